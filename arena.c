@@ -0,0 +1,171 @@
+/* arena.c - memory for building one packet at a time
+ *
+ * A packet that isn't built from the template (see sendip.c) is put
+ * together afresh each time round the loop: every module's initialize()
+ * wants its sendip_data and a header, do_opt() grows the header for
+ * options and takes a little scratch space to parse them, and sendip
+ * wants a buffer to stick the headers together in. None of it outlives
+ * the packet, so it all comes from here, a bump of a pointer at a time,
+ * and sendip calls arena_reset() before the next packet to have it all
+ * back at once.
+ *
+ * When a packet needs more than the arena has, another block comes from
+ * the heap; the next reset swaps the blocks for one block as big as all
+ * of them, so from the second packet or so on, building a packet takes
+ * no heap allocations at all. arena_counts keeps count, for -v.
+ *
+ * arena_free() of arena memory only gives back the latest allocation
+ * (scratch space, typically); arena_realloc() and arena_free() pass
+ * anything that isn't the arena's on to realloc() and free(). The arena
+ * is per process, like the random numbers.
+ */
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sendip_module.h"
+
+/* Allocations are aligned as malloc()'s are, each after its length */
+#define ARENA_ALIGN	16
+#define ARENA_ROUND(n)	(((n)+ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1))
+#define ARENA_MIN	16384	/* first block */
+
+typedef struct arena_block {
+	struct arena_block *next;
+	size_t size;		/* bytes after the block header */
+	size_t used;
+} arena_block;
+
+#define ARENA_BLOCK	ARENA_ROUND(sizeof(arena_block))
+
+arena_stats arena_counts;
+
+static arena_block *blocks;	/* newest, the one in use, first */
+static u_int8_t *arena_last;	/* latest allocation, which can grow */
+
+static u_int8_t *arena_base(arena_block *b) {
+	return (u_int8_t *)b + ARENA_BLOCK;
+}
+
+static size_t *arena_len(void *p) {
+	return (size_t *)((u_int8_t *)p - ARENA_ALIGN);
+}
+
+static bool arena_owns(const void *p) {
+	arena_block *b;
+
+	for (b=blocks; b!=NULL; b=b->next)
+		if ((const u_int8_t *)p >= arena_base(b) &&
+		    (const u_int8_t *)p < arena_base(b)+b->size)
+			return TRUE;
+	return FALSE;
+}
+
+/* A new block with room for at least need bytes */
+static arena_block *arena_grow(size_t need) {
+	size_t size = blocks ? 2*blocks->size : ARENA_MIN;
+	arena_block *b;
+
+	while (size < need)
+		size *= 2;
+	if ((b = malloc(ARENA_BLOCK+size)) == NULL)
+		return NULL;
+	arena_counts.heap_allocs++;
+	b->size = size;
+	b->used = 0;
+	b->next = blocks;
+	blocks = b;
+	return b;
+}
+
+void *arena_alloc(size_t len) {
+	size_t need = ARENA_ALIGN + ARENA_ROUND(len);
+	arena_block *b = blocks;
+
+	if (b == NULL || b->size - b->used < need)
+		if ((b = arena_grow(need)) == NULL)
+			return NULL;
+	arena_last = arena_base(b) + b->used + ARENA_ALIGN;
+	b->used += need;
+	*arena_len(arena_last) = len;
+	arena_counts.allocs++;
+	return arena_last;
+}
+
+void *arena_realloc(void *p, size_t len) {
+	size_t old;
+	void *q;
+
+	if (p == NULL)
+		return arena_alloc(len);
+	if (!arena_owns(p)) {
+		arena_counts.heap_allocs++;
+		return realloc(p, len);
+	}
+	old = *arena_len(p);
+	/* The latest allocation can grow where it is */
+	if (p == arena_last) {
+		size_t at = (u_int8_t *)p - arena_base(blocks);
+
+		if (at + ARENA_ROUND(len) <= blocks->size) {
+			blocks->used = at + ARENA_ROUND(len);
+			*arena_len(p) = len;
+			return p;
+		}
+	}
+	if ((q = arena_alloc(len)) != NULL)
+		memcpy(q, p, old < len ? old : len);
+	return q;
+}
+
+void arena_free(void *p) {
+	if (p == NULL)
+		return;
+	if (!arena_owns(p)) {
+		free(p);
+	} else if (p == arena_last) {
+		blocks->used = arena_last - ARENA_ALIGN - arena_base(blocks);
+		arena_last = NULL;
+	}
+}
+
+/* Everything allocated so far is finished with */
+void arena_reset(void) {
+	arena_block *b, *next;
+	size_t total = 0;
+
+	if (blocks && blocks->next) {
+		for (b=blocks; b!=NULL; b=next) {
+			next = b->next;
+			total += b->size;
+			free(b);
+		}
+		blocks = NULL;
+		(void)arena_grow(total);
+	}
+	if (blocks)
+		blocks->used = 0;
+	arena_last = NULL;
+}
+
+void arena_close(void) {
+	arena_block *b, *next;
+
+	for (b=blocks; b!=NULL; b=next) {
+		next = b->next;
+		free(b);
+	}
+	blocks = NULL;
+	arena_last = NULL;
+}
+
+void arena_report(const char *who) {
+	arena_stats *s = &arena_counts;
+
+	if (!s->allocs) return;
+	fprintf(stderr, "%s memory: %llu allocations from the arena, %llu from"
+	        " the heap, %llu after the first packet\n", who, s->allocs,
+	        s->heap_allocs, s->heap_allocs-s->first_packet);
+}
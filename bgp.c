@@ -128,13 +128,13 @@ sendip_data *initialize (void)
 	sendip_data *data = NULL;
 	u_int8_t    *ptr;
 
-	data = malloc(sizeof(sendip_data));
+	data = arena_alloc(sizeof(sendip_data));
 
 	if (data != NULL) {
 		memset(data, 0, sizeof(sendip_data));
-		data->data = malloc(BGP_BUFLEN);
+		data->data = arena_alloc(BGP_BUFLEN);
 		if (data->data == NULL) {
-			free(data);
+			arena_free(data);
 			data = NULL;
 		}
 	}
@@ -0,0 +1,74 @@
+/* builtin.c - the table of modules linked into sendip itself
+ *
+ * make static builds sendip-static, with the modules in $(BUILTINS)
+ * linked in rather than loaded from .so files. Each module is compiled
+ * as usual, then objcopy makes everything in it local except its entry
+ * points, and renames those sendip_<module>_<entry> so the modules
+ * don't clash (see the Makefile). This file is compiled with
+ * SENDIP_BUILTINS set to BUILTIN(ipv4) BUILTIN(ipv6) ... and gives
+ * load_module() a table to look in before it tries dlopen(), so -p
+ * ipv4 costs no more than a string compare. Anything not in the table
+ * is still loaded from a .so.
+ *
+ * The entry points are weak references, so that those a module
+ * doesn't have (do_pad, finalize_batch, ...) come out NULL, as dlsym()
+ * would give them. In the ordinary build the table is empty.
+ */
+
+#include <string.h>
+#include "builtin.h"
+
+#ifdef SENDIP_BUILTINS
+
+#define BUILTIN_ENTRIES(m, X) \
+	X(m, initialize) X(m, do_opt) X(m, do_pad) X(m, set_addr) \
+	X(m, finalize) X(m, finalize_batch) X(m, num_opts) X(m, get_opts) \
+	X(m, get_optchar) X(m, num_fields) X(m, get_fields)
+
+/* Only the address is wanted, so the type doesn't matter */
+#define BUILTIN_DECLARE(m, e)	extern void sendip_##m##_##e(void) __attribute__((weak));
+#define BUILTIN_SYM(m, e)	{ #e, (void *)sendip_##m##_##e },
+
+#define BUILTIN(m)	BUILTIN_ENTRIES(m, BUILTIN_DECLARE)
+SENDIP_BUILTINS
+#undef BUILTIN
+
+#define BUILTIN(m) \
+	static const builtin_sym builtin_##m[] = { \
+		BUILTIN_ENTRIES(m, BUILTIN_SYM) { NULL, NULL } \
+	};
+SENDIP_BUILTINS
+#undef BUILTIN
+
+#define BUILTIN(m)	{ #m, builtin_##m },
+static const builtin_module builtins[] = {
+	SENDIP_BUILTINS
+	{ NULL, NULL }
+};
+#undef BUILTIN
+
+#else
+
+static const builtin_module builtins[] = {
+	{ NULL, NULL }
+};
+
+#endif /* SENDIP_BUILTINS */
+
+const builtin_module *builtin_find(const char *name) {
+	const builtin_module *mod;
+
+	for (mod=builtins; mod->name; mod++)
+		if (!strcmp(mod->name, name))
+			return mod;
+	return NULL;
+}
+
+void *builtin_sym_addr(const builtin_module *mod, const char *name) {
+	const builtin_sym *sym;
+
+	for (sym=mod->syms; sym->name; sym++)
+		if (!strcmp(sym->name, name))
+			return sym->addr;
+	return NULL;
+}
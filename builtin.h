@@ -0,0 +1,22 @@
+/* builtin.h - modules linked into sendip itself
+ */
+#ifndef _SENDIP_BUILTIN_H
+#define _SENDIP_BUILTIN_H
+
+/* A module's entry points, by the names dlsym() would look for. Those
+ * the module doesn't have are NULL.
+ */
+typedef struct {
+	const char *name;
+	void *addr;
+} builtin_sym;
+
+typedef struct {
+	const char *name;		/* as given to -p */
+	const builtin_sym *syms;	/* ends with a NULL name */
+} builtin_module;
+
+const builtin_module *builtin_find(const char *name);
+void *builtin_sym_addr(const builtin_module *mod, const char *name);
+
+#endif  /* _SENDIP_BUILTIN_H */
@@ -83,7 +83,7 @@ int compact_string(char *data_out) {
  * Note the handling of space is slightly screwy - compact_string
  * above overwrites its argument in place, since it knows that
  * no matter what, the string it produces can be no longer than
- * its argument. randombytes and zerobytes, however, use a static
+ * its argument. randombytes and zerobytes, however, use static
  * areas, since the calling argument there (something like r32) will
  * generally be much shorter than the string produced.
  *
@@ -92,114 +92,28 @@ int compact_string(char *data_out) {
  * don't matter. But this should be kept in mind if these routines
  * are used elsewhere.
  */
-/*
- * randomfill() expects a 32-bit pseudorandom value, i.e., one between
- * 0 and 2^32-1, inclusive. However, random(), for historical reasons,
- * only returns 31 random bits - the most significant bit is always 0.
- * So to get a full 32-bit value, you can either call random() twice
- * and add the results (which seems wasteful for just one bit) or use
- * a different function. A couple of possibilites for the latter are
- * jrand48() (or one of its related siblings), or the "dirtyrand()"
- * function below. Neither of these perform quite as well on tests
- * of "randomness" as random(), but they both do give a full 32 bits,
- * and both are considerably faster than random(). On my system
- * (64-bit Linux), jrand48() is about 30% faster, and dirtyrand()
- * is about six times as fast.
- *
- * Note: as employed here, neither jrand48() nor dirtyrand() are
- * thread-safe. The static values would have to be per-thread (e.g., passed
- * in as paramaters) for that. Though I understand that jrand48() still
- * has some other static value in its implementation somewhere that
- * presents an issue. In the context of sendip, which isn't intended
- * to be threaded, this isn't a problem, but it may be elsewhere.
- *
- * Of course, for a pseudorandom number generator, all that threading
- * might do is make the values returned actually random rather than just
- * pseudorandom. For reproducibility, this isn't good, but for other
- * purposes, it may be fine.
- */
-#define USE_DIRTY	1	/* Use the simpler/faster one */
-#ifdef USE_DIRTY
-
-/* This is adapted from an old hash generator. The magic numbers are all
- * relatively prime to each other, which at least guarantees a long
- * period. In practice, it seems to have a decent spread. This was
- * written with 64-bit arithmetic in mind, and would require some
- * adaptation for good performance on a 32-bit system.
- */
-u_int32_t
-dirtyrand(void)
-{
-	static u_int64_t dirtybase=1927868237;
-	union {
-		u_int64_t whole;
-		u_int32_t half[2];
-	} answer;
-
-	answer.whole = dirtybase * 69069 + 907133923;
-	dirtybase = answer.whole;
-	return answer.half[0]^answer.half[1];
-}
-#define	myrandom()	dirtyrand()
-
-#else 	/* !USE_DIRTY */
-/* static version of jrand48(), for convenience */
-u_int32_t
-sjrand48(void)
-{
-	static unsigned short xsubi[3];
-
-	return (u_int32_t)jrand48(xsubi);
-}
-#define	myrandom()	sjrand48()
-
-#endif
-
-u_int32_t randomcalls;
-static void
-randomfill(u_int32_t *buffer, int length)
-{
-	int i;
-
-	for (i=0; i < length; ++i) {
-		++randomcalls;
-		/*buffer[i] = (u_int32_t)random()+(u_int32_t)random();*/
-		buffer[i] = (u_int32_t)myrandom();
-	}
-}
-
-/* @@ Return a pointer to a string of random bytes. Note this is a
- * static area which is periodically overwritten.
+/* @@ Return a pointer to a string of random bytes (see random.c). Note
+ * this is a static area which is overwritten by the next call; it grows
+ * to fit, so there is no limit on the length.
  */
 u_int8_t *
 randombytes(int length)
 {
-	static union {
-		u_int32_t random32[MAXRAND/4];
-		u_int8_t random8[MAXRAND];
-	} store;
-	static int rnext=MAXRAND;
-	u_int8_t *answer;
+	static u_int8_t *store;
+	static int size;
 
-	/* Sanity check */
-	if (length > MAXRAND) {
-		usage_error("Random data too long to be sane\n");
-		return NULL;
-	}
-	/* This could be done more efficiently ... */
-	if (length+rnext >= MAXRAND) {
-		randomfill(store.random32, MAXRAND/4);
-		rnext = 0;
-	}
-	answer = &store.random8[rnext];
-	rnext += length;
+	if (length > size) {
+		u_int8_t *bigger = realloc(store, length);
 
-#ifdef notdef
-	/* Zero-pad out to 64-bit boundary */
-	/*@@ why did I do this ? */ for (; i&07; ++i)
-		answer.answer8[i] = 0;
-#endif
-	return answer;
+		if (!bigger) {
+			usage_error("Random data too long to be sane\n");
+			return NULL;
+		}
+		store = bigger;
+		size = length;
+	}
+	randomfill(store, length);
+	return store;
 }
 
 /* @@ Return a pointer to a string of zero bytes. Note this is a
@@ -291,6 +205,44 @@ stringargument(char *input, char **output)
 	return length;
 }
 
+/* A plain number, or the next value of a range (see range.c) */
+static unsigned long
+numberargument(const char *input)
+{
+	u_int64_t value;
+
+	if (isrange(input) && rangeargument(input, AF_UNSPEC, &value))
+		return value;
+	return strtoul(input, (char **)NULL, 0);
+}
+
+/* Cut value down to length bytes, in network or host order */
+static u_int32_t
+networkinteger(unsigned long value, int length)
+{
+	switch (length) {
+	case 1:
+		return (u_int8_t)value;
+	case 2:
+		return htons((u_int16_t)value);
+	default:
+		return htonl(value);
+	}
+}
+
+static u_int32_t
+hostinteger(unsigned long value, int length)
+{
+	switch (length) {
+	case 1:
+		return (u_int8_t)value;
+	case 2:
+		return (u_int16_t)value;
+	default:
+		return value;
+	}
+}
+
 /* @@ This is the integer (1, 2 or 4 byte) version of the above. It takes
  * the input, which may be decimal, octal, hex, or the special strings
  * rX (random bytes) or zX (zero bytes - kind of pointless) and converts
@@ -305,6 +257,7 @@ integerargument(const char *input, int length)
 {
 	int inputlength;
 	void *string;
+	u_int64_t column;
 
 	if (!input || !length) return 0;
 	/* Special case for rN, zN strings */
@@ -335,20 +288,16 @@ integerargument(const char *input, int length)
 		/* like I said, pointless ... */
 		return 0;
 	case 'f':
+		/* A column of numbers is converted already */
+		if (filecolumn(input+1, AF_UNSPEC, &column))
+			return networkinteger(column, length);
 		return integerargument(fileargument(input+1), length);
 	default:
 		break;
 	}
 
 	/* Everything else, just use strtoul, then cast and swap */
-	switch (length) {
-	case 1:
-		return (u_int8_t)strtoul(input, (char **)NULL, 0);
-	case 2:
-		return htons((u_int16_t)strtoul(input, (char **)NULL, 0));
-	default:
-		return htonl(strtoul(input, (char **)NULL, 0));
-	}
+	return networkinteger(numberargument(input), length);
 }
 
 
@@ -358,6 +307,7 @@ hostintegerargument(const char *input, int length)
 {
 	int inputlength;
 	void *string;
+	u_int64_t column;
 
 	if (!input || !length) return 0;
 	/* Special case for rN, zN, fN strings */
@@ -385,20 +335,15 @@ hostintegerargument(const char *input, int length)
 		/* like I said, pointless ... */
 		return 0;
 	case 'f':
+		if (filecolumn(input+1, AF_UNSPEC, &column))
+			return hostinteger(column, length);
 		return hostintegerargument(fileargument(input+1), length);
 	default:
 		break;
 	}
 
 	/* Everything else, just use strtoul, then cast */
-	switch (length) {
-	case 1:
-		return (u_int8_t)strtoul(input, (char **)NULL, 0);
-	case 2:
-		return (u_int16_t)strtoul(input, (char **)NULL, 0);
-	default:
-		return strtoul(input, (char **)NULL, 0);
-	}
+	return hostinteger(numberargument(input), length);
 }
 /* @@ IPv4 dotted decimal arguments can be specified in several ways.
  * First off, you can use the rN random arguments as above:
@@ -415,9 +360,13 @@ hostintegerargument(const char *input, int length)
  * Note the CIDR specification won't generate either a 0 or all 1s (broadcast)
  * in the host portion of the address, while the rN method above can.
  *
+ * You can also give a range, 10.0.0.1-10.0.255.254, which is gone
+ * through in order, or once each in a pseudorandom order with a /%
+ * suffix (see range.c), one address per packet when looping.
+ *
  * Finally, you can use file arguments - most useful when you are using
  * looping, and working through a list of addresses. The addresses can
- * include the random or CIDR-type specifications above.
+ * include the random, CIDR-type or range specifications above.
  *
  * If you're wondering why the different types, the answer is that I
  * only did the first type at first, because it was easiest to implement,
@@ -471,14 +420,24 @@ ipv4argument(const char *input, int length)
 	static char ipv4space[BUFSIZ]; /* actual max around 40 */
 	u_int32_t a, b, c, d;
 	char *dotpoint, *slashpoint;
+	in_addr_t addr;
 
 	/* Special case for fN strings */
 	switch (*input) {
 	case 'f':
+		/* A column of addresses is converted already */
+		if (filecolumn(input+1, AF_INET, &addr))
+			return addr;
 		return ipv4argument(fileargument(input+1), length);
 	default:
 		break;
 	}
+	/* Ranges, which may have a / too */
+	if (isrange(input)) {
+		addr = 0;
+		(void)rangeargument(input, AF_INET, &addr);
+		return addr;
+	}
 	/* Special case for CIDR notation */
 	if ((slashpoint=strchr(input, '/'))) {
 		return cidrargument(input, slashpoint, length);
@@ -514,3 +473,58 @@ ipv4argument(const char *input, int length)
 	return inet_addr(ipv4space);
 }
 
+/* IPv6 addresses may be given as usual, as a range of the last 64 bits
+ * (see range.c) or, failing those, as fF. That's tried last, since
+ * plenty of IPv6 addresses start with f. Returns FALSE if there's no
+ * address to be had.
+ */
+bool
+ipv6argument(const char *input, struct in6_addr *addr)
+{
+	if (!input) return FALSE;
+	if (isrange(input))
+		return rangeargument(input, AF_INET6, addr);
+	if (inet_pton(AF_INET6, input, addr) > 0)
+		return TRUE;
+	if (*input == 'f') {
+		if (filecolumn(input+1, AF_INET6, addr))
+			return TRUE;
+		return ipv6argument(fileargument(input+1), addr);
+	}
+	return FALSE;
+}
+
+/* @@ Tell whether an argument may produce a different value each time
+ * it is evaluated, i.e., whether it uses any of the rN, r, tN, fF,
+ * CIDR or range forms above. This errs on the side of saying yes; it is used
+ * when looping to decide which fields must be regenerated for each
+ * packet and which can be left alone.
+ */
+bool
+dynamicargument(const char *input)
+{
+	const char *p;
+
+	if (!input) return FALSE;
+	switch (*input) {
+	case 'f':
+		return TRUE;
+	case 'r':
+		if (!input[1] || isdigit(input[1]))
+			return TRUE;
+		break;
+	case 't':
+		if (isdigit(input[1]))
+			return TRUE;
+		break;
+	default:
+		break;
+	}
+	if (strchr(input, '/') || isrange(input))
+		return TRUE;
+	for (p=input; (p=strchr(p, '.')); ++p) {
+		if (p[1] == 'r' && isdigit(p[2]))
+			return TRUE;
+	}
+	return FALSE;
+}
@@ -3,21 +3,457 @@
  *	ChangeLog since sendip 2.0:
  * 02/12/2001: Moved ipv6_csum into icmp.c as that is where it is used
  * 22/01/2002: Include types.h to make sure u_int*_t defined on Solaris
+ *
+ * Checksums over several separate pieces of data (pseudo header,
+ * transport header, payload) are summed where the pieces lie, with
+ * csum_partial() or csumv(), rather than copied together first. A
+ * piece of odd length leaves the next one starting half way through a
+ * 16 bit word; that piece's sum is then byte swapped, which comes to
+ * the same thing (RFC1071 section 2(B)).
  */
 
 #define __USE_BSD    /* GLIBC */
 #define _DEFAULT_SOURCE  /* LIBC5 */
 #include <sys/types.h>
+#include <stdio.h>
 #include <netinet/in_systm.h>
 #include <netinet/in.h>
 #include <string.h>
 #include <stdlib.h>
-#include "types.h"
+#include "sendip_module.h"
 
-u_int16_t csum (u_int16_t *packet, int packlen);
+/* Summing the data as 32 bit (or wider) words and folding the total
+ * back down to 16 bits gives the same answer as summing 16 bit words,
+ * whatever the byte order, so the block sums below all work on words
+ * as wide as they can and leave the folding to csum_fold16(). The
+ * totals are 64 bit, which can't overflow for anything we could send.
+ */
+typedef u_int64_t (*csum_fn)(const u_int8_t *p, int len);
+typedef u_int64_t (*csum_copy_fn)(u_int8_t *d, const u_int8_t *p, int len);
+
+/* Add the last few (under 4) bytes of a block */
+static u_int64_t csum_tail(const u_int8_t *p, int len) {
+	u_int16_t w;
+	u_int64_t sum = 0;
+
+	if (len > 1) {
+		memcpy(&w, p, 2);
+		sum += w;
+		p += 2;
+		len -= 2;
+	}
+
+	/* The last byte is the first half of a word, whatever the byte order */
+	if (len > 0) {
+		w = 0;
+		*(u_int8_t *)&w = *p;
+		sum += w;
+	}
+	return sum;
+}
+
+/* Sum len bytes from p, in host byte order, not folded. This one works
+ * anywhere.
+ */
+static u_int64_t csum_words(const u_int8_t *p, int len) {
+	u_int64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	u_int32_t w[4];
+
+	while (len >= 16) {
+		memcpy(w, p, 16);
+		s0 += w[0];
+		s1 += w[1];
+		s2 += w[2];
+		s3 += w[3];
+		p += 16;
+		len -= 16;
+	}
+	while (len >= 4) {
+		memcpy(w, p, 4);
+		s0 += w[0];
+		p += 4;
+		len -= 4;
+	}
+	return s0 + s1 + s2 + s3 + csum_tail(p, len);
+}
+
+/* The same, copying the data to d as it goes */
+static u_int64_t csum_copy_words(u_int8_t *d, const u_int8_t *p, int len) {
+	u_int64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	u_int32_t w[4];
+
+	while (len >= 16) {
+		memcpy(w, p, 16);
+		memcpy(d, w, 16);
+		s0 += w[0];
+		s1 += w[1];
+		s2 += w[2];
+		s3 += w[3];
+		p += 16;
+		d += 16;
+		len -= 16;
+	}
+	while (len >= 4) {
+		memcpy(w, p, 4);
+		memcpy(d, w, 4);
+		s0 += w[0];
+		p += 4;
+		d += 4;
+		len -= 4;
+	}
+	memcpy(d, p, len);
+	return s0 + s1 + s2 + s3 + csum_tail(p, len);
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CSUM_X86
+#include <immintrin.h>
+
+/* Each 32 bit word is widened into a 64 bit lane and added there, so
+ * the lanes never carry into each other.
+ */
+__attribute__((target("sse2")))
+static u_int64_t csum_sse2(const u_int8_t *p, int len) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i a0 = zero, a1 = zero;
+	u_int64_t lane[2];
+
+	while (len >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+
+		a0 = _mm_add_epi64(a0, _mm_unpacklo_epi32(v, zero));
+		a1 = _mm_add_epi64(a1, _mm_unpackhi_epi32(v, zero));
+		p += 16;
+		len -= 16;
+	}
+	_mm_storeu_si128((__m128i *)lane, _mm_add_epi64(a0, a1));
+	return lane[0] + lane[1] + csum_words(p, len);
+}
+
+__attribute__((target("avx2")))
+static u_int64_t csum_avx2(const u_int8_t *p, int len) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i a0 = zero, a1 = zero, a2 = zero, a3 = zero;
+	u_int64_t lane[4];
+
+	/* Two loads at a time, to keep the adders busy */
+	while (len >= 64) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+		__m256i u = _mm256_loadu_si256((const __m256i *)(p+32));
+
+		a0 = _mm256_add_epi64(a0, _mm256_unpacklo_epi32(v, zero));
+		a1 = _mm256_add_epi64(a1, _mm256_unpackhi_epi32(v, zero));
+		a2 = _mm256_add_epi64(a2, _mm256_unpacklo_epi32(u, zero));
+		a3 = _mm256_add_epi64(a3, _mm256_unpackhi_epi32(u, zero));
+		p += 64;
+		len -= 64;
+	}
+	if (len >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+
+		a0 = _mm256_add_epi64(a0, _mm256_unpacklo_epi32(v, zero));
+		a1 = _mm256_add_epi64(a1, _mm256_unpackhi_epi32(v, zero));
+		p += 32;
+		len -= 32;
+	}
+	a0 = _mm256_add_epi64(_mm256_add_epi64(a0, a1), _mm256_add_epi64(a2, a3));
+	_mm256_storeu_si256((__m256i *)lane, a0);
+	return lane[0] + lane[1] + lane[2] + lane[3] + csum_words(p, len);
+}
+
+__attribute__((target("sse2")))
+static u_int64_t csum_copy_sse2(u_int8_t *d, const u_int8_t *p, int len) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i a0 = zero, a1 = zero;
+	u_int64_t lane[2];
+
+	while (len >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+
+		_mm_storeu_si128((__m128i *)d, v);
+		a0 = _mm_add_epi64(a0, _mm_unpacklo_epi32(v, zero));
+		a1 = _mm_add_epi64(a1, _mm_unpackhi_epi32(v, zero));
+		p += 16;
+		d += 16;
+		len -= 16;
+	}
+	_mm_storeu_si128((__m128i *)lane, _mm_add_epi64(a0, a1));
+	return lane[0] + lane[1] + csum_copy_words(d, p, len);
+}
+
+__attribute__((target("avx2")))
+static u_int64_t csum_copy_avx2(u_int8_t *d, const u_int8_t *p, int len) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i a0 = zero, a1 = zero, a2 = zero, a3 = zero;
+	u_int64_t lane[4];
+
+	while (len >= 64) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+		__m256i u = _mm256_loadu_si256((const __m256i *)(p+32));
+
+		_mm256_storeu_si256((__m256i *)d, v);
+		_mm256_storeu_si256((__m256i *)(d+32), u);
+		a0 = _mm256_add_epi64(a0, _mm256_unpacklo_epi32(v, zero));
+		a1 = _mm256_add_epi64(a1, _mm256_unpackhi_epi32(v, zero));
+		a2 = _mm256_add_epi64(a2, _mm256_unpacklo_epi32(u, zero));
+		a3 = _mm256_add_epi64(a3, _mm256_unpackhi_epi32(u, zero));
+		p += 64;
+		d += 64;
+		len -= 64;
+	}
+	a0 = _mm256_add_epi64(_mm256_add_epi64(a0, a1), _mm256_add_epi64(a2, a3));
+	_mm256_storeu_si256((__m256i *)lane, a0);
+	return lane[0] + lane[1] + lane[2] + lane[3] + csum_copy_sse2(d, p, len);
+}
+#endif /* CSUM_X86 */
+
+/* Short blocks (headers, mostly) aren't worth the vector setup */
+#define CSUM_VECTOR_MIN	64
+
+static u_int64_t csum_pick(const u_int8_t *p, int len);
+static u_int64_t csum_copy_pick(u_int8_t *d, const u_int8_t *p, int len);
+static csum_fn csum_vector = csum_pick;
+static csum_copy_fn csum_copy_vector = csum_copy_pick;
+
+/* Find out, on first use, what this CPU can do */
+static void csum_select(void) {
+	csum_vector = csum_words;
+	csum_copy_vector = csum_copy_words;
+#ifdef CSUM_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		csum_vector = csum_avx2;
+		csum_copy_vector = csum_copy_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		csum_vector = csum_sse2;
+		csum_copy_vector = csum_copy_sse2;
+	}
+#endif
+}
+
+static u_int64_t csum_pick(const u_int8_t *p, int len) {
+	csum_select();
+	return csum_vector(p, len);
+}
+
+static u_int64_t csum_copy_pick(u_int8_t *d, const u_int8_t *p, int len) {
+	csum_select();
+	return csum_copy_vector(d, p, len);
+}
+
+/* Sum len bytes from p, as 16 bit words in host byte order, not folded */
+static u_int64_t csum_block(const u_int8_t *p, int len) {
+	if (len < CSUM_VECTOR_MIN)
+		return csum_words(p, len);
+	return csum_vector(p, len);
+}
+
+static u_int32_t csum_fold16(u_int64_t sum) {
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (u_int32_t)sum;
+}
 
 /* Checksum a block of data */
 u_int16_t csum (u_int16_t *packet, int packlen) {
+	return (u_int16_t) ~csum_fold16(csum_block((u_int8_t *)packet, packlen));
+}
+
+/* Add len bytes at buf to a running (unfolded, uncomplemented) sum.
+ * *odd says whether the data summed so far came to an odd number of
+ * bytes, and is updated; start with sum 0 and *odd FALSE.
+ */
+u_int32_t csum_partial(const void *buf, int len, u_int32_t sum, bool *odd) {
+	u_int32_t s = csum_fold16(csum_block((const u_int8_t *)buf, len));
+
+	if (*odd)
+		s = ((s & 0xff) << 8) | (s >> 8);
+	if (len & 1)
+		*odd = !*odd;
+	return csum_fold16((u_int64_t)sum + s);
+}
+
+/* csum_partial(), copying the data to dst at the same time (like the
+ * kernel's csum_partial_copy()), so that putting the payload in the
+ * packet gives its sum for nothing
+ */
+u_int32_t csum_partial_copy(void *dst, const void *src, int len,
+                            u_int32_t sum, bool *odd) {
+	u_int32_t s;
+
+	if (len < CSUM_VECTOR_MIN)
+		s = csum_fold16(csum_copy_words(dst, src, len));
+	else
+		s = csum_fold16(csum_copy_vector(dst, src, len));
+	if (*odd)
+		s = ((s & 0xff) << 8) | (s >> 8);
+	if (len & 1)
+		*odd = !*odd;
+	return csum_fold16((u_int64_t)sum + s);
+}
+
+/* Finish off a sum from csum_partial() */
+u_int16_t csum_fold(u_int32_t sum) {
+	return (u_int16_t) ~csum_fold16(sum);
+}
+
+/* Checksum a vector of blocks of data, ending with a zero length. The
+ * blocks may be of any length, odd or even.
+ */
+u_int16_t csumv (u_int16_t *packet[], int packlen[]) {
+	u_int32_t sum = 0;
+	bool odd = FALSE;
+	int i;
+
+	for (i=0; packlen[i]; ++i)
+		sum = csum_partial(packet[i], packlen[i], sum, &odd);
+
+	return csum_fold(sum);
+}
+
+/* Incremental updates (RFC 1624).
+ * csum_cover() checksums a pseudo header and a header (together, the
+ * "cover") followed by the data after them. For each key (a module's
+ * header) it remembers the cover and the partial sums of the two
+ * regions, cover and data, separately. Next time:
+ *  - if the cover is the same length, only the 16 bit words of it that
+ *    differ are folded into the old sum, using ~m + m' (RFC 1624 eqn.
+ *    3), so a change of source address in the IP header only costs the
+ *    two pseudo header words it touches;
+ *  - if the caller says the data is the same as before, its old sum is
+ *    used without reading it; if sendip summed it while copying it in,
+ *    that sum is used;
+ * and the checksum is the two sums added and folded. csum_counts keeps
+ * score, for sendip -v.
+ */
+#define CSUM_CACHE_SLOTS	16	/* headers we remember covers for */
+
+typedef struct {
+	const void *key;
+	const void *data;
+	int datalen;
+	int len;		/* of the cover, -1 when nothing is cached */
+	u_int32_t coversum;	/* csum_partial() sums of each region */
+	u_int32_t datasum;
+	u_int16_t cover[CSUM_COVER_MAX/2];
+} csum_cache;
+
+static csum_cache csum_caches[CSUM_CACHE_SLOTS];
+static int csum_victim;
+csum_stats csum_counts;
+
+static csum_cache *csum_find(const void *key) {
+	csum_cache *c;
+	int i;
+
+	for (i=0; i<CSUM_CACHE_SLOTS; i++)
+		if (csum_caches[i].key == key)
+			return &csum_caches[i];
+	c = &csum_caches[csum_victim];
+	csum_victim = (csum_victim+1) % CSUM_CACHE_SLOTS;
+	c->key = key;
+	c->len = -1;
+	return c;
+}
+
+/* Add the data (if any) to a sum of cover bytes, using the sum worked
+ * out when the data was put in place if there is one
+ */
+static u_int32_t csum_data(u_int32_t sum, bool odd, sendip_data *data) {
+	u_int32_t s;
+
+	if (!data || !data->alloc_len)
+		return sum;
+	if (!(data->modified & SENDIP_DATA_SUMMED)) {
+		csum_counts.data_misses++;
+		return csum_partial(data->data, data->alloc_len, sum, &odd);
+	}
+	csum_counts.data_summed++;
+	s = data->csum;
+	if (odd)
+		s = ((s & 0xff) << 8) | (s >> 8);
+	return csum_fold16((u_int64_t)sum + s);
+}
+
+/* The checksum of plen bytes of pseudo header, hlen of header and the
+ * data. SENDIP_DATA_SAME in data->modified says that the data hasn't
+ * changed since the last call for key.
+ */
+u_int16_t csum_cover(const void *key, const void *pseudo, int plen,
+                     const void *hdr, int hlen, sendip_data *data) {
+	csum_cache *c = csum_find(key);
+	u_int16_t w[CSUM_COVER_MAX/2];
+	int len = plen+hlen;
+	const void *dp = data ? data->data : NULL;
+	int datalen = data ? data->alloc_len : 0;
+	bool same = !data || (data->modified & SENDIP_DATA_SAME);
+	u_int32_t sum;
+	bool odd = FALSE;
+	int i, changed;
+
+	if (len > CSUM_COVER_MAX || (plen & 1) || (hlen & 1)) {
+		c->len = -1;
+		csum_counts.cover_misses++;
+		sum = csum_partial(pseudo, plen, 0, &odd);
+		sum = csum_partial(hdr, hlen, sum, &odd);
+		return csum_fold(csum_data(sum, odd, data));
+	}
+	memcpy(w, pseudo, plen);
+	memcpy((u_int8_t *)w+plen, hdr, hlen);
+
+	if (c->len == len) {
+		sum = c->coversum;
+		for (i=changed=0; i<len/2; i++) {
+			if (w[i] != c->cover[i]) {
+				sum += (u_int16_t)~c->cover[i] + w[i];
+				changed++;
+			}
+		}
+		c->coversum = csum_fold16(sum);
+		if (changed)
+			csum_counts.cover_updates++;
+		else
+			csum_counts.cover_hits++;
+	} else {
+		c->coversum = csum_partial(w, len, 0, &odd);
+		c->len = len;
+		csum_counts.cover_misses++;
+	}
+	memcpy(c->cover, w, len);
+
+	if (!datalen) {
+		c->datasum = 0;
+	} else if (same && c->data == dp && c->datalen == datalen) {
+		csum_counts.data_hits++;
+	} else {
+		c->datasum = csum_data(0, FALSE, data);
+	}
+	c->data = dp;
+	c->datalen = datalen;
+	return csum_fold(c->coversum + c->datasum);
+}
+
+/* Print csum_counts, if any checksums were done */
+void csum_report(const char *who) {
+	csum_stats *s = &csum_counts;
+	unsigned long long covers = s->cover_hits+s->cover_updates+s->cover_misses;
+	unsigned long long datas = s->data_hits+s->data_summed+s->data_misses;
+
+	if (!covers) return;
+	fprintf(stderr, "%s checksums: headers %llu same, %llu updated, %llu summed"
+	        " (%.1f%% reused)", who, s->cover_hits, s->cover_updates,
+	        s->cover_misses, 100.0*(covers-s->cover_misses)/covers);
+	if (datas)
+		fprintf(stderr, "; data %llu same, %llu summed on copy, %llu read"
+		        " (%.1f%% not read)", s->data_hits, s->data_summed,
+		        s->data_misses, 100.0*(datas-s->data_misses)/datas);
+	fprintf(stderr, "\n");
+}
+
+#if defined(CSUM_TEST) || defined(CSUM_BENCH)
+
+/* The original loop, a 16 bit word at a time, to check against */
+static u_int16_t csum_ref(u_int16_t *packet, int packlen) {
 	register unsigned long sum = 0;
 
 	while (packlen > 1) {
@@ -28,33 +464,343 @@ u_int16_t csum (u_int16_t *packet, int packlen) {
 	if (packlen > 0)
 		sum += *(unsigned char *)packet;
 
-	/* TODO: this depends on byte order */
-
 	while (sum >> 16)
 		sum = (sum & 0xffff) + (sum >> 16);
 
 	return (u_int16_t) ~sum;
 }
 
-/* Checksum a vector of blocks of data */
-u_int16_t csumv (u_int16_t *packet[], int packlen[]) {
-	register unsigned long sum = 0;
-	int i;
+static const struct {
+	const char *name;
+	csum_fn fn;
+	csum_copy_fn copy;
+} csum_kernels[] = {
+	{ "words", csum_words, csum_copy_words },
+#ifdef CSUM_X86
+	{ "sse2", csum_sse2, csum_copy_sse2 },
+	{ "avx2", csum_avx2, csum_copy_avx2 },
+#endif
+};
+#define CSUM_KERNELS	((int)(sizeof(csum_kernels)/sizeof(csum_kernels[0])))
+
+static bool csum_usable(csum_fn fn) {
+#ifdef CSUM_X86
+	__builtin_cpu_init();
+	if (fn == csum_avx2) return __builtin_cpu_supports("avx2");
+	if (fn == csum_sse2) return __builtin_cpu_supports("sse2");
+#endif
+	return TRUE;
+}
+#endif /* CSUM_TEST || CSUM_BENCH */
+
+#ifdef CSUM_TEST
+/* cc -DCSUM_TEST -o csumtest csum.c && ./csumtest
+ * Checks each block sum against the original loop, and the vectored
+ * sums against copying everything into one buffer and checksumming
+ * that, which is how the transport modules used to do it.
+ */
+#define CSUM_TRIES	20000
+
+static int failures;
+
+/* Copy the pieces together and checksum that */
+static u_int16_t copysum(u_int8_t *piece[], int len[]) {
+	u_int16_t buf[4200];
+	int i, n = 0;
+
+	for (i=0; len[i]; i++) {
+		memcpy((u_int8_t *)buf+n, piece[i], len[i]);
+		n += len[i];
+	}
+	return csum_ref(buf, n);
+}
 
-	for (i=0; packlen[i]; ++i) {
-		while (packlen[i] > 1) {
-			sum+= *(packet[i]++);
-			packlen[i]-=2;
+/* Every kernel, every length up to a few thousand, every alignment */
+static void kernels(void) {
+	static u_int8_t big[65536+8], to[65536+8];
+	int k, n, a;
+
+	for (n=0; n<(int)sizeof(big); n++) big[n] = random();
+	for (k=0; k<CSUM_KERNELS; k++) {
+		if (!csum_usable(csum_kernels[k].fn)) continue;
+		for (n=0; n<3000; n++) {
+			for (a=0; a<8; a++) {
+				u_int16_t want = csum_ref((u_int16_t *)(big+a), n);
+				u_int16_t got = ~csum_fold16(csum_kernels[k].fn(big+a, n));
+
+				if (got != want) {
+					fprintf(stderr, "%s, %d bytes at +%d: got %04x, want %04x\n",
+					        csum_kernels[k].name, n, a, got, want);
+					failures++;
+				}
+				/* And copying, to a differently aligned place */
+				memset(to, 0, n+8);
+				got = ~csum_fold16(csum_kernels[k].copy(to+7-a, big+a, n));
+				if (got != want || memcmp(to+7-a, big+a, n) ||
+				    to[7-a+n] != 0) {
+					fprintf(stderr, "%s copy, %d bytes at +%d: wrong\n",
+					        csum_kernels[k].name, n, a);
+					failures++;
+				}
+			}
+		}
+		/* All ones is the worst case for carries */
+		memset(big, 0xff, sizeof(big));
+		if ((u_int16_t)~csum_fold16(csum_kernels[k].fn(big+1, 65535)) !=
+		    csum_ref((u_int16_t *)(big+1), 65535)) {
+			fprintf(stderr, "%s: wrong for 65535 bytes of 0xff\n",
+			        csum_kernels[k].name);
+			failures++;
 		}
+		for (n=0; n<(int)sizeof(big); n++) big[n] = random();
+	}
+}
 
-		if (packlen[i] > 0)
-			sum += *(unsigned char *)packet[i];
+static void check(const char *what, u_int8_t *piece[], int len[]) {
+	u_int16_t want = copysum(piece, len);
+	u_int16_t got = csumv((u_int16_t **)piece, len);
+
+	if (got != want) {
+		fprintf(stderr, "%s: got %04x, want %04x\n", what, got, want);
+		failures++;
 	}
+}
 
-	/* TODO: this depends on byte order */
+/* A transport checksum in a packet of nested IP headers: the pseudo
+ * header comes from the innermost one, as the modules work it out
+ */
+static void nested(const char *what, int outer, int inner, int datalen) {
+	u_int8_t pkt[1600];
+	u_int8_t pseudo[40];
+	u_int8_t *piece[4];
+	int len[4];
+	int i, l4, plen;
 
-	while (sum >> 16)
-		sum = (sum & 0xffff) + (sum >> 16);
+	for (i=0; i<(int)sizeof(pkt); i++) pkt[i] = random();
+	l4 = outer+inner;
+	if (inner == 20) {
+		memcpy(pseudo, pkt+outer+12, 8);
+		pseudo[8] = 0;
+		pseudo[9] = IPPROTO_UDP;
+		pseudo[10] = (8+datalen)>>8;
+		pseudo[11] = (8+datalen)&0xFF;
+		plen = 12;
+	} else {
+		memset(pseudo, 0, 40);
+		memcpy(pseudo, pkt+outer+8, 32);
+		pseudo[34] = (8+datalen)>>8;
+		pseudo[35] = (8+datalen)&0xFF;
+		pseudo[39] = IPPROTO_UDP;
+		plen = 40;
+	}
+	piece[0] = pseudo;	len[0] = plen;
+	piece[1] = pkt+l4;	len[1] = 8;
+	piece[2] = pkt+l4+8;	len[2] = datalen;
+	piece[3] = NULL;	len[3] = 0;
+	check(what, piece, len);
+}
 
-	return (u_int16_t) ~sum;
+/* Incremental updates must come out the same as doing it all again */
+static void incremental(void) {
+	u_int8_t cover[60], data[1500], copy[1500];
+	sendip_data d;
+	u_int8_t *piece[3];
+	int len[3];
+	int i, j, n, clen, dlen;
+	u_int16_t got;
+	char key;
+
+	for (i=0; i<(int)sizeof(data); i++) data[i] = random();
+	for (i=0; i<(int)sizeof(cover); i++) cover[i] = random();
+	for (i=0; i<CSUM_TRIES; i++) {
+		/* A new shape of packet every so often */
+		clen = 20+2*(i/1000%20);
+		dlen = (i/1000)*71 % (int)sizeof(data);
+		/* Change a few words, sometimes to 0 or 0xffff */
+		n = random()%4;
+		for (j=0; j<n; j++) {
+			int at = random()%clen;
+
+			switch (random()%4) {
+			case 0: cover[at] = 0; break;
+			case 1: cover[at] = 0xff; break;
+			default: cover[at] = random(); break;
+			}
+		}
+		d.data = data;
+		d.alloc_len = dlen;
+		d.modified = SENDIP_DATA_SAME;
+		/* And now and then the data */
+		if (dlen && random()%5 == 0) {
+			data[random()%dlen] = random();
+			d.modified = 0;
+		}
+		if (i & 1) {
+			/* As sendip does it, having copied the data in */
+			bool odd = FALSE;
+
+			d.csum = csum_partial_copy(copy, data, dlen, 0, &odd);
+			d.modified |= SENDIP_DATA_SUMMED;
+			if (memcmp(copy, data, dlen)) {
+				fprintf(stderr, "csum_partial_copy: bad copy of %d bytes\n",
+				        dlen);
+				failures++;
+			}
+		}
+		got = csum_cover(&key, cover, 12, cover+12, clen-12, &d);
+		piece[0] = cover;	len[0] = clen;
+		piece[1] = data;	len[1] = dlen;
+		len[2] = 0;
+		if (got != copysum(piece, len)) {
+			fprintf(stderr, "incremental: got %04x, want %04x\n",
+			        got, copysum(piece, len));
+			failures++;
+		}
+	}
+	/* All zeroes, and back */
+	memset(cover, 0, sizeof(cover));
+	for (i=0; i<2; i++) {
+		got = csum_cover(&key, NULL, 0, cover, 20, NULL);
+		if (got != csum_ref((u_int16_t *)cover, 20)) {
+			fprintf(stderr, "incremental zero: got %04x, want %04x\n",
+			        got, csum_ref((u_int16_t *)cover, 20));
+			failures++;
+		}
+		memset(cover, 0xff, 20);
+	}
+}
+
+int main(void) {
+	u_int8_t data[4096];
+	u_int8_t *piece[6];
+	int len[6];
+	int i, j, n, total;
+
+	srandom(1);
+	for (i=0; i<(int)sizeof(data); i++) data[i] = random();
+
+	/* All lengths, one piece and split in two at every point */
+	for (n=1; n<200; n++) {
+		piece[0] = data+1;	len[0] = n;
+		len[1] = 0;
+		check("single", piece, len);
+		for (j=1; j<n; j++) {
+			piece[0] = data;	len[0] = j;
+			piece[1] = data+j;	len[1] = n-j;
+			len[2] = 0;
+			check("split", piece, len);
+		}
+	}
+
+	/* Random pieces, random (odd or even) lengths and alignments */
+	for (i=0; i<CSUM_TRIES; i++) {
+		n = 1+random()%5;
+		total = 0;
+		for (j=0; j<n; j++) {
+			len[j] = 1+random()%800;
+			piece[j] = data+total+random()%3;
+			total += len[j]+2;
+		}
+		len[n] = 0;
+		check("random", piece, len);
+	}
+
+	kernels();
+	incremental();
+
+	/* UDP in IPIP and 6in4, and plain, with odd and even payloads */
+	for (n=0; n<1400; n+=7) {
+		nested("ipv4", 0, 20, n);
+		nested("ipip", 20, 20, n);
+		nested("6in4", 20, 40, n);
+		nested("ipv6", 0, 40, n);
+	}
+
+	if (failures)
+		fprintf(stderr, "%d failures\n", failures);
+	else
+		fprintf(stderr, "All checksums match\n");
+	return failures != 0;
+}
+#endif /* CSUM_TEST */
+
+#ifdef CSUM_BENCH
+/* cc -O3 -DCSUM_BENCH -o csumbench csum.c && ./csumbench
+ * Times the original loop and each block sum this CPU can run, and the
+ * same for copying and summing together.
+ */
+#include <time.h>
+
+#define CSUM_BENCH_BYTES	(1ULL<<31)	/* summed per size and method */
+
+static double csum_secs(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+int main(void) {
+	static const int sizes[] = { 64, 576, 1500, 9000, 65535 };
+	static u_int16_t buf[65536/2], to[65536/2];
+	volatile u_int32_t sink = 0;
+	double t, ref;
+	long reps, r;
+	int s, k;
+
+	for (s=0; s<(int)sizeof(buf)/2; s++) buf[s] = random();
+	printf("Checksum:\n");
+	printf("%8s %10s", "bytes", "original");
+	for (k=0; k<CSUM_KERNELS; k++)
+		if (csum_usable(csum_kernels[k].fn))
+			printf(" %16s", csum_kernels[k].name);
+	printf("   (GB/s, and speedup)\n");
+
+	for (s=0; s<(int)(sizeof(sizes)/sizeof(sizes[0])); s++) {
+		reps = CSUM_BENCH_BYTES/sizes[s];
+		t = csum_secs();
+		for (r=0; r<reps; r++)
+			sink += csum_ref(buf, sizes[s]);
+		ref = csum_secs()-t;
+		printf("%8d %10.2f", sizes[s], CSUM_BENCH_BYTES/ref/1e9);
+		for (k=0; k<CSUM_KERNELS; k++) {
+			if (!csum_usable(csum_kernels[k].fn)) continue;
+			t = csum_secs();
+			for (r=0; r<reps; r++)
+				sink += csum_fold16(csum_kernels[k].fn((u_int8_t *)buf, sizes[s]));
+			t = csum_secs()-t;
+			printf(" %9.2f (%4.1fx)", CSUM_BENCH_BYTES/t/1e9, ref/t);
+		}
+		printf("\n");
+	}
+
+	/* memcpy() and then the original loop, against doing both at once */
+	printf("\nCopy and checksum:\n");
+	printf("%8s %10s", "bytes", "separate");
+	for (k=0; k<CSUM_KERNELS; k++)
+		if (csum_usable(csum_kernels[k].fn))
+			printf(" %16s", csum_kernels[k].name);
+	printf("   (GB/s, and speedup)\n");
+	for (s=0; s<(int)(sizeof(sizes)/sizeof(sizes[0])); s++) {
+		reps = CSUM_BENCH_BYTES/sizes[s];
+		t = csum_secs();
+		for (r=0; r<reps; r++) {
+			memcpy(to, buf, sizes[s]);
+			sink += csum_ref(to, sizes[s]);
+		}
+		ref = csum_secs()-t;
+		printf("%8d %10.2f", sizes[s], CSUM_BENCH_BYTES/ref/1e9);
+		for (k=0; k<CSUM_KERNELS; k++) {
+			if (!csum_usable(csum_kernels[k].fn)) continue;
+			t = csum_secs();
+			for (r=0; r<reps; r++)
+				sink += csum_fold16(csum_kernels[k].copy((u_int8_t *)to,
+				                    (u_int8_t *)buf, sizes[s]));
+			t = csum_secs()-t;
+			printf(" %9.2f (%4.1fx)", CSUM_BENCH_BYTES/t/1e9, ref/t);
+		}
+		printf("\n");
+	}
+	return sink == 0xdeadbeef;
 }
+#endif /* CSUM_BENCH */
@@ -35,6 +35,18 @@
  *      takes a value (almost always).  description should be a short
  *      explanation of what the option does, and default should be its default
  *      value (as a string, can be NULL if there is no default).
+ *    - @@ optionally, fill in a foo_fields array for those options whose
+ *      do_opt code is no more than the typical case below: put the
+ *      argument, as integerargument(), hostintegerargument(),
+ *      ipv4argument() or ipv6argument() gives it, into a header field
+ *      and set its FOO_MOD_* flag.  Each entry has the format:
+ *      {opt_string,offset,width,type,modified}
+ *      offset is offsetof(foo_header,thing), width is its size in bytes
+ *      and type is one of the SENDIP_FIELD_* types in sendip_module.h.
+ *      sendip then sets these fields itself, straight into the packet,
+ *      when it regenerates them for each packet of a -l loop.  Leave out
+ *      anything that does more (bitfields, options that set other flags
+ *      or change the length of the packet).  See udp.h.
  *    - remove the #error line at the top
  * * In <your_module>.c:
  *    - remove this essay (you can still read it in dummy.c!)
@@ -89,10 +101,29 @@
  *       The "standard" string argument routine - does either compact_string
  *       above, or for strings of the form rN, returns N random bytes, or
  *       for strings of the form zN, returns N nul (zero) bytes.
+ *      -u_int32_t random32(void), void randomfill(void *buf, size_t len)
+ *       random numbers and bytes; use these rather than rand() so that
+ *       --seed repeats your module's random fields too
  *      -u_int16_t csum(u_int16_t *data, int len)
  *       returns the standard internet checksum of the packet
+ *      -@@void *arena_alloc(size_t len), arena_realloc(), arena_free()
+ *       memory that lasts until sendip starts on the next packet; use
+ *       these rather than malloc() and friends for your sendip_data, your
+ *       header and any scratch space, so that a packet can be built
+ *       without going to the heap.  See arena.c.
  *    - If something doesn't work as expected, or you can't figure out how to
  *      do something, mail mike@earth.li and ask.
+ *    - @@ optionally, a finalize_batch function, which does the same as
+ *      finalize for n packets at once. sendip uses it when it sends a
+ *      packet repeatedly (-l) from a template: the n packets are copies,
+ *      stride bytes apart, that differ only in their dynamic fields, so
+ *      anything that is the same for them all (lengths, where the
+ *      enclosing headers are) need only be worked out once. headers[] and
+ *      pack point into the first packet; data[k] is the data of packet k.
+ *      Put any pointers you move back as they were.  ipv4.c, udp.c and
+ *      tcp.c have one, with finalize simply a batch of 1.
+ *    - @@ if you have a foo_fields array, add num_fields and get_fields
+ *      functions to go with it, in the same way as num_opts and get_opts.
  * * In the Makefile add <your_module>.so to the PROTOS line
  * * Test it
  * * Mail it to mike@earth.li, either as a patch or just send the .c and .h
@@ -109,12 +140,13 @@
 const char opt_char='dummy';
 
 sendip_data *initialize(void) {
-	sendip_data *ret = malloc(sizeof(sendip_data));
-	dummy_header *dummy = malloc(sizeof(dummy_header));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
+	dummy_header *dummy = arena_alloc(sizeof(dummy_header));
 	memset(dummy,0,sizeof(dummy_header));
 	ret->alloc_len = sizeof(dummy_header);
 	ret->data = dummy;
 	ret->modified=0;
+	ret->private=NULL;
 	return ret;
 }
 
@@ -0,0 +1,160 @@
+/* fastpath.c - finalizing the commonest stacks in one pass
+ *
+ * Once sendip is building packets from a template (see sendip.c), an
+ * ipv4/udp, ipv4/tcp, ipv4/icmp or ipv6/udp packet needs very little
+ * done to it: the lengths, protocol numbers and other defaults are the
+ * same in every copy, and already in the template, so all that changes
+ * is the IP ID and TCP sequence number, if they're random, and the
+ * checksums. fast_finalize() does just that, a packet at a time with
+ * the headers at fixed offsets, where finalize_packets() would go
+ * through each module's finalize, its outer_header() lookup and
+ * csum_cover()'s cache.
+ *
+ * It has to come out the same as the modules, byte for byte, so it's
+ * only used when it can: the standard modules, every dynamic option
+ * from their field tables (so that it sets a field and nothing else)
+ * and no source route. Random numbers are drawn in the order
+ * finalize_packets() would draw them, a module at a time from the
+ * inside out. sendip --no-fastpath leaves it out, to check one against
+ * the other.
+ */
+
+#define _SENDIP_MAIN
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <string.h>
+#include "sendip_module.h"
+#include "ipv4.h"
+#include "ipv6.h"
+#include "udp.h"
+#include "tcp.h"
+#include "icmp.h"
+#include "fastpath.h"
+
+/* Sum of len (even) bytes, as 16 bit words in memory order. Headers are
+ * short enough that 32 bits can't overflow.
+ */
+static u_int32_t fast_sum(const u_int8_t *p, int len) {
+	u_int32_t sum = 0;
+	u_int16_t w;
+
+	for (; len > 0; len -= 2, p += 2) {
+		memcpy(&w, p, 2);
+		sum += w;
+	}
+	return sum;
+}
+
+static void fast_put16(u_int8_t *p, u_int16_t v) {
+	memcpy(p, &v, 2);
+}
+
+/* Whether names/headers are a stack fast_finalize() can do, and if so
+ * what it needs to do for it
+ */
+bool fast_setup(fastpath *fp, const char *names[], sendip_data *headers[],
+                int num_modules, int datalen) {
+	bool v4;
+
+	memset(fp, 0, sizeof(*fp));
+	if (num_modules != 2)
+		return FALSE;
+	if (!strcmp(names[0], "ipv4"))
+		v4 = TRUE;
+	else if (!strcmp(names[0], "ipv6"))
+		v4 = FALSE;
+	else
+		return FALSE;
+
+	if (!strcmp(names[1], "udp")) {
+		fp->stack = v4 ? FAST_IPV4_UDP : FAST_IPV6_UDP;
+		fp->l4sum = offsetof(udp_header,check);
+		fp->l4_check = !(headers[1]->modified & UDP_MOD_CHECK);
+	} else if (v4 && !strcmp(names[1], "tcp")) {
+		fp->stack = FAST_IPV4_TCP;
+		fp->l4sum = offsetof(tcp_header,check);
+		fp->l4_seq = !(headers[1]->modified & TCP_MOD_SEQ);
+		fp->l4_check = !(headers[1]->modified & TCP_MOD_CHECK);
+	} else if (v4 && !strcmp(names[1], "icmp")) {
+		fp->stack = FAST_IPV4_ICMP;
+		fp->l4sum = offsetof(icmp_header,check);
+		fp->l4_check = !(headers[1]->modified & ICMP_MOD_CHECK);
+	} else {
+		return FALSE;
+	}
+	if (v4) {
+		/* Source routes swap the destination for the checksum */
+		if (headers[0]->modified & IP_MOD_ROUTE_DADDR) {
+			fp->stack = FAST_NONE;
+			return FALSE;
+		}
+		fp->ip_id = !(headers[0]->modified & IP_MOD_ID);
+		fp->ip_check = !(headers[0]->modified & IP_MOD_CHECK);
+	}
+	fp->iplen = headers[0]->alloc_len;
+	fp->l4len = headers[1]->alloc_len;
+	fp->datalen = datalen;
+	/* fast_sum() takes whole words, and the data's sum starts on one;
+	 * odd length options (-tonop, -ionop) are left to the modules
+	 */
+	if ((fp->iplen & 1) || (fp->l4len & 1)) {
+		fp->stack = FAST_NONE;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Finalize n packets, stride bytes apart from batch on; datasums are the
+ * partial checksums of their data
+ */
+void fast_finalize(const fastpath *fp, u_int8_t *batch, int n, int stride,
+                   const u_int32_t *datasums) {
+	u_int32_t seqs[n];
+	u_int16_t ids[n];
+	u_int16_t l4total = htons((u_int16_t)(fp->l4len+fp->datalen));
+	int k;
+
+	/* tcp's finalize draws its sequence numbers before ipv4's IDs */
+	if (fp->l4_seq)
+		for (k=0; k<n; k++)
+			seqs[k] = random32();
+	if (fp->ip_id)
+		for (k=0; k<n; k++)
+			ids[k] = (u_int16_t)random32();
+
+	for (k=0; k<n; k++) {
+		u_int8_t *ip = batch+k*stride;
+		u_int8_t *l4 = ip+fp->iplen;
+		u_int32_t sum;
+
+		if (fp->l4_seq)
+			memcpy(l4+offsetof(tcp_header,seq), &seqs[k], 4);
+		if (fp->ip_id)
+			fast_put16(ip+offsetof(ip_header,id), ids[k]);
+
+		if (fp->l4_check) {
+			fast_put16(l4+fp->l4sum, 0);
+			sum = datasums[k] + fast_sum(l4, fp->l4len);
+			/* The pseudo header */
+			switch (fp->stack) {
+			case FAST_IPV4_UDP:
+			case FAST_IPV4_TCP:
+				sum += fast_sum(ip+offsetof(ip_header,saddr), 8);
+				sum += htons(ip[offsetof(ip_header,protocol)]);
+				sum += l4total;
+				break;
+			case FAST_IPV6_UDP:
+				sum += fast_sum(ip+offsetof(ipv6_header,ip6_src), 32);
+				sum += l4total + htons(IPPROTO_UDP);
+				break;
+			}
+			fast_put16(l4+fp->l4sum, csum_fold(sum));
+		}
+		/* Last, since it covers the ID */
+		if (fp->ip_check) {
+			fast_put16(ip+offsetof(ip_header,check), 0);
+			fast_put16(ip+offsetof(ip_header,check),
+			           csum_fold(fast_sum(ip, fp->iplen)));
+		}
+	}
+}
@@ -0,0 +1,27 @@
+/* fastpath.h - finalizing the commonest stacks in one pass
+ */
+#ifndef _SENDIP_FASTPATH_H
+#define _SENDIP_FASTPATH_H
+
+#define FAST_NONE	0
+#define FAST_IPV4_UDP	1
+#define FAST_IPV4_TCP	2
+#define FAST_IPV4_ICMP	3
+#define FAST_IPV6_UDP	4
+
+typedef struct {
+	int stack;		/* FAST_... */
+	int iplen;		/* of the IP header, with any options */
+	int l4len;		/* of the UDP, TCP or ICMP header */
+	int l4sum;		/* where its checksum is */
+	int datalen;
+	bool ip_id, ip_check;	/* what finalize would fill in */
+	bool l4_seq, l4_check;
+} fastpath;
+
+bool fast_setup(fastpath *fp, const char *names[], sendip_data *headers[],
+                int num_modules, int datalen);
+void fast_finalize(const fastpath *fp, u_int8_t *batch, int n, int stride,
+                   const u_int32_t *datasums);
+
+#endif  /* _SENDIP_FASTPATH_H */
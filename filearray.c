@@ -4,6 +4,8 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <memory.h>
 #include <string.h>
 #include <search.h>
@@ -13,12 +15,65 @@
 #include "sendip_module.h"
 #include <errno.h>
 
+/* An fF file is mapped rather than read in, and each line is found
+ * through an index of where it starts: 4 bytes a line (8 for files over
+ * 4GB) instead of a copy of every line. The index of a big file is kept
+ * in a sidecar, F.sendip-index, so the next run can map that too rather
+ * than scan the file again. A file too big for its index to be sensible
+ * (over half the memory) is streamed instead: no index, just a place in
+ * the file, moved on line by line.
+ *
+ * Lines are handed out as a copy, since the caller may rewrite them
+ * (compact_string() does).
+ *
+ * fF:colN takes column N (from 0) of a comma separated file instead, so
+ * one line can supply several fields: -id fF:col0 -ud fF:col1. The
+ * columns of a file share a place in it, which moves on to the next
+ * line (record) when a column is asked for again, i.e. for the next
+ * packet. A field may be in double quotes, with "" for a quote, if it
+ * has a comma in it. The first time an address or number is wanted
+ * from a column (filecolumn()), the whole column is parsed into an
+ * array of them, so after that each packet just copies its value out;
+ * columns that won't parse are handed out as text as usual.
+ */
+#define FA_COLUMNS	64
+
+typedef struct {
+	int state;		/* 0 not parsed yet, 1 parsed, -1 won't parse */
+	int family;		/* AF_UNSPEC (numbers), AF_INET or AF_INET6 */
+	void *values;
+} fa_column;
+
 typedef struct _filearray {
-	unsigned int length;
-	unsigned int index;
-	char *lines[0];
+	const char *map;	/* the file */
+	size_t size;
+	u_int64_t length;	/* lines, or 0 when streaming */
+	const void *starts;	/* where each line starts */
+	int width;		/* of an entry in starts: 4 or 8 */
+	void *sidecar;		/* mapped index, if that's where starts is */
+	size_t sidecar_len;
+	u_int64_t index;	/* next line */
+	size_t pos;		/* streaming: where the next line starts */
+	bool sharded;		/* index has been moved to our shard */
+	char *line;		/* copy of the last line handed out */
+	size_t linesize;
+	u_int64_t columns_read;	/* bit for each column read from this line */
+	fa_column columns[FA_COLUMNS];
 } Filearray;
 
+/* The start of a sidecar index, followed by the line starts */
+typedef struct {
+	u_int64_t magic;
+	u_int64_t size;		/* of the file, and its */
+	u_int64_t mtime;	/* modification time, when indexed */
+	u_int64_t length;
+	u_int64_t width;
+} fa_sidecar;
+
+#define FA_MAGIC	0x5844495049444e53ULL	/* "SNDIPIDX", in our byte order */
+#define FA_SIDECAR	".sendip-index"
+#define FA_SIDECAR_MIN	(1<<20)	/* fewest lines worth keeping an index for */
+
 #if defined(__APPLE_CC__)
 #include <stdint.h>
 #include <limits.h>
@@ -255,51 +310,214 @@ hsearch_r (ENTRY item, ACTION action, ENTRY **retval,
 
 static struct hsearch_data fa_tab;
 
+/* The file and column of a column argument. The few there are are kept
+ * to hand, so that a packet's worth doesn't mean splitting and hashing
+ * each one again.
+ */
+#define FA_COLUMN_ARGS	16
+static struct {
+	char *arg;
+	Filearray *fa;
+	int col;
+} fa_column_args[FA_COLUMN_ARGS];
+
+/* With --threads, worker k of n reads lines k, k+n, k+2n, ... */
+static unsigned int fa_offset=0, fa_stride=1;
+
+/* Files bigger than this are streamed rather than indexed */
+static size_t fa_stream_min;
+
 int
 fa_init(void)
 {
+	long pages = sysconf(_SC_PHYS_PAGES), pagesize = sysconf(_SC_PAGESIZE);
+
+	fa_stream_min = (pages > 0 && pagesize > 0) ?
+	                (size_t)pages/2*pagesize : (size_t)1<<32;
 	memset((void *)&fa_tab, 0, sizeof(fa_tab));
 #define HSIZE	512	/* why not, probably plenty */
 	return hcreate_r(HSIZE, &fa_tab);
 }
 
+void
+fa_shard(unsigned int offset, unsigned int stride)
+{
+	fa_offset = offset;
+	fa_stride = stride ? stride : 1;
+}
+
 void
 fa_close(void)
 {
+	int i;
+
+	for (i=0; i<FA_COLUMN_ARGS; ++i) {
+		free(fa_column_args[i].arg);
+		fa_column_args[i].arg = NULL;
+	}
 	hdestroy_r(&fa_tab);
 	memset((void *)&fa_tab, 0, sizeof(fa_tab));
 }
 
+static u_int64_t
+fa_start(Filearray *fa, u_int64_t i)
+{
+	if (fa->width == 4)
+		return ((const u_int32_t *)fa->starts)[i];
+	return ((const u_int64_t *)fa->starts)[i];
+}
+
+/* Where the line after the one starting at pos starts, 0 after the last */
+static size_t
+fa_next(Filearray *fa, size_t pos)
+{
+	const char *nl = memchr(fa->map+pos, '\n', fa->size-pos);
+
+	if (!nl || (size_t)(nl+1-fa->map) >= fa->size)
+		return 0;
+	return nl+1-fa->map;
+}
+
+/* Map the sidecar index of name, if there is one and it's up to date */
+static bool
+fa_sidecar_load(Filearray *fa, const char *name, struct stat *st)
+{
+	char path[BUFSIZ];
+	struct stat sst;
+	fa_sidecar *h;
+	void *map;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s" FA_SIDECAR, name);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return FALSE;
+	if (fstat(fd, &sst) < 0 || sst.st_size < sizeof(fa_sidecar)) {
+		close(fd);
+		return FALSE;
+	}
+	map = mmap(NULL, sst.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return FALSE;
+	h = map;
+	if (h->magic != FA_MAGIC || h->size != st->st_size
+	    || h->mtime != st->st_mtime || (h->width != 4 && h->width != 8)
+	    || sst.st_size != sizeof(fa_sidecar) + h->length*h->width) {
+		munmap(map, sst.st_size);
+		return FALSE;
+	}
+	fa->length = h->length;
+	fa->width = h->width;
+	fa->starts = h+1;
+	fa->sidecar = map;
+	fa->sidecar_len = sst.st_size;
+	return TRUE;
+}
+
+/* Keep the index for next time. It's only worth it for big files, and
+ * if the directory can't be written to, never mind.
+ */
+static void
+fa_sidecar_save(Filearray *fa, const char *name, struct stat *st)
+{
+	char path[BUFSIZ], tmp[BUFSIZ+16];
+	fa_sidecar h;
+	FILE *fp;
+
+	if (fa->length < FA_SIDECAR_MIN)
+		return;
+	snprintf(path, sizeof(path), "%s" FA_SIDECAR, name);
+	/* --threads workers may all be at it, so each writes its own */
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	if (!(fp = fopen(tmp, "w")))
+		return;
+	memset(&h, 0, sizeof(h));
+	h.magic = FA_MAGIC;
+	h.size = st->st_size;
+	h.mtime = st->st_mtime;
+	h.length = fa->length;
+	h.width = fa->width;
+	if (fwrite(&h, sizeof(h), 1, fp) != 1
+	    || fwrite(fa->starts, fa->width, fa->length, fp) != fa->length
+	    || fclose(fp) != 0 || rename(tmp, path) < 0) {
+		unlink(tmp);
+	}
+}
+
+/* One pass over the file for the line starts */
+static bool
+fa_index(Filearray *fa)
+{
+	u_int64_t limit = fa->size/16 + 16;
+	void *starts = NULL;
+	size_t pos = 0;
+
+	fa->width = (fa->size > 0xffffffffUL) ? 8 : 4;
+	fa->length = 0;
+	do {
+		if (fa->length == 0 || fa->length >= limit) {
+			void *more;
+
+			limit *= 2;
+			if (!(more = realloc(starts, limit*fa->width))) {
+				free(starts);
+				return FALSE;
+			}
+			starts = more;
+		}
+		if (fa->width == 4)
+			((u_int32_t *)starts)[fa->length++] = pos;
+		else
+			((u_int64_t *)starts)[fa->length++] = pos;
+	} while ((pos = fa_next(fa, pos)));
+	fa->starts = starts;
+	return TRUE;
+}
+
 Filearray *
 fa_create(const char *name)
 {
-	FILE *fp;
 	Filearray *answer;
-	int linelimit=0;
 	struct stat statbuf;
-	char line[BUFSIZ];
+	void *map;
+	int fd;
 
-	if (!(fp = fopen(name, "r")))
+	if ((fd = open(name, O_RDONLY)) < 0)
 		return NULL;
-	/* guess a line count based on size */
-	if (stat(name, &statbuf) < 0)
+	if (fstat(fd, &statbuf) < 0) {
+		close(fd);
+		return NULL;
+	}
+	if (statbuf.st_size == 0) {
+		fprintf(stderr, "%s: nothing in it\n", name);
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	if (!(answer = (Filearray *)calloc(1, sizeof(Filearray)))) {
+		munmap(map, statbuf.st_size);
+		return NULL;
+	}
+	answer->map = map;
+	answer->size = statbuf.st_size;
+
+	if (fa_sidecar_load(answer, name, &statbuf))
+		return answer;
+	if (answer->size >= fa_stream_min) {
+		/* length 0: stream it */
+		madvise(map, answer->size, MADV_SEQUENTIAL);
+		return answer;
+	}
+	if (!fa_index(answer)) {
+		munmap(map, statbuf.st_size);
+		free(answer);
 		return NULL;
-	linelimit = statbuf.st_size/5;
-	answer = (Filearray *)malloc(sizeof(struct _filearray)+linelimit*(sizeof(char *)));
-	if (!answer) return NULL;
-	/* read the lines into memory */
-	answer->index=0;
-	for (answer->length=0; fgets(line, BUFSIZ, fp); ++answer->length) {
-		if (answer->length >= linelimit-1) {
-			linelimit *= 2;
-			answer = (Filearray *)realloc(answer,
-			                              sizeof(struct _filearray)+linelimit*(sizeof(char *)));
-			if (!answer) return NULL;
-		}
-		line[strlen(line)-1] = '\0';
-		answer->lines[answer->length] = strdup(line);
 	}
-	fclose(fp);
+	fa_sidecar_save(answer, name, &statbuf);
 	return answer;
 }
 
@@ -325,6 +543,8 @@ fa_find(const char *name)
 				perror(name);
 				return NULL;
 			}
+			/* name may be a column argument's copy */
+			item.key = strdup(name);
 			if (hsearch_r(item, ENTER, &found, &fa_tab) <= 0) {
 				perror(name);
 				return NULL;
@@ -334,44 +554,347 @@ fa_find(const char *name)
 	return (Filearray *)found->data;
 }
 
+/* Move a streamed file on n lines, going back to the start after the
+ * last one.
+ */
+static void
+fa_skip(Filearray *fa, unsigned int n)
+{
+	while (n--)
+		fa->pos = fa_next(fa, fa->pos);
+}
+
+/* The first time a file is used, move to our worker's share of it */
+static void
+fa_sharding(Filearray *fa)
+{
+	if (fa->sharded) return;
+	if (fa->length)
+		fa->index = (fa->index+fa_offset) % fa->length;
+	else
+		fa_skip(fa, fa_offset);
+	fa->sharded = TRUE;
+}
+
+/* Where the current line starts, and on to the next one */
+static const char *
+fa_here(Filearray *fa)
+{
+	return fa->map + (fa->length ? fa_start(fa, fa->index) : fa->pos);
+}
+
+static void
+fa_advance(Filearray *fa)
+{
+	if (fa->length)
+		fa->index = (fa->index+fa_stride) % fa->length;
+	else
+		fa_skip(fa, fa_stride);
+}
+
+/* The line of a column argument: the same one until a column is read
+ * from it a second time.
+ */
+static const char *
+fa_record(Filearray *fa, int col)
+{
+	fa_sharding(fa);
+	if (fa->columns_read & ((u_int64_t)1 << col)) {
+		fa_advance(fa);
+		fa->columns_read = 0;
+	}
+	fa->columns_read |= (u_int64_t)1 << col;
+	return fa_here(fa);
+}
+
+/* Copy out the line starting at start, or just its column col (if col
+ * isn't -1), without quotes.
+ */
+static char *
+fa_text(Filearray *fa, const char *start, int col)
+{
+	const char *end, *p;
+	char *q;
+	bool quoted = FALSE;
+	size_t len;
+
+	if (!(end = memchr(start, '\n', fa->map+fa->size-start)))
+		end = fa->map+fa->size;
+	for (; col > 0 && start < end; --col) {
+		for (p=start; p < end && (*p != ',' || quoted); ++p)
+			if (*p == '"') quoted = !quoted;
+		start = (p < end) ? p+1 : end;
+	}
+	len = end-start;
+	if (len >= fa->linesize) {
+		char *bigger = realloc(fa->line, len+1);
+
+		if (!bigger) {
+			perror("OUT OF MEMORY!\n");
+			return NULL;
+		}
+		fa->line = bigger;
+		fa->linesize = len+1;
+	}
+	if (col < 0) {
+		memcpy(fa->line, start, len);
+		fa->line[len] = '\0';
+		return fa->line;
+	}
+	/* col is 0 now, or the line ran out first and start is end */
+	for (p=start, q=fa->line, quoted=FALSE; p < end; ++p) {
+		if (*p == '"') {
+			if (quoted && p+1 < end && p[1] == '"')
+				*q++ = *++p;
+			else
+				quoted = !quoted;
+		} else if (*p == ',' && !quoted) {
+			break;
+		} else {
+			*q++ = *p;
+		}
+	}
+	*q = '\0';
+	return fa->line;
+}
+
+/* Split F:colN into F and N. Returns FALSE if arg isn't like that. */
+static bool
+fa_column_arg(const char *arg, char *name, size_t size, int *col)
+{
+	const char *colon = strrchr(arg, ':');
+	char *end;
+
+	if (!colon || strncmp(colon+1, "col", 3) || !isdigit(colon[4]))
+		return FALSE;
+	*col = strtol(colon+4, &end, 10);
+	if (*end || *col >= FA_COLUMNS || colon-arg >= size)
+		return FALSE;
+	memcpy(name, arg, colon-arg);
+	name[colon-arg] = '\0';
+	return TRUE;
+}
+
+/* The file and column of a column argument, or NULL with *col -1 if
+ * it isn't one
+ */
+static Filearray *
+fa_column_find(const char *arg, int *col)
+{
+	char name[BUFSIZ];
+	Filearray *fa;
+	int i;
+
+	*col = -1;
+	for (i=0; i<FA_COLUMN_ARGS && fa_column_args[i].arg; ++i) {
+		if (!strcmp(fa_column_args[i].arg, arg)) {
+			*col = fa_column_args[i].col;
+			return fa_column_args[i].fa;
+		}
+	}
+	if (!fa_column_arg(arg, name, sizeof(name), col)) {
+		*col = -1;
+		return NULL;
+	}
+	if (!(fa = fa_find(name)))
+		return NULL;
+	if (i < FA_COLUMN_ARGS && (fa_column_args[i].arg = strdup(arg))) {
+		fa_column_args[i].fa = fa;
+		fa_column_args[i].col = *col;
+	}
+	return fa;
+}
+
+static int
+fa_column_width(int family)
+{
+	switch (family) {
+	case AF_INET:
+		return sizeof(in_addr_t);
+	case AF_INET6:
+		return sizeof(struct in6_addr);
+	default:
+		return sizeof(u_int64_t);
+	}
+}
+
+/* Parse all of column col as family, or find it won't go */
+static void
+fa_column_parse(Filearray *fa, int col, int family)
+{
+	fa_column *c = &fa->columns[col];
+	int width = fa_column_width(family);
+	u_int64_t i;
+	char *text, *end;
+
+	c->state = -1;
+	c->family = family;
+	if (!(c->values = malloc(fa->length*width)))
+		return;
+	for (i=0; i<fa->length; ++i) {
+		void *value = (char *)c->values + i*width;
+
+		if (!(text = fa_text(fa, fa->map+fa_start(fa, i), col)))
+			break;
+		if (family == AF_UNSPEC) {
+			*(u_int64_t *)value = strtoull(text, &end, 0);
+			if (!*text || *end) break;
+		} else if (inet_pton(family, text, value) <= 0) {
+			break;
+		}
+	}
+	if (i < fa->length) {
+		free(c->values);
+		c->values = NULL;
+		return;
+	}
+	c->state = 1;
+}
 
 /* Takes a file argument, looks it up in the hash table, and
- * returns the next line from the associated file.
+ * returns the next line from the associated file, or for F:colN, the
+ * column from the current line.
  */
 char *
 fileargument(const char *arg)
 {
 	Filearray *fa;
-	char *answer;
+	const char *start;
+	int col;
 
+	fa = fa_column_find(arg, &col);
+	if (col >= 0)
+		return fa ? fa_text(fa, fa_record(fa, col), col) : NULL;
 	fa = fa_find(arg);
 	if (!fa) return NULL;
-	answer = fa->lines[fa->index];
-	++fa->index;
-	if (fa->index >= fa->length)
-		fa->index = 0;
-	return answer;
+	fa_sharding(fa);
+	start = fa_here(fa);
+	fa_advance(fa);
+	return fa_text(fa, start, -1);
+}
+
+/* For an F:colN argument whose column holds nothing but numbers
+ * (AF_UNSPEC, stored as a u_int64_t) or addresses (AF_INET or
+ * AF_INET6), stores the current line's value in *value. Returns FALSE,
+ * without using up anything, if the column doesn't, or the file is
+ * streamed; fileargument() then gives the text.
+ */
+bool
+filecolumn(const char *arg, int family, void *value)
+{
+	Filearray *fa;
+	fa_column *c;
+	int col, width = fa_column_width(family);
+
+	if (!(fa = fa_column_find(arg, &col)) || !fa->length)
+		return FALSE;
+	c = &fa->columns[col];
+	if (!c->state)
+		fa_column_parse(fa, col, family);
+	if (c->state < 0 || c->family != family)
+		return FALSE;
+	(void)fa_record(fa, col);
+	memcpy(value, (char *)c->values + fa->index*width, width);
+	return TRUE;
 }
 
 #ifdef FA_TEST
-main()
+/* cc -DFA_TEST -o fatest filearray.c && ./fatest
+ * Writes a file of numbered lines and checks that indexing it, using
+ * its sidecar and streaming it all give the lines in order, shared out
+ * among workers too, and that its columns come out a line at a time.
+ */
+static int failures;
+
+static void
+fa_check(const char *name, u_int64_t lines, int k, int n, const char *how)
 {
-	char arg[BUFSIZ];
+	u_int64_t i, want;
 	char *line;
 
+	fa_close();
 	fa_init();
-	while (1) {
-		fprintf(stderr, "file? ");
-		fgets(arg, BUFSIZ, stdin);
-		arg[strlen(arg)-1] = '\0';
-		if (!arg[0]) break;
-		line = filearg(arg);
-		if (line) {
-			fprintf(stderr, "%s: %s\n", arg, line);
-		} else {
-			fprintf(stderr, "%s: not found\n", arg);
+	if (!strcmp(how, "streamed")) fa_stream_min = 0;
+	fa_shard(k, n);
+	for (i=0; i<lines+n; i++) {
+		want = (k + i*n) % lines;
+		line = fileargument(name);
+		if (!line || strtoull(line, NULL, 10) != want || !strchr(line, ',')) {
+			fprintf(stderr, "%s, worker %d of %d: line %llu is %s\n",
+			        how, k, n, (unsigned long long)want,
+			        line ? line : "missing");
+			failures++;
+			return;
 		}
 	}
+}
+
+/* Columns of one line come out together, the numbers parsed */
+static void
+fa_check_columns(const char *name, u_int64_t lines, int k, int n)
+{
+	char arg0[BUFSIZ], arg1[BUFSIZ], want[BUFSIZ], *text;
+	u_int64_t i, line, number;
+
 	fa_close();
+	fa_init();
+	fa_shard(k, n);
+	snprintf(arg0, sizeof(arg0), "%s:col0", name);
+	snprintf(arg1, sizeof(arg1), "%s:col1", name);
+	for (i=0; i<lines+n; i++) {
+		line = (k + i*n) % lines;
+		snprintf(want, sizeof(want), "a,\"%llu\"", (unsigned long long)line);
+		if (!filecolumn(arg0, AF_UNSPEC, &number) || number != line
+		    || !(text = fileargument(arg1)) || strcmp(text, want)) {
+			fprintf(stderr, "columns, worker %d of %d: line %llu wrong\n",
+			        k, n, (unsigned long long)line);
+			failures++;
+			return;
+		}
+	}
+}
+
+int
+main(void)
+{
+	static const u_int64_t counts[] = { 1, 2, 7, FA_SIDECAR_MIN+3 };
+	char name[] = "/tmp/fatestXXXXXX", side[BUFSIZ];
+	unsigned int c;
+	u_int64_t i;
+	FILE *fp;
+	int fd;
+
+	for (c=0; c<sizeof(counts)/sizeof(counts[0]); c++) {
+		strcpy(name, "/tmp/fatestXXXXXX");
+		if ((fd = mkstemp(name)) < 0 || !(fp = fdopen(fd, "w"))) {
+			perror(name);
+			return 1;
+		}
+		snprintf(side, sizeof(side), "%s" FA_SIDECAR, name);
+		/* The last line has no newline when there's an odd number */
+		for (i=0; i<counts[c]; i++)
+			fprintf(fp, "%llu,\"a,\"\"%llu\"\"\"%s", (unsigned long long)i,
+			        (unsigned long long)i,
+			        (i+1 < counts[c] || counts[c]%2 == 0) ? "\n" : "");
+		fclose(fp);
+		fa_check(name, counts[c], 0, 1, "indexed");
+		if (counts[c] >= FA_SIDECAR_MIN && access(side, R_OK) < 0) {
+			fprintf(stderr, "no sidecar index written\n");
+			failures++;
+		}
+		fa_check(name, counts[c], 0, 1, "from the sidecar");
+		fa_check(name, counts[c], 1, 3, "from the sidecar");
+		fa_check_columns(name, counts[c], 0, 1);
+		fa_check_columns(name, counts[c], 2, 3);
+		unlink(side);
+		fa_check(name, counts[c], 0, 1, "streamed");
+		fa_check(name, counts[c], 2, 3, "streamed");
+		unlink(name);
+	}
+	if (failures)
+		fprintf(stderr, "%d failures\n", failures);
+	else
+		fprintf(stderr, "All file argument tests pass\n");
+	return failures != 0;
 }
 #endif
@@ -27,34 +27,16 @@ const char opt_char='c';
 
 static void icmpcsum(sendip_data *icmp_hdr, sendip_data *data) {
 	icmp_header *icp = (icmp_header *)icmp_hdr->data;
-	u_int16_t *buf = malloc(icmp_hdr->alloc_len+data->alloc_len);
-	u_int8_t *tempbuf = (u_int8_t *)buf;
 	icp->check = 0;
-	if(tempbuf == NULL) {
-		fprintf(stderr,"Out of memory: ICMP checksum not computed\n");
-		return;
-	}
-	memcpy(tempbuf,icmp_hdr->data,icmp_hdr->alloc_len);
-	memcpy(tempbuf+icmp_hdr->alloc_len,data->data,data->alloc_len);
-	icp->check = csum(buf,icmp_hdr->alloc_len+data->alloc_len);
-	free(buf);
+	icp->check = csum_cover(icmp_hdr,NULL,0,icmp_hdr->data,icmp_hdr->alloc_len,
+	                        data);
 }
 
 static void icmp6csum(struct in6_addr *src, struct in6_addr *dst,
                       sendip_data *hdr, sendip_data *data) {
 	icmp_header *icp = (icmp_header *)hdr->data;
 	struct ipv6_pseudo_hdr phdr;
-
-	/* Make sure tempbuf is word aligned */
-	u_int16_t *buf = malloc(sizeof(phdr)+hdr->alloc_len+data->alloc_len);
-	u_int8_t *tempbuf = (u_int8_t *)buf;
 	icp->check = 0;
-	if(tempbuf == NULL) {
-		fprintf(stderr,"Out of memory: ICMP checksum not computed\n");
-		return;
-	}
-	memcpy(tempbuf+sizeof(phdr), hdr->data, hdr->alloc_len);
-	memcpy(tempbuf+sizeof(phdr)+hdr->alloc_len, data->data, data->alloc_len);
 
 	/* do an ipv6 checksum */
 	memset(&phdr, 0, sizeof(phdr));
@@ -63,19 +45,19 @@ static void icmp6csum(struct in6_addr *src, struct in6_addr *dst,
 	phdr.ulp_length = htonl(hdr->alloc_len+data->alloc_len);
 	phdr.nexthdr = IPPROTO_ICMPV6;
 
-	memcpy(tempbuf, &phdr, sizeof(phdr));
-
-	icp->check = csum(buf,sizeof(phdr)+hdr->alloc_len+data->alloc_len);
-	free(buf);
+	/* The header and data are summed where they are, not copied */
+	icp->check = csum_cover(hdr,&phdr,sizeof(phdr),hdr->data,hdr->alloc_len,
+	                        data);
 }
 
 sendip_data *initialize(void) {
-	sendip_data *ret = malloc(sizeof(sendip_data));
-	icmp_header *icmp = malloc(sizeof(icmp_header));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
+	icmp_header *icmp = arena_alloc(sizeof(icmp_header));
 	memset(icmp,0,sizeof(icmp_header));
 	ret->alloc_len = sizeof(icmp_header);
 	ret->data = (void *)icmp;
 	ret->modified=0;
+	ret->private=NULL;
 	return ret;
 }
 
@@ -165,6 +147,12 @@ int num_opts() {
 sendip_option *get_opts() {
 	return icmp_opts;
 }
+int num_fields() {
+	return sizeof(icmp_fields)/sizeof(sendip_field);
+}
+sendip_field *get_fields() {
+	return icmp_fields;
+}
 char get_optchar() {
 	return opt_char;
 }
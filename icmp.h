@@ -22,6 +22,7 @@ typedef struct {
 #define ICMP_MOD_CODE  1<<1
 #define ICMP_MOD_CHECK 1<<2
 
+#ifndef _SENDIP_MAIN
 /* Options
  */
 sendip_option icmp_opts[] = {
@@ -30,4 +31,13 @@ sendip_option icmp_opts[] = {
 	{"c",1,"ICMP checksum","Correct"}
 };
 
+/* Options sendip may set without calling do_opt
+ */
+sendip_field icmp_fields[] = {
+	{"t",offsetof(icmp_header,type),1,SENDIP_FIELD_NET,ICMP_MOD_TYPE},
+	{"d",offsetof(icmp_header,code),1,SENDIP_FIELD_NET,ICMP_MOD_CODE},
+	{"c",offsetof(icmp_header,check),2,SENDIP_FIELD_NET,ICMP_MOD_CHECK}
+};
+#endif  /* _SENDIP_MAIN */
+
 #endif  /* _SENDIP_ICMP_H */
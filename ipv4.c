@@ -28,7 +28,16 @@ const char opt_char='i';
 static void ipcsum(sendip_data *ip_hdr) {
 	ip_header *ip = (ip_header *)ip_hdr->data;
 	ip->check=0;
-	ip->check=csum((u_int16_t *)ip_hdr->data, ip_hdr->alloc_len);
+	/* No data to cover, so this can always be an update */
+	ip->check=csum_cover(ip_hdr, NULL, 0, ip_hdr->data, ip_hdr->alloc_len, NULL);
+}
+
+/* A scratch copy of an option's argument, to parse in place */
+static char *argcopy(const char *arg) {
+	char *copy = arena_alloc(strlen(arg)+1);
+
+	if(copy) strcpy(copy, arg);
+	return copy;
 }
 
 /* This builds a source route format option from an argument */
@@ -90,7 +99,7 @@ static void addoption(u_int8_t copy, u_int8_t class, u_int8_t num,
                       sendip_data *pack) {
 	/* opt is copy flag (1bit) + class (2 bit) + number (5 bit) */
 	u_int8_t opt = ((copy&1)<<7) | ((class&3)<<5) | (num&31);
-	pack->data = realloc(pack->data, pack->alloc_len + len);
+	pack->data = arena_realloc(pack->data, pack->alloc_len + len);
 	*((u_int8_t *)pack->data+pack->alloc_len) = opt;
 	if(len > 1)
 		*((u_int8_t *)pack->data+pack->alloc_len+1) = len;
@@ -100,28 +109,37 @@ static void addoption(u_int8_t copy, u_int8_t class, u_int8_t num,
 }
 
 sendip_data *initialize(void) {
-	sendip_data *ret = malloc(sizeof(sendip_data));
-	ip_header *ip = malloc(sizeof(ip_header));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
+	ip_header *ip = arena_alloc(sizeof(ip_header));
 	memset(ip,0,sizeof(ip_header));
 	ret->alloc_len = sizeof(ip_header);
 	ret->data = (void *)ip;
 	ret->modified=0;
+	ret->private=NULL;
 	return ret;
 }
 
+/* Every packet goes to the same host, so it's only looked up once */
+static const char *dest_name;
+static u_int32_t dest_addr;
+
 bool set_addr(char *hostname, sendip_data *pack) {
 	ip_header *ip = (ip_header *)pack->data;
-	struct hostent *host = gethostbyname2(hostname,AF_INET);
 	if(!(pack->modified & IP_MOD_SADDR)) {
 		ip->saddr = inet_addr("127.0.0.1");
 	}
 	if(!(pack->modified & IP_MOD_DADDR)) {
-		if(host==NULL) return FALSE;
-		if(host->h_length != sizeof(ip->daddr)) {
-			fprintf(stderr,"IPV4 destination address is the wrong size!!!");
-			return FALSE;
+		if(dest_name == NULL || strcmp(dest_name, hostname)) {
+			struct hostent *host = gethostbyname2(hostname,AF_INET);
+			if(host==NULL) return FALSE;
+			if(host->h_length != sizeof(dest_addr)) {
+				fprintf(stderr,"IPV4 destination address is the wrong size!!!");
+				return FALSE;
+			}
+			memcpy(&dest_addr,host->h_addr,host->h_length);
+			dest_name = hostname;
 		}
-		memcpy(&(ip->daddr),host->h_addr,host->h_length);
+		ip->daddr = dest_addr;
 	}
 	return TRUE;
 }
@@ -233,7 +251,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 		if(!strcmp(opt+2, "num")) {
 			/* Other options (auto length) */
 			u_int8_t cp, cls, num, len;
-			u_int8_t *data = malloc(strlen(arg)+2);
+			u_int8_t *data = arena_alloc(strlen(arg)+2);
 			if(!data) {
 				fprintf(stderr,"Out of memory!\n");
 				return FALSE;
@@ -244,7 +262,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 			cls=(*data&0x60)>>5;
 			num=(*data&0x1F);
 			addoption(cp,cls,num,len+1,data+1,pack);
-			free(data);
+			arena_free(data);
 		} else if(!strcmp(opt+2, "eol")) {
 			/* End of list */
 			addoption(0,0,0,1,NULL,pack);
@@ -255,7 +273,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 			/* Record route
 			 * Format is the same as for loose source route
 			 */
-			char *data = strdup(arg);
+			char *data = argcopy(arg);
 			u_int8_t len;
 			if(!data) {
 				fprintf(stderr,"Out of memory!\n");
@@ -263,11 +281,11 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 			}
 			len = buildroute(data, NULL);
 			if(len==0) {
-				free(data);
+				arena_free(data);
 				return FALSE;
 			} else {
 				addoption(0,0,7,len+2,(u_int8_t *)data,pack);
-				free(data);
+				arena_free(data);
 			}
 		} else if(!strcmp(opt+2, "ts")) {
 			/* Time stamp (RFC791)
@@ -282,7 +300,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 			 *  timestamp2 (32bit)
 			 *  ...
 			 */
-			char *data = strdup(arg);
+			char *data = argcopy(arg);
 			char *data_in = data;
 			char *data_out = data;
 			char *next;
@@ -305,7 +323,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 				} else {
 					fprintf(stderr,
 					        "First 2 chars of IP timestamp must be hex pointer\n");
-					free(data);
+					arena_free(data);
 					return FALSE;
 				}
 				data_in++;
@@ -315,7 +333,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 			/* Skip a : */
 			if(*(data_in++) != ':') {
 				fprintf(stderr,"Third char of IP timestamp must be :\n");
-				free(data);
+				arena_free(data);
 				return FALSE;
 			}
 
@@ -323,14 +341,14 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 			next = strchr(data_in,':');
 			if(!next) {
 				fprintf(stderr,"IP timestamp option incorrect\n");
-				free(data);
+				arena_free(data);
 				return FALSE;
 			}
 			*(next++)=0;
 			i = atoi(data_in);
 			if(i > 15) {
 				fprintf(stderr,"IP timestamp overflow too big (max 15)\n");
-				free(data);
+				arena_free(data);
 				return FALSE;
 			}
 			*data_out=(u_int8_t)(i<<4);
@@ -340,14 +358,14 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 			next = strchr(data_in,':');
 			if(!next) {
 				fprintf(stderr,"IP timestamp option incorrect\n");
-				free(data);
+				arena_free(data);
 				return FALSE;
 			}
 			*(next++)=0;
 			i = atoi(data_in);
 			if(i > 15) {
 				fprintf(stderr,"IP timestamp flag too big (max 3)\n");
-				free(data);
+				arena_free(data);
 				return FALSE;
 			} else if(i!=0 && i!=1 && i!=3) {
 				fprintf(stderr,
@@ -365,7 +383,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 					next=strchr(data_in,':');
 					if(!next) {
 						fprintf(stderr,"IP address in IP timestamp option must be followed by a timestamp\n");
-						free(data);
+						arena_free(data);
 						return FALSE;
 					}
 					*(next++)=0;
@@ -385,7 +403,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 			}
 
 			addoption(0,2,4,data_out-data+2,(u_int8_t *)data,pack);
-			free(data);
+			arena_free(data);
 			/* End of timestamp parsing */
 
 		} else if(!strcmp(opt+2, "lsr")) {
@@ -398,7 +416,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 			 *  ip address1 (32bit)
 			 *  ...
 			 */
-			char *data = strdup(arg);
+			char *data = argcopy(arg);
 			u_int8_t len;
 			if(!data) {
 				fprintf(stderr,"Out of memory!\n");
@@ -406,11 +424,11 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 			}
 			len = buildroute(data, pack);
 			if(len==0) {
-				free(data);
+				arena_free(data);
 				return FALSE;
 			} else {
 				addoption(1,0,3,len+2,(u_int8_t *)data,pack);
-				free(data);
+				arena_free(data);
 			}
 		} else if(!strcmp(opt+2, "sid")) {
 			/* Stream ID (RFC791) */
@@ -421,7 +439,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 			/* Strict Source Route
 			 * Format is identical to loose source route
 			 */
-			char *data = strdup(arg);
+			char *data = argcopy(arg);
 			u_int8_t len;
 			if(!data) {
 				fprintf(stderr,"Out of memory!\n");
@@ -429,11 +447,11 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 			}
 			len = buildroute(data, pack);
 			if(len==0) {
-				free(data);
+				arena_free(data);
 				return FALSE;
 			} else {
 				addoption(1,0,9,len+2,(u_int8_t *)data,pack);
-				free(data);
+				arena_free(data);
 			}
 		} else {
 			fprintf(stderr, "unsupported IP option %s val %s\n", opt, arg);
@@ -456,46 +474,74 @@ bool do_pad(sendip_data *pack) {
 	return TRUE;
 }
 
-bool finalize(char *hdrs, sendip_data *headers[], int index,
-              sendip_data *data, sendip_data *pack) {
-	ip_header *iph = (ip_header *)pack->data;
+/* Finalize n packets, stride bytes apart. They differ only in their
+ * dynamic fields, so the lengths and the protocol are worked out once.
+ */
+bool finalize_batch(char *hdrs, sendip_data *headers[], int index,
+                    sendip_data data[], sendip_data *pack, int n, int stride) {
+	u_int8_t *at = (u_int8_t *)pack->data;
+	u_int32_t unset = ~pack->modified;
+	u_int16_t tot_len = pack->alloc_len + data[0].alloc_len;
+	u_int8_t header_len = (pack->alloc_len+3)/4;
+	u_int8_t protocol = 0;
+	int k;
 
-	if(!(pack->modified & IP_MOD_VERSION)) {
-		iph->version=4;
-	}
-	if(!(pack->modified & IP_MOD_HEADERLEN)) {
-		iph->header_len=(pack->alloc_len+3)/4;
-	}
-	if(!(pack->modified & IP_MOD_TOTLEN)) {
-		iph->tot_len=pack->alloc_len + data->alloc_len;
+	if(unset & IP_MOD_PROTOCOL)
+		protocol = header_type(hdrs[index+1]);
 #ifndef __FreeBSD__
 #ifndef __FreeBSD
-		iph->tot_len = htons(iph->tot_len);
+	tot_len = htons(tot_len);
 #endif
 #endif
+	for(k=0; k<n; k++) {
+		ip_header *iph = (ip_header *)(at+k*stride);
+
+		if(unset & IP_MOD_VERSION) {
+			iph->version=4;
+		}
+		if(unset & IP_MOD_HEADERLEN) {
+			iph->header_len=header_len;
+		}
+		if(unset & IP_MOD_TOTLEN) {
+			iph->tot_len=tot_len;
+		}
+		if(unset & IP_MOD_ID) {
+			iph->id = (u_int16_t)random32();
+		}
+		if(unset & IP_MOD_TTL) {
+			iph->ttl = 255;
+		}
+		if(unset & IP_MOD_PROTOCOL) {
+			/* New default: actual type of following header */
+			iph->protocol = protocol;
+		}
+		/* The checksum has to come last, since it covers everything above */
+		if(unset & IP_MOD_CHECK) {
+			pack->data = iph;
+			ipcsum(pack);
+		}
 	}
-	if(!(pack->modified & IP_MOD_ID)) {
-		iph->id = rand();
-	}
-	if(!(pack->modified & IP_MOD_TTL)) {
-		iph->ttl = 255;
-	}
-	if(!(pack->modified & IP_MOD_CHECK)) {
-		ipcsum(pack);
-	}
-	if(!(pack->modified&IP_MOD_PROTOCOL)) {
-		/* New default: actual type of following header */
-		iph->protocol = header_type(hdrs[index+1]);
-	}
+	pack->data = at;
 	return TRUE;
 }
 
+bool finalize(char *hdrs, sendip_data *headers[], int index,
+              sendip_data *data, sendip_data *pack) {
+	return finalize_batch(hdrs, headers, index, data, pack, 1, 0);
+}
+
 int num_opts() {
 	return sizeof(ip_opts)/sizeof(sendip_option);
 }
 sendip_option *get_opts() {
 	return ip_opts;
 }
+int num_fields() {
+	return sizeof(ip_fields)/sizeof(sendip_field);
+}
+sendip_field *get_fields() {
+	return ip_fields;
+}
 char get_optchar() {
 	return opt_char;
 }
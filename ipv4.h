@@ -76,6 +76,7 @@ typedef struct {
 #define IP_MOD_DADDR      (1<<13)
 #define IP_MOD_ROUTE_DADDR      (1<<14)
 
+#ifndef _SENDIP_MAIN
 /* Options
  */
 sendip_option ip_opts[] = {
@@ -104,4 +105,22 @@ sendip_option ip_opts[] = {
 	{"ossr",1,"IP option: strict source route. Format: pointer:addr1:addr2:...",NULL}
 };
 
+/* Options sendip may set without calling do_opt (see the -il comment
+ * in ipv4.c for FreeBSD's tot_len)
+ */
+sendip_field ip_fields[] = {
+	{"s",offsetof(ip_header,saddr),4,SENDIP_FIELD_IPV4,IP_MOD_SADDR},
+	{"d",offsetof(ip_header,daddr),4,SENDIP_FIELD_IPV4,IP_MOD_DADDR},
+#if defined(__FreeBSD__) || defined(__FreeBSD)
+	{"l",offsetof(ip_header,tot_len),2,SENDIP_FIELD_HOST,IP_MOD_TOTLEN},
+#else
+	{"l",offsetof(ip_header,tot_len),2,SENDIP_FIELD_NET,IP_MOD_TOTLEN},
+#endif
+	{"i",offsetof(ip_header,id),2,SENDIP_FIELD_NET,IP_MOD_ID},
+	{"t",offsetof(ip_header,ttl),1,SENDIP_FIELD_NET,IP_MOD_TTL},
+	{"p",offsetof(ip_header,protocol),1,SENDIP_FIELD_NET,IP_MOD_PROTOCOL},
+	{"c",offsetof(ip_header,check),2,SENDIP_FIELD_NET,IP_MOD_CHECK}
+};
+#endif  /* _SENDIP_MAIN */
+
 #endif  /* _SENDIP_IP_H */
@@ -19,28 +19,37 @@
 const char opt_char='6';
 
 sendip_data *initialize(void) {
-	sendip_data *ret = malloc(sizeof(sendip_data));
-	ipv6_header *ipv6 = malloc(sizeof(ipv6_header));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
+	ipv6_header *ipv6 = arena_alloc(sizeof(ipv6_header));
 	memset(ipv6,0,sizeof(ipv6_header));
 	ret->alloc_len = sizeof(ipv6_header);
 	ret->data = (void *)ipv6;
 	ret->modified=0;
+	ret->private=NULL;
 	return ret;
 }
 
+/* Every packet goes to the same host, so it's only looked up once */
+static const char *dest_name;
+static struct in6_addr dest_addr;
+
 bool set_addr(char *hostname, sendip_data *pack) {
 	ipv6_header *ipv6 = (ipv6_header *)pack->data;
-	struct hostent *host = gethostbyname2(hostname,AF_INET6);
 	if(!(pack->modified & IPV6_MOD_SRC)) {
 		ipv6->ip6_src = in6addr_loopback;
 	}
 	if(!(pack->modified & IPV6_MOD_DST)) {
-		if(host==NULL) return FALSE;
-		if(host->h_length != sizeof(ipv6->ip6_dst)) {
-			fprintf(stderr,"IPV6 destination address is the wrong size!!!");
-			return FALSE;
+		if(dest_name == NULL || strcmp(dest_name, hostname)) {
+			struct hostent *host = gethostbyname2(hostname,AF_INET6);
+			if(host==NULL) return FALSE;
+			if(host->h_length != sizeof(dest_addr)) {
+				fprintf(stderr,"IPV6 destination address is the wrong size!!!");
+				return FALSE;
+			}
+			memcpy(&dest_addr,host->h_addr,host->h_length);
+			dest_name = hostname;
 		}
-		memcpy(&(ipv6->ip6_dst),host->h_addr,host->h_length);
+		ipv6->ip6_dst = dest_addr;
 	}
 	return TRUE;
 }
@@ -83,15 +92,15 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 		pack->modified |= IPV6_MOD_NXT;
 		break;
 	case 's':
-		/*@@ TODO: flexible address specification @@*/
-		if (inet_pton(AF_INET6, arg, &addr)) {
+		/*@@ fixed, a range of the last 64 bits, or fF @@*/
+		if (ipv6argument(arg, &addr)) {
 			memcpy(&hdr->ip6_src, &addr, sizeof(struct in6_addr));
 		}
 		pack->modified |= IPV6_MOD_SRC;
 		break;
 	case 'd':
-		/*@@ TODO: flexible address specification @@*/
-		if (inet_pton(AF_INET6, arg, &addr)) {
+		/*@@ fixed, a range of the last 64 bits, or fF @@*/
+		if (ipv6argument(arg, &addr)) {
 			memcpy(&hdr->ip6_dst, &addr, sizeof(struct in6_addr));
 		}
 		pack->modified |= IPV6_MOD_DST;
@@ -136,6 +145,12 @@ int num_opts() {
 sendip_option *get_opts() {
 	return ipv6_opts;
 }
+int num_fields() {
+	return sizeof(ipv6_fields)/sizeof(sendip_field);
+}
+sendip_field *get_fields() {
+	return ipv6_fields;
+}
 char get_optchar() {
 	return opt_char;
 }
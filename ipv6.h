@@ -57,6 +57,7 @@ typedef struct {
 #define IPV6_MOD_SRC      (1<<6)
 #define IPV6_MOD_DST      (1<<7)
 
+#ifndef _SENDIP_MAIN
 /* Options
  */
 sendip_option ipv6_opts[] = {
@@ -71,4 +72,14 @@ sendip_option ipv6_opts[] = {
 	{"d",1,"IPv6 destination address","Correct"}
 };
 
+/* Options sendip may set without calling do_opt
+ */
+sendip_field ipv6_fields[] = {
+	{"l",offsetof(ipv6_header,ip6_plen),2,SENDIP_FIELD_NET,IPV6_MOD_PLEN},
+	{"h",offsetof(ipv6_header,ip6_hlim),1,SENDIP_FIELD_HOST,IPV6_MOD_HLIM},
+	{"s",offsetof(ipv6_header,ip6_src),16,SENDIP_FIELD_IPV6,IPV6_MOD_SRC},
+	{"d",offsetof(ipv6_header,ip6_dst),16,SENDIP_FIELD_IPV6,IPV6_MOD_DST}
+};
+#endif  /* _SENDIP_MAIN */
+
 #endif  /* _SENDIP_IPV6_H */
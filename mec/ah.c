@@ -26,9 +26,9 @@ crypto_module *cryptoah;
 sendip_data *
 initialize(void)
 {
-	sendip_data *ret = malloc(sizeof(sendip_data));
-	ah_header *ah = malloc(sizeof(ah_header));
-	ah_private *priv = malloc(sizeof(ah_private));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
+	ah_header *ah = arena_alloc(sizeof(ah_header));
+	ah_private *priv = arena_alloc(sizeof(ah_private));
 
 	memset(ah,0,sizeof(ah_header));
 	memset(priv,0,sizeof(ah_private));
@@ -63,7 +63,7 @@ do_opt(char *opt, char *arg, sendip_data *pack)
 		 * or a user-provided string.
 		 */
 		length = stringargument(arg, &temp);
-		pack->data = realloc(ah, sizeof(ah_header)+length);
+		pack->data = arena_realloc(ah, sizeof(ah_header)+length);
 		pack->alloc_len = sizeof(ah_header)+length;
 		ah = (ah_header *)pack->data;
 		memcpy(ah->auth_data, temp, length);
@@ -74,8 +74,8 @@ do_opt(char *opt, char *arg, sendip_data *pack)
 	case 'k':       /* Key */
 		length = stringargument(arg, &temp);
 		priv->keylen = length;
-		priv = (ah_private *)realloc(priv,
-		                             sizeof(ah_private) + length);
+		priv = (ah_private *)arena_realloc(priv,
+		                                   sizeof(ah_private) + length);
 		memcpy(priv->key, temp, priv->keylen);
 		pack->private = priv;
 		pack->modified |= AH_MOD_KEY;
@@ -116,7 +116,7 @@ finalize(char *hdrs, sendip_data *headers[], int index,
 		                             data, pack);
 	}
 	/* Free the private data as no longer required */
-	free((void *)priv);
+	arena_free((void *)priv);
 	pack->private = NULL;
 	return ret;
 }
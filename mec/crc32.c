@@ -440,6 +440,20 @@ buf_dump(char const *prefix, unsigned char const *buf, size_t len)
 }
 #endif
 
+/* From linux/bitrev.h, which user space doesn't have */
+static unsigned char bitrev8(unsigned char x)
+{
+	x = (x >> 4) | (x << 4);
+	x = ((x >> 2) & 0x33) | ((x & 0x33) << 2);
+	return ((x >> 1) & 0x55) | ((x & 0x55) << 1);
+}
+
+static u_int32_t bitrev32(u_int32_t x)
+{
+	return (bitrev8(x & 0xff) << 24) | (bitrev8((x >> 8) & 0xff) << 16) |
+	       (bitrev8((x >> 16) & 0xff) << 8) | bitrev8(x >> 24);
+}
+
 static void bytereverse(unsigned char *buf, size_t len)
 {
 	while (len--) {
@@ -454,7 +468,6 @@ static void random_garbage(unsigned char *buf, size_t len)
 		*buf++ = (unsigned char) random();
 }
 
-#if 0				/* Not used at present */
 static void store_le(u_int32_t x, unsigned char *buf)
 {
 	buf[0] = (unsigned char) x;
@@ -462,7 +475,6 @@ static void store_le(u_int32_t x, unsigned char *buf)
 	buf[2] = (unsigned char) (x >> 16);
 	buf[3] = (unsigned char) (x >> 24);
 }
-#endif
 
 static void store_be(u_int32_t x, unsigned char *buf)
 {
@@ -524,17 +536,77 @@ static u_int32_t test_step(u_int32_t init, unsigned char *buf, size_t len)
 	return crc1;
 }
 
+/*
+ * The same checks for each CRC32c implementation, which also have to
+ * agree with a bit at a time division by the Castagnoli polynomial.
+ * Returns the number of failures.
+ */
+#define CRC32C_POLY_LE 0x82f63b78
+
+static u_int32_t crc32c_bitwise(u_int32_t crc, unsigned char const *p,
+				size_t len)
+{
+	int i;
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY_LE : 0);
+	}
+	return crc;
+}
+
+static int test_step_c(u_int32_t init, unsigned char *buf, size_t len)
+{
+	u_int32_t crc1, crc2;
+	size_t i;
+	int v, fails = 0;
+
+	crc1 = crc32c_bitwise(init, buf, len);
+	for (v = 0; crc32c_variant_name(v); v++) {
+		crc2 = crc32c_variant(v, init, buf, len);
+		if (crc2 != crc1) {
+			printf("\nCRC32c %s fail at length %lu: 0x%08x != 0x%08x\n",
+			       crc32c_variant_name(v), (unsigned long)len,
+			       crc2, crc1);
+			fails++;
+		}
+	}
+	store_le(crc1, buf + len);
+	for (v = 0; crc32c_variant_name(v); v++) {
+		crc2 = crc32c_variant(v, init, buf, len + 4);
+		if (crc2) {
+			printf("\nCRC32c %s cancellation fail: 0x%08x should be 0\n",
+			       crc32c_variant_name(v), crc2);
+			fails++;
+		}
+		/* A few split points, lest this take all day */
+		for (i = 0; i <= len + 4; i += 1 + len / 8) {
+			crc2 = crc32c_variant(v, init, buf, i);
+			crc2 = crc32c_variant(v, crc2, buf + i, len + 4 - i);
+			if (crc2) {
+				printf("\nCRC32c %s split fail: 0x%08x\n",
+				       crc32c_variant_name(v), crc2);
+				fails++;
+			}
+		}
+	}
+	return fails;
+}
+
 #define SIZE 64
 #define INIT1 0
 #define INIT2 0
+#define CSIZE 30000	/* past the longest stride of each CRC32c variant */
 
 int main(void)
 {
 	unsigned char buf1[SIZE + 4];
 	unsigned char buf2[SIZE + 4];
 	unsigned char buf3[SIZE + 4];
-	int i, j;
+	static unsigned char cbuf[CSIZE + 4 + 8];
+	int i, j, fails = 0;
 	u_int32_t crc1, crc2, crc3;
+	static const char check[] = "123456789";
 
 	for (i = 0; i <= SIZE; i++) {
 		printf("\rTesting length %d...", i);
@@ -553,7 +625,31 @@ int main(void)
 			       crc3, crc1, crc2);
 	}
 	printf("\nAll test complete.  No failures expected.\n");
-	return 0;
+
+	/* CRC32c: the check value from RFC 3720 B.4, then random buffers,
+	 * every length up to a few kilobytes and a spread past that, at
+	 * each alignment
+	 */
+	crc1 = ~crc32c_bitwise(~0, (unsigned char const *)check, 9);
+	if (crc1 != 0xe3069283) {
+		printf("CRC32c check value fail: 0x%08x != 0xe3069283\n", crc1);
+		fails++;
+	}
+	for (i = 0; i <= CSIZE; i += (i < 4096 ? 1 : 1 + random() % 997)) {
+		if (i % 64 == 0) {
+			printf("\rTesting CRC32c length %d...", i);
+			fflush(stdout);
+		}
+		j = random() % 8;
+		random_garbage(cbuf + j, i);
+		fails += test_step_c(i & 1 ? ~0 : (u_int32_t) random(),
+				     cbuf + j, i);
+	}
+	printf("\nCRC32c test complete, %d failures", fails);
+	for (i = 0; crc32c_variant_name(i); i++)
+		printf("%s %s", i ? "," : " (checked", crc32c_variant_name(i));
+	printf(")\n");
+	return fails != 0;
 }
 
 #endif				/* UNITTEST */
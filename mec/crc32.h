@@ -15,6 +15,18 @@ extern u_int32_t  crc32_be(u_int32_t crc, unsigned char const *p, size_t len);
 
 #define crc32(seed, data, length)  crc32_le(seed, (unsigned char const *)data, length)
 
+/* CRC32c (Castagnoli), for SCTP; see crc32c.c */
+extern u_int32_t  crc32c_le(u_int32_t crc, unsigned char const *p, size_t len);
+
+#define crc32c(seed, data, length)  crc32c_le(seed, (unsigned char const *)data, length)
+
+#ifdef UNITTEST
+/* Each implementation this CPU can run, 0 up until the name is NULL */
+extern const char *crc32c_variant_name(int i);
+extern u_int32_t  crc32c_variant(int i, u_int32_t crc, unsigned char const *p,
+                                 size_t len);
+#endif
+
 #ifdef notdef
 /*
  * Helpers for hash table generation of ethernet nics:
@@ -0,0 +1,383 @@
+/* crc32c.c - CRC32c (Castagnoli), the SCTP checksum (RFC 4960, App. B)
+ *
+ * crc32c_le() works like crc32_le() in crc32.c: the seed goes in as is
+ * and the result isn't inverted, so SCTP wants ~crc32c_le(~0, ...).
+ * There are three ways of doing it, and the first call picks the best
+ * one this CPU can run:
+ *  - slicing by 8: eight 256 entry tables, 8 bytes a step, any CPU;
+ *  - the SSE4.2 crc32 instruction, on three streams at once. Each
+ *    crc32 takes 3 cycles but a new one can start every cycle, so the
+ *    buffer is cut in three, each third run separately, and the three
+ *    CRCs joined up by shifting the earlier ones over the length of
+ *    the later ones (multiplying by x^(8*len), done with tables);
+ *  - PCLMULQDQ: carry-less multiplies fold 64 bytes at a time into four
+ *    128 bit remainders (Intel's "Fast CRC Computation for Generic
+ *    Polynomials Using PCLMULQDQ"), for long buffers.
+ * They all have to agree with each other and with a bit at a time
+ * division; crc32.c's UNITTEST main (make crc32test) checks that.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "crc32.h"
+
+#define CRC32C_POLY	0x82f63b78	/* 0x1edc6f41 bit reversed */
+
+/* Lengths of the three streams for the crc32 instruction. Long
+ * buffers go in 3*LONG pieces, the rest in 3*SHORT, what is left in
+ * one stream.
+ */
+#define CRC32C_LONG	8192
+#define CRC32C_SHORT	256
+/* Shortest buffer worth folding with PCLMULQDQ */
+#define CRC32C_FOLD_MIN	512
+
+typedef u_int32_t (*crc32c_fn)(u_int32_t crc, const unsigned char *p,
+                               size_t len);
+
+/* crc32c_table[k][n] is the CRC of byte n followed by k zero bytes */
+static u_int32_t crc32c_table[8][256];
+/* The same for shifting a CRC over LONG and SHORT zero bytes, a byte
+ * of the CRC at a time
+ */
+static u_int32_t crc32c_long[4][256];
+static u_int32_t crc32c_short[4][256];
+
+static u_int64_t crc32c_load(const unsigned char *p) {
+	u_int64_t w;
+
+	memcpy(&w, p, sizeof(w));
+	return w;
+}
+
+/* Shift a CRC over len zero bytes, a bit at a time through the
+ * byte table. Only used to build the shift tables.
+ */
+static u_int32_t crc32c_zeros(u_int32_t crc, size_t len) {
+	while (len--)
+		crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+/* Shifting is linear, so the table entry for byte value n is the xor
+ * of the shifts of n's set bits
+ */
+static void crc32c_shift_table(u_int32_t table[4][256], size_t len) {
+	u_int32_t bit[32];
+	int i, k, n;
+
+	for (i=0; i<32; i++)
+		bit[i] = crc32c_zeros((u_int32_t)1 << i, len);
+	for (k=0; k<4; k++) {
+		for (n=0; n<256; n++) {
+			table[k][n] = 0;
+			for (i=0; i<8; i++)
+				if (n & (1 << i))
+					table[k][n] ^= bit[8*k+i];
+		}
+	}
+}
+
+static u_int32_t crc32c_shift(u_int32_t table[4][256], u_int32_t crc) {
+	return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+	       table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+}
+
+static void crc32c_tables(void) {
+	u_int32_t c;
+	int k, n;
+
+	for (n=0; n<256; n++) {
+		c = n;
+		for (k=0; k<8; k++)
+			c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		crc32c_table[0][n] = c;
+	}
+	for (n=0; n<256; n++) {
+		c = crc32c_table[0][n];
+		for (k=1; k<8; k++) {
+			c = crc32c_table[0][c & 0xff] ^ (c >> 8);
+			crc32c_table[k][n] = c;
+		}
+	}
+	crc32c_shift_table(crc32c_long, CRC32C_LONG);
+	crc32c_shift_table(crc32c_short, CRC32C_SHORT);
+}
+
+static u_int32_t crc32c_bytes(u_int32_t crc, const unsigned char *p,
+                              size_t len) {
+	while (len--)
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+static u_int32_t crc32c_sb8(u_int32_t crc, const unsigned char *p,
+                            size_t len) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	u_int64_t w;
+
+	while (len >= 8) {
+		w = crc32c_load(p) ^ crc;
+		crc = crc32c_table[7][w & 0xff] ^
+		      crc32c_table[6][(w >> 8) & 0xff] ^
+		      crc32c_table[5][(w >> 16) & 0xff] ^
+		      crc32c_table[4][(w >> 24) & 0xff] ^
+		      crc32c_table[3][(w >> 32) & 0xff] ^
+		      crc32c_table[2][(w >> 40) & 0xff] ^
+		      crc32c_table[1][(w >> 48) & 0xff] ^
+		      crc32c_table[0][w >> 56];
+		p += 8;
+		len -= 8;
+	}
+#endif
+	return crc32c_bytes(crc, p, len);
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CRC32C_X86
+#include <immintrin.h>
+
+#ifdef __x86_64__
+#define crc32c_word(crc, p)	_mm_crc32_u64((crc), crc32c_load(p))
+#else
+#define crc32c_word(crc, p)	_mm_crc32_u32(_mm_crc32_u32((crc), \
+				    (u_int32_t)crc32c_load(p)), \
+				    (u_int32_t)(crc32c_load(p) >> 32))
+#endif
+
+/* Run three streams of n bytes each over the next 3*n bytes */
+#define CRC32C_STREAMS(crc, p, n, table) do { \
+		u_int64_t c0 = (crc), c1 = 0, c2 = 0; \
+		const unsigned char *end = (p)+(n); \
+		\
+		while ((p) < end) { \
+			c0 = crc32c_word(c0, (p)); \
+			c1 = crc32c_word(c1, (p)+(n)); \
+			c2 = crc32c_word(c2, (p)+2*(n)); \
+			(p) += 8; \
+		} \
+		c0 = crc32c_shift((table), c0) ^ c1; \
+		(crc) = crc32c_shift((table), c0) ^ c2; \
+		(p) += 2*(n); \
+	} while (0)
+
+__attribute__((target("sse4.2")))
+static u_int32_t crc32c_sse42(u_int32_t crc, const unsigned char *p,
+                              size_t len) {
+	u_int64_t c;
+
+	while (len >= 3*CRC32C_LONG) {
+		CRC32C_STREAMS(crc, p, CRC32C_LONG, crc32c_long);
+		len -= 3*CRC32C_LONG;
+	}
+	while (len >= 3*CRC32C_SHORT) {
+		CRC32C_STREAMS(crc, p, CRC32C_SHORT, crc32c_short);
+		len -= 3*CRC32C_SHORT;
+	}
+	c = crc;
+	while (len >= 8) {
+		c = crc32c_word(c, p);
+		p += 8;
+		len -= 8;
+	}
+	crc = c;
+	while (len--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+
+#ifdef __x86_64__
+/* Folding constants, x^n mod P bit reversed and shifted left one, for
+ * n = 4*128+32 and 4*128-32 (across 64 bytes), 128+32 and 128-32
+ * (across 16)
+ */
+#define CRC32C_K1	0x0740eef02ULL
+#define CRC32C_K2	0x09e4addf8ULL
+#define CRC32C_K3	0x0f20c0dfeULL
+#define CRC32C_K4	0x14cd00bd6ULL
+
+#define CRC32C_FOLD(x, k, y) \
+	_mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128((x), (k), 0x00), \
+	                            _mm_clmulepi64_si128((x), (k), 0x11)), (y))
+
+__attribute__((target("sse4.2,pclmul")))
+static u_int32_t crc32c_pclmul(u_int32_t crc, const unsigned char *p,
+                               size_t len) {
+	__m128i x0, x1, x2, x3, k;
+	u_int64_t c;
+
+	if (len < CRC32C_FOLD_MIN)
+		return crc32c_sse42(crc, p, len);
+
+	x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)p),
+	                   _mm_cvtsi32_si128(crc));
+	x1 = _mm_loadu_si128((const __m128i *)(p+16));
+	x2 = _mm_loadu_si128((const __m128i *)(p+32));
+	x3 = _mm_loadu_si128((const __m128i *)(p+48));
+	p += 64;
+	len -= 64;
+
+	k = _mm_set_epi64x(CRC32C_K2, CRC32C_K1);
+	while (len >= 64) {
+		x0 = CRC32C_FOLD(x0, k, _mm_loadu_si128((const __m128i *)p));
+		x1 = CRC32C_FOLD(x1, k, _mm_loadu_si128((const __m128i *)(p+16)));
+		x2 = CRC32C_FOLD(x2, k, _mm_loadu_si128((const __m128i *)(p+32)));
+		x3 = CRC32C_FOLD(x3, k, _mm_loadu_si128((const __m128i *)(p+48)));
+		p += 64;
+		len -= 64;
+	}
+
+	/* Down to one remainder, and any whole 16 bytes left */
+	k = _mm_set_epi64x(CRC32C_K4, CRC32C_K3);
+	x0 = CRC32C_FOLD(x0, k, x1);
+	x0 = CRC32C_FOLD(x0, k, x2);
+	x0 = CRC32C_FOLD(x0, k, x3);
+	while (len >= 16) {
+		x0 = CRC32C_FOLD(x0, k, _mm_loadu_si128((const __m128i *)p));
+		p += 16;
+		len -= 16;
+	}
+
+	/* The remainder has the same CRC as everything folded into it, so
+	 * the crc32 instruction can finish it off
+	 */
+	c = _mm_crc32_u64(0, (u_int64_t)_mm_cvtsi128_si64(x0));
+	c = _mm_crc32_u64(c, (u_int64_t)_mm_cvtsi128_si64(_mm_srli_si128(x0, 8)));
+	return crc32c_sse42(c, p, len);
+}
+#endif /* __x86_64__ */
+#endif /* CRC32C_X86 */
+
+static u_int32_t crc32c_pick(u_int32_t crc, const unsigned char *p,
+                             size_t len);
+static crc32c_fn crc32c_impl = crc32c_pick;
+
+/* Build the tables, and find out what this CPU can do */
+static u_int32_t crc32c_pick(u_int32_t crc, const unsigned char *p,
+                             size_t len) {
+	crc32c_tables();
+	crc32c_impl = crc32c_sb8;
+#ifdef CRC32C_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		crc32c_impl = crc32c_sse42;
+#ifdef __x86_64__
+		if (__builtin_cpu_supports("pclmul"))
+			crc32c_impl = crc32c_pclmul;
+#endif
+	}
+#endif
+	return crc32c_impl(crc, p, len);
+}
+
+u_int32_t crc32c_le(u_int32_t crc, unsigned char const *p, size_t len) {
+	return crc32c_impl(crc, p, len);
+}
+
+#if defined(UNITTEST) || defined(CRC32C_BENCH)
+/* Every way this CPU can run, for crc32.c's UNITTEST and the bench */
+typedef struct {
+	const char *name;
+	crc32c_fn fn;
+} crc32c_impls;
+
+static const crc32c_impls crc32c_all[] = {
+	{ "bytes", crc32c_bytes },
+	{ "slice8", crc32c_sb8 },
+#ifdef CRC32C_X86
+	{ "sse4.2", crc32c_sse42 },
+#ifdef __x86_64__
+	{ "pclmul", crc32c_pclmul },
+#endif
+#endif
+};
+
+/* The i'th variant this CPU can run, or NULL if there are no more */
+static const crc32c_impls *crc32c_usable(int i) {
+	int k;
+
+	crc32c_le(0, NULL, 0);
+	for (k=0; k<(int)(sizeof(crc32c_all)/sizeof(crc32c_all[0])); k++) {
+#ifdef CRC32C_X86
+		if (crc32c_all[k].fn == crc32c_sse42 &&
+		    !__builtin_cpu_supports("sse4.2"))
+			continue;
+#ifdef __x86_64__
+		if (crc32c_all[k].fn == crc32c_pclmul &&
+		    (!__builtin_cpu_supports("sse4.2") ||
+		     !__builtin_cpu_supports("pclmul")))
+			continue;
+#endif
+#endif
+		if (!i--)
+			return &crc32c_all[k];
+	}
+	return NULL;
+}
+
+const char *crc32c_variant_name(int i) {
+	const crc32c_impls *v = crc32c_usable(i);
+
+	return v ? v->name : NULL;
+}
+
+u_int32_t crc32c_variant(int i, u_int32_t crc, unsigned char const *p,
+                         size_t len) {
+	return crc32c_usable(i)->fn(crc, p, len);
+}
+#endif /* UNITTEST || CRC32C_BENCH */
+
+#ifdef CRC32C_BENCH
+/* make crc32cbench && ./crc32cbench
+ * Times each variant this CPU can run at a few buffer sizes, against
+ * the crc32_le() that SCTP used to use.
+ */
+#include <stdlib.h>
+#include <time.h>
+
+#define CRC32C_BENCH_BYTES	(1ULL<<30)	/* per size and variant */
+
+static double crc32c_secs(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+int main(void) {
+	static const int sizes[] = { 64, 576, 1500, 9000, 65535 };
+	static unsigned char buf[65536];
+	volatile u_int32_t sink = 0;
+	crc32c_fn fn;
+	double t, ref;
+	long reps, r;
+	int s, k;
+
+	for (s=0; s<(int)sizeof(buf); s++) buf[s] = random();
+	printf("%8s %10s", "bytes", "crc32_le");
+	for (k=0; crc32c_variant_name(k); k++)
+		printf(" %16s", crc32c_variant_name(k));
+	printf("   (GB/s, and speedup)\n");
+
+	for (s=0; s<(int)(sizeof(sizes)/sizeof(sizes[0])); s++) {
+		reps = CRC32C_BENCH_BYTES/sizes[s];
+		t = crc32c_secs();
+		for (r=0; r<reps; r++)
+			sink += crc32_le(~0, buf, sizes[s]);
+		ref = crc32c_secs()-t;
+		printf("%8d %10.2f", sizes[s], CRC32C_BENCH_BYTES/ref/1e9);
+		for (k=0; crc32c_variant_name(k); k++) {
+			fn = crc32c_usable(k)->fn;
+			t = crc32c_secs();
+			for (r=0; r<reps; r++)
+				sink += fn(~0, buf, sizes[s]);
+			t = crc32c_secs()-t;
+			printf(" %9.2f (%4.1fx)", CRC32C_BENCH_BYTES/t/1e9, ref/t);
+		}
+		printf("\n");
+	}
+	return sink == 0xdeadbeef;
+}
+#endif /* CRC32C_BENCH */
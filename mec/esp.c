@@ -26,14 +26,14 @@ crypto_module *authesp, *cryptoesp;
 sendip_data *
 initialize(void)
 {
-	sendip_data *ret = malloc(sizeof(sendip_data));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
 	/* We allocate an additional 4 bytes to ensure we have
 	 * enough space for any padding in finalize(). In reality,
 	 * we will only need at most 3 bytes, but this should
 	 * help keep things aligned better.
 	 */
-	esp_header *esp = malloc(sizeof(esp_header) + ESP_MIN_PADDING);
-	esp_private *priv = malloc(sizeof(esp_private));
+	esp_header *esp = arena_alloc(sizeof(esp_header) + ESP_MIN_PADDING);
+	esp_private *priv = arena_alloc(sizeof(esp_private));
 
 	memset(esp,0,sizeof(esp_header)+ESP_MIN_PADDING);
 	memset(priv,0,sizeof(esp_private));
@@ -74,7 +74,7 @@ do_opt(char *opt, char *arg, sendip_data *pack)
 		esp->tail.padlen = length;
 		if (length >  ESP_MIN_PADDING) {
 			pack->alloc_len += length-ESP_MIN_PADDING;
-			pack->data = realloc(esp, pack->alloc_len);
+			pack->data = arena_realloc(esp, pack->alloc_len);
 		}
 		/* We don't bother doing anything with the padding
 		 * contents right now
@@ -90,7 +90,7 @@ do_opt(char *opt, char *arg, sendip_data *pack)
 		length = stringargument(arg, &temp);
 		priv->ivlen = length;
 		pack->alloc_len += length;
-		pack->data = realloc(esp, pack->alloc_len);
+		pack->data = arena_realloc(esp, pack->alloc_len);
 		esp = (esp_header *)pack->data;
 		/* Check if we have an ICV we have to shove down */
 		if (priv->icvlen)
@@ -107,7 +107,7 @@ do_opt(char *opt, char *arg, sendip_data *pack)
 		length = stringargument(arg, &temp);
 		priv->icvlen = length;
 		pack->alloc_len += length;
-		pack->data = realloc(esp, pack->alloc_len);
+		pack->data = arena_realloc(esp, pack->alloc_len);
 		esp = (esp_header *)pack->data;
 		memcpy(&esp->tail.ivicv[priv->ivlen], temp, priv->icvlen);
 		pack->modified |= ESP_MOD_ICV;
@@ -115,8 +115,8 @@ do_opt(char *opt, char *arg, sendip_data *pack)
 	case 'k':	/* Key */
 		length = stringargument(arg, &temp);
 		priv->keylen = length;
-		priv = (esp_private *)realloc(priv,
-		                              sizeof(esp_private) + length);
+		priv = (esp_private *)arena_realloc(priv,
+		                                    sizeof(esp_private) + length);
 		memcpy(priv->key, temp, priv->keylen);
 		pack->private = priv;
 		pack->modified |= ESP_MOD_KEY;
@@ -208,13 +208,13 @@ finalize(char *hdrs, sendip_data *headers[], int index,
 	padlen = esp->tail.padlen;
 	nexthdr = esp->tail.nexthdr;
 	if (priv->ivlen) {
-		iv = (u_int8_t *)malloc(priv->ivlen);
+		iv = (u_int8_t *)arena_alloc(priv->ivlen);
 		memcpy(iv, &esp->tail.ivicv[0], priv->ivlen);
 	} else {
 		iv = NULL;
 	}
 	if (priv->icvlen) {
-		icv = (u_int8_t *)malloc(priv->icvlen);
+		icv = (u_int8_t *)arena_alloc(priv->icvlen);
 		memcpy(icv, &esp->tail.ivicv[priv->ivlen], priv->icvlen);
 	} else {
 		icv = NULL;
@@ -228,7 +228,7 @@ finalize(char *hdrs, sendip_data *headers[], int index,
 	if (iv) {
 		memcpy(where, iv, priv->ivlen);
 		where += priv->ivlen;
-		free((void *)iv);
+		arena_free((void *)iv);
 	}
 	/* I think memcpy would work, too (at least, the implementations
 	 * of it that I have seen), but since technically this could
@@ -251,7 +251,7 @@ finalize(char *hdrs, sendip_data *headers[], int index,
 	if (icv) {
 		memcpy(where, icv, priv->icvlen);
 		where += priv->icvlen;
-		free((void *)icv);
+		arena_free((void *)icv);
 	}
 
 	/* Now let's testify to the real lengths */
@@ -273,7 +273,7 @@ finalize(char *hdrs, sendip_data *headers[], int index,
 	}
 
 	/* @@ We can't free the private data, as WESP needs it */
-	/* free((void *)priv);
+	/* arena_free((void *)priv);
 	pack->private = NULL; */
 	return ret;
 }
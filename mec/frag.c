@@ -22,13 +22,14 @@ const char opt_char='F';	/* -f is load from file */
 sendip_data *
 initialize(void)
 {
-	sendip_data *ret = malloc(sizeof(sendip_data));
-	frag_header *frag = malloc(sizeof(frag_header));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
+	frag_header *frag = arena_alloc(sizeof(frag_header));
 
 	memset(frag,0,sizeof(frag_header));
 	ret->alloc_len = sizeof(frag_header);
 	ret->data = frag;
 	ret->modified=0;
+	ret->private=NULL;
 	return ret;
 }
 
@@ -28,12 +28,13 @@ const char opt_char='g';
 sendip_data *
 initialize(void)
 {
-	sendip_data *ret = malloc(sizeof(sendip_data));
-	gre_header *gre = malloc(sizeof(gre_header));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
+	gre_header *gre = arena_alloc(sizeof(gre_header));
 	memset(gre,0,sizeof(gre_header));
 	ret->alloc_len = sizeof(gre_header);
 	ret->data = gre;
 	ret->modified=0;
+	ret->private=NULL;
 	return ret;
 }
 
@@ -131,7 +132,7 @@ gre_resize(sendip_data *pack, u_int16_t flags, u_int16_t addflag)
 
 	/* Allocate any additional space needed */
 	if (pack->alloc_len >= size) return gre; /* ?? */
-	pack->data = realloc(pack->data, size);
+	pack->data = arena_realloc(pack->data, size);
 	pack->alloc_len = size;
 	gre = (gre_header *)pack->data;
 
@@ -62,14 +62,15 @@ const char opt_char='d';
 sendip_data *
 initialize(void)
 {
-	sendip_data *ret = malloc(sizeof(sendip_data));
-	hop_header *hop = malloc(HDR_ALLOC);
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
+	hop_header *hop = arena_alloc(HDR_ALLOC);
 
 	memset(hop,0,HDR_ALLOC);
 	hop->hdrlen = 0;
 	ret->modified = sizeof(hop_header);	/* for the opt header itself */
 	ret->alloc_len = HDR_ALLOC;
 	ret->data = hop;
+	ret->private = NULL;
 	return ret;
 }
 
@@ -97,7 +98,7 @@ addopt(sendip_data *pack, struct ipv6_hopopt *opt)
 	 */
 	if (hoplen + optlen > alloclen) {
 		alloclen = (1 + (hoplen+optlen)/HDR_ALLOC)*HDR_ALLOC;
-		hop = realloc((void *)hop, alloclen);
+		hop = arena_realloc((void *)hop, alloclen);
 		pack->data = hop;
 		pack->alloc_len = alloclen;
 	}
@@ -157,50 +158,50 @@ bool do_opt(char *opt, char *arg, sendip_data *pack)
 		}
 
 		hopt = (struct ipv6_hopopt *)
-		       malloc(svalue);
+		       arena_alloc(svalue);
 		hopt->hopt_type = IPV6_TLV_PADN;
 		hopt->hopt_len = svalue-2;
 		memset(hopt->hopt_data, 0, svalue-2);
 		if (!addopt(pack, hopt))
 			return FALSE;
-		free((void *)hopt);
+		arena_free((void *)hopt);
 		break;
 	case 'r':	/* router alert */
 		pack->modified |= HOP_MOD_RA;
 		svalue = integerargument(arg, 2);
 		hopt = (struct ipv6_hopopt *)
-		       malloc(sizeof(struct ipv6_hopopt) + 2);
+		       arena_alloc(sizeof(struct ipv6_hopopt) + 2);
 		hopt->hopt_type = IPV6_TLV_ROUTERALERT;
 		hopt->hopt_len = 2;
 		memcpy(hopt->hopt_data, &svalue, 2);
 		if (!addopt(pack, hopt))
 			return FALSE;
-		free((void *)hopt);
+		arena_free((void *)hopt);
 		break;
 	case 'j':	/* jumbo frame length */
 		pack->modified |= HOP_MOD_JUMBO;
 		value = integerargument(arg, 4);
 		hopt = (struct ipv6_hopopt *)
-		       malloc(sizeof(struct ipv6_hopopt) + 4);
+		       arena_alloc(sizeof(struct ipv6_hopopt) + 4);
 		hopt->hopt_type = IPV6_TLV_JUMBO;
 		hopt->hopt_len = 4;
 		memcpy(hopt->hopt_data, &value, 4);
 		if (!addopt(pack, hopt))
 			return FALSE;
-		free((void *)hopt);
+		arena_free((void *)hopt);
 		break;
 	case 'h':	/* (destination option only) home address */
 		if (inet_pton(AF_INET6, arg, &addr)) {
 			pack->modified |= HOP_MOD_HAO;
 			hopt = (struct ipv6_hopopt *)
-			       malloc(sizeof(struct ipv6_hopopt)
+			       arena_alloc(sizeof(struct ipv6_hopopt)
 			              + sizeof(struct in6_addr));
 			hopt->hopt_type = IPV6_TLV_HAO;
 			hopt->hopt_len = sizeof(struct in6_addr);
 			memcpy(hopt->hopt_data, &addr, sizeof(struct in6_addr));
 			if (!addopt(pack, hopt))
 				return FALSE;
-			free((void *)hopt);
+			arena_free((void *)hopt);
 		} else {
 			fprintf(stderr, "Couldn't parse home address %s\n",
 			        arg);
@@ -243,7 +244,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack)
 			temp = NULL;
 		}
 		hopt = (struct ipv6_hopopt *)
-		       malloc(sizeof(struct ipv6_hopopt) + length);
+		       arena_alloc(sizeof(struct ipv6_hopopt) + length);
 		hopt->hopt_type = type;
 		hopt->hopt_len = svalue;
 		if (length) {
@@ -252,7 +253,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack)
 		}
 		if (!addopt(pack, hopt))
 			return FALSE;
-		free((void *)hopt);
+		arena_free((void *)hopt);
 		break;
 	}
 	return TRUE;
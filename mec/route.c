@@ -23,17 +23,18 @@ const char opt_char='o';	/* r'o'uting - r and R already used */
 sendip_data *
 initialize(void)
 {
-	sendip_data *ret = malloc(sizeof(sendip_data));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
 	/* Note the Linux generic routing header structure doesn't
 	 * include the 4-byte reserved field. To get that, let's
 	 * just use the type 0 routing header as the allocation unit.
 	 */
-	route_header *route = malloc(sizeof(struct rt0_hdr));
+	route_header *route = arena_alloc(sizeof(struct rt0_hdr));
 
 	memset(route,0,sizeof(struct rt0_hdr));
 	ret->alloc_len = sizeof(struct rt0_hdr);
 	ret->data = route;
 	ret->modified=0;
+	ret->private=NULL;
 	return ret;
 }
 
@@ -48,7 +49,7 @@ readaddrs(char *arg, sendip_data *pack)
 	char *addrs[ADDRMAX];
 
 	count = parsenargs(arg, addrs, ADDRMAX, ", ");
-	pack->data = realloc(pack->data,
+	pack->data = arena_realloc(pack->data,
 	                     sizeof(struct rt0_hdr)+count*sizeof(struct in6_addr));
 	rt = (struct rt0_hdr *)pack->data;
 	pack->alloc_len = sizeof(struct rt0_hdr)+count*sizeof(struct in6_addr);
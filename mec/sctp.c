@@ -23,13 +23,14 @@ const char opt_char='s';
 sendip_data *
 initialize(void)
 {
-	sendip_data *ret = malloc(sizeof(sendip_data));
-	sctp_header *sctp = malloc(sizeof(sctp_header));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
+	sctp_header *sctp = arena_alloc(sizeof(sctp_header));
 
 	memset(sctp,0,sizeof(sctp_header));
 	ret->alloc_len = sizeof(sctp_header);
 	ret->data = sctp;
 	ret->modified=0;
+	ret->private=NULL;
 	return ret;
 }
 
@@ -44,7 +45,7 @@ add_chunk(sendip_data *pack, u_int8_t type)
 	sctp_header *sctp = (sctp_header *)pack->data;
 	sctp_chunk_header *chunk;
 
-	pack->data = sctp = (sctp_header *)realloc((void *)sctp,
+	pack->data = sctp = (sctp_header *)arena_realloc((void *)sctp,
 	                    pack->alloc_len + sizeof(sctp_chunk_header));
 	chunk = (sctp_chunk_header *)(void *)((u_int8_t *)sctp + pack->alloc_len);
 	pack->alloc_len += sizeof(sctp_chunk_header);
@@ -64,7 +65,7 @@ grow_chunk(sendip_data *pack, sctp_chunk_header *chunk,
 	/* urp */
 	int offset = (u_int8_t *)chunk - (u_int8_t *)sctp;
 
-	pack->data = sctp = (sctp_header *)realloc((void *)sctp,
+	pack->data = sctp = (sctp_header *)arena_realloc((void *)sctp,
 	                    pack->alloc_len + length);
 	chunk = (sctp_chunk_header *)(void *)((u_int8_t *)sctp + offset);
 	pack->alloc_len += length;
@@ -109,7 +110,7 @@ grow_chunk_round4(sendip_data *pack, sctp_chunk_header *chunk,
 	roundup = round4(length);
 	if (roundup == length) return grow_chunk(pack, chunk, length, data);
 
-	pack->data = sctp = (sctp_header *)realloc((void *)sctp,
+	pack->data = sctp = (sctp_header *)arena_realloc((void *)sctp,
 	                    pack->alloc_len + roundup);
 	chunk = (sctp_chunk_header *)(void *)((u_int8_t *)sctp + offset);
 	pack->alloc_len += roundup;
@@ -419,12 +420,23 @@ bool finalize(char *hdrs, sendip_data *headers[], int index,
               sendip_data *data, sendip_data *pack)
 {
 	sctp_header *sctp = (sctp_header *)pack->data;
+	u_int8_t *check = (u_int8_t *)&sctp->checksum;
+	u_int32_t crc;
 
+	/* CRC32c over the whole SCTP packet, stored least significant
+	 * byte first (RFC 4960, appendix B)
+	 */
 	if (!(pack->modified&SCTP_MOD_CHECKSUM)) {
 		sctp->checksum = 0;
 
-		sctp->checksum = crc32(~((u_int32_t) 0), (void *)sctp,
-		                       pack->alloc_len);
+		crc = crc32c(~((u_int32_t) 0), (void *)sctp, pack->alloc_len);
+		if (data->alloc_len)
+			crc = crc32c(crc, data->data, data->alloc_len);
+		crc = ~crc;
+		check[0] = crc;
+		check[1] = crc >> 8;
+		check[2] = crc >> 16;
+		check[3] = crc >> 24;
 	}
 	return TRUE;
 }
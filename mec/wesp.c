@@ -22,13 +22,14 @@ const char opt_char='w';
 sendip_data *
 initialize(void)
 {
-	sendip_data *ret = malloc(sizeof(sendip_data));
-	wesp_header *wesp = malloc(sizeof(wesp_header));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
+	wesp_header *wesp = arena_alloc(sizeof(wesp_header));
 
 	memset(wesp,0,sizeof(wesp_header));
 	ret->alloc_len = sizeof(wesp_header);
 	ret->data = wesp;
 	ret->modified=0;
+	ret->private=NULL;
 	return ret;
 }
 
@@ -41,7 +42,7 @@ addpadding(sendip_data *pack)
 	wesp_header *wesp = (wesp_header *)pack->data;
 	int alloclen = pack->alloc_len+4;
 
-	wesp = realloc((void *)wesp, alloclen);
+	wesp = arena_realloc((void *)wesp, alloclen);
 	pack->data = wesp;
 	pack->alloc_len = alloclen;
 	/* Be a good citizen */
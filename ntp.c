@@ -86,12 +86,13 @@ bool make_ts(ntp_ts *dest, char *src) {
 }
 
 sendip_data *initialize(void) {
-	sendip_data *ret = malloc(sizeof(sendip_data));
-	ntp_header *ntp = malloc(sizeof(ntp_header));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
+	ntp_header *ntp = arena_alloc(sizeof(ntp_header));
 	memset(ntp,0,sizeof(ntp_header));
 	ret->alloc_len = sizeof(ntp_header);
 	ret->data = (void *)ntp;
 	ret->modified=0;
+	ret->private=NULL;
 	return ret;
 }
 
@@ -0,0 +1,204 @@
+/* pace.c - send rate control for sendip
+ * Packets can be limited to a number of packets (--pps) or bits
+ * (--bps) per second, with up to --burst packets allowed to go back to
+ * back. Each packet is given a due time; the pacer sleeps with
+ * clock_nanosleep() until just before it, and then spins on the clock
+ * for the rest, which gets the timing right to a microsecond or so
+ * without burning a CPU at low rates. How early to stop sleeping is
+ * measured once at startup.
+ *
+ * Because the due times are absolute rather than relative to the last
+ * packet, time lost to a slow packet is made up (within the burst) and
+ * the error doesn't build up over a long run. Unless --burst says
+ * otherwise, the bucket holds PACE_CATCHUP worth of packets, which is
+ * enough to ride out the odd scheduling hiccup; a small --burst gives
+ * smoother output at the cost of falling behind after one.
+ *
+ * When replaying a capture with --speed, packets are instead due at
+ * their original times (relative to the first), divided by the speed.
+ * A rate limit, if there is one, applies on top of that.
+ */
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include "sendip_module.h"
+#include "xmit.h"
+#include "pace.h"
+
+#define PACE_CALIBRATE	8		/* sleeps used to measure wakeup lag */
+#define PACE_PROBE	50000		/* ns in each of those sleeps */
+#define PACE_MAXSLACK	2000000		/* never spin for longer than this */
+#define PACE_FLUSH	1000000		/* flush batches before waits this long */
+#define PACE_CATCHUP	10000000	/* default bucket size, in ns */
+#define PACE_YIELD	10000		/* spin with sched_yield() above this */
+
+static u_int64_t pace_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void pace_sleep_until(u_int64_t when) {
+	struct timespec ts;
+
+	ts.tv_sec = when/1000000000ULL;
+	ts.tv_nsec = when%1000000000ULL;
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+void pace_init(pacer *p) {
+	memset(p, 0, sizeof(pacer));
+}
+
+/* Parse a rate, with an optional k, M or G multiplier */
+int pace_rate(pacer *p, const char *arg, bool bits) {
+	char *end;
+	double rate = strtod(arg, &end);
+
+	switch(*end) {
+	case 'k': case 'K': rate *= 1e3; end++; break;
+	case 'm': case 'M': rate *= 1e6; end++; break;
+	case 'g': case 'G': rate *= 1e9; end++; break;
+	}
+	if(end == arg || *end || rate <= 0) {
+		fprintf(stderr,"Bad rate %s\n",arg);
+		return -1;
+	}
+	if(p->rate) {
+		fprintf(stderr,"Only one of -T, --pps and --bps can be given\n");
+		return -1;
+	}
+	p->rate = rate;
+	p->bits = bits;
+	return 0;
+}
+
+/* -T: a delay of (possibly fractional) seconds between packets */
+int pace_delay(pacer *p, const char *arg) {
+	char *end;
+	double delay = strtod(arg, &end);
+
+	if(end == arg || *end || delay < 0) {
+		fprintf(stderr,"Bad delay %s\n",arg);
+		return -1;
+	}
+	if(delay == 0) return 0;	/* as fast as possible */
+	if(p->rate) {
+		fprintf(stderr,"Only one of -T, --pps and --bps can be given\n");
+		return -1;
+	}
+	p->rate = 1/delay;
+	p->bits = FALSE;
+	return 0;
+}
+
+/* --speed: replay a capture at this multiple of its own pace */
+int pace_speed(pacer *p, const char *arg) {
+	char *end;
+	double speed = strtod(arg, &end);
+
+	if(end == arg || *end || speed <= 0) {
+		fprintf(stderr,"Bad speed %s\n",arg);
+		return -1;
+	}
+	p->speed = speed;
+	return 0;
+}
+
+/* Each of n workers gets an equal part of the rate */
+void pace_share(pacer *p, int n) {
+	if(n > 1) p->rate /= n;
+}
+
+/* Start the clock, and find out how late clock_nanosleep() wakes us */
+void pace_start(pacer *p) {
+	u_int64_t t, lag, worst=0;
+	int i;
+
+	p->start = pace_now();
+	p->tat = 0;
+	p->epoch = p->start;
+	if(!p->rate && !p->speed) return;
+	for(i=0; i<PACE_CALIBRATE; i++) {
+		t = pace_now()+PACE_PROBE;
+		pace_sleep_until(t);
+		lag = pace_now()-t;
+		if(lag > worst) worst = lag;
+	}
+	p->slack = worst + worst/2;
+	if(p->slack > PACE_MAXSLACK) p->slack = PACE_MAXSLACK;
+	p->start = p->epoch = pace_now();
+}
+
+/* Sleep, then spin, until due; returns the time it is now */
+static u_int64_t pace_until_ns(pacer *p, xmit_ctx *ctx, u_int64_t now,
+                               u_int64_t due) {
+	/* Don't leave queued packets waiting with us */
+	if(due-now > PACE_FLUSH) xmit_flush(ctx);
+	if(due-now > p->slack) pace_sleep_until(due-p->slack);
+	/* Other workers may be sharing the CPU */
+	while((now = pace_now()) < due) {
+		if(due-now > PACE_YIELD) sched_yield();
+	}
+	return now;
+}
+
+/* Wait until a packet of len bytes may be sent */
+void pace_wait(pacer *p, xmit_ctx *ctx, int len) {
+	double inc, depth;
+	u_int64_t now, due;
+
+	if(!p->rate) return;
+	inc = (p->bits ? len*8.0 : 1.0)*1e9/p->rate;
+	/* How far ahead of the schedule a full bucket lets us get */
+	if(p->burst)
+		depth = (p->burst-1)*inc;
+	else
+		depth = (inc < PACE_CATCHUP) ? PACE_CATCHUP-inc : 0;
+	now = pace_now();
+	/* Start with an empty bucket, so a short run isn't all burst */
+	if(!p->tat) p->tat = now+depth;
+	due = (u_int64_t)(p->tat - depth);
+	if(now < due) now = pace_until_ns(p, ctx, now, due);
+	if(p->tat < now) p->tat = (double)now;
+	p->tat += inc;
+}
+
+/* --replay --speed: note when the replay (or this pass of it) started */
+void pace_epoch(pacer *p) {
+	p->epoch = pace_now();
+}
+
+/* Wait until offset ns (of capture time) after the epoch, scaled by
+ * the speed
+ */
+void pace_until(pacer *p, xmit_ctx *ctx, u_int64_t offset) {
+	u_int64_t now, due;
+
+	if(!p->speed) return;
+	due = p->epoch + (u_int64_t)(offset/p->speed);
+	now = pace_now();
+	if(now < due) pace_until_ns(p, ctx, now, due);
+}
+
+void pace_report(pacer *p, xmit_stats *stats, bool verbose) {
+	double secs;
+
+	if(!p->rate && !verbose) return;
+	secs = (pace_now()-p->start)/1e9;
+	if(secs <= 0) return;
+	fprintf(stderr, "Rate: %.0f packets/s, %.3f Mbit/s over %.3f s",
+	        stats->packets/secs, stats->bytes*8/secs/1e6, secs);
+	if(p->rate) {
+		fprintf(stderr, " (target %.0f %s/s)", p->rate,
+		        p->bits ? "bits" : "packets");
+	}
+	fprintf(stderr, "\n");
+}
@@ -0,0 +1,32 @@
+/* pace.h - send rate control for sendip
+ */
+#ifndef _SENDIP_PACE_H
+#define _SENDIP_PACE_H
+
+/* A token bucket, kept as the time at which the bucket will next be
+ * full enough (the "theoretical arrival time" of the GCRA). All times
+ * are CLOCK_MONOTONIC nanoseconds.
+ */
+typedef struct {
+	double rate;		/* packets or bits per second; 0 = unlimited */
+	bool bits;		/* rate is in bits rather than packets */
+	int burst;		/* packets that may go back to back, 0 = auto */
+	double tat;		/* when the next packet is due */
+	u_int64_t slack;	/* how early to wake up and start spinning */
+	u_int64_t start;	/* when the run started */
+	double speed;		/* --replay: multiple of capture time; 0 = none */
+	u_int64_t epoch;	/* when the replay pass started */
+} pacer;
+
+void pace_init(pacer *p);
+int pace_rate(pacer *p, const char *arg, bool bits);
+int pace_delay(pacer *p, const char *arg);
+int pace_speed(pacer *p, const char *arg);
+void pace_share(pacer *p, int n);
+void pace_start(pacer *p);
+void pace_wait(pacer *p, xmit_ctx *ctx, int len);
+void pace_epoch(pacer *p);
+void pace_until(pacer *p, xmit_ctx *ctx, u_int64_t offset);
+void pace_report(pacer *p, xmit_stats *stats, bool verbose);
+
+#endif  /* _SENDIP_PACE_H */
@@ -0,0 +1,183 @@
+/* pcap.c - pcap and pcapng output for sendip
+ * With --pcap or --pcapng, dumped packets are written as a capture file
+ * rather than back to back, so they can be told apart again and fed to
+ * other tools. Each packet is stamped with the time it was generated,
+ * to the nanosecond. Packets are plain IP (LINKTYPE_RAW) unless there
+ * is an Ethernet header to put in front of them (--ether, or a link
+ * level --xmit method).
+ *
+ * Records are collected in a large buffer and written out a buffer at a
+ * time. Everything is written in host byte order, which both formats
+ * allow (readers go by the magic number).
+ */
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include "sendip_module.h"
+#include "pcap.h"
+
+#define PCAP_MAGIC_NS	0xa1b23c4d	/* pcap with nanosecond timestamps */
+
+#define PCAPNG_SHB	0x0A0D0D0A	/* section header block */
+#define PCAPNG_IDB	0x00000001	/* interface description block */
+#define PCAPNG_EPB	0x00000006	/* enhanced packet block */
+#define PCAPNG_BOM	0x1A2B3C4D
+
+#define PCAP_ETHER	14
+
+static int pcap_drain(pcap_out *p) {
+	size_t done=0;
+	ssize_t n;
+
+	while(done < p->used) {
+		n = write(p->fd, p->buf+done, p->used-done);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			perror("Couldn't write capture");
+			return -1;
+		}
+		done += n;
+	}
+	p->used = 0;
+	return 0;
+}
+
+/* Room for len more bytes in the buffer */
+static char *pcap_space(pcap_out *p, size_t len) {
+	if(p->used+len > PCAP_BUFSIZE && pcap_drain(p) < 0)
+		return NULL;
+	return p->buf+p->used;
+}
+
+static void put16(char **q, u_int16_t v) {
+	memcpy(*q, &v, 2);
+	*q += 2;
+}
+
+static void put32(char **q, u_int32_t v) {
+	memcpy(*q, &v, 4);
+	*q += 4;
+}
+
+void pcap_init(pcap_out *p) {
+	memset(p, 0, sizeof(pcap_out));
+	p->fd = -1;
+}
+
+/* Open name ("-" for stdout) and write out the file header */
+int pcap_open(pcap_out *p, const char *name, bool ng, const u_int8_t *l2) {
+	u_int16_t linktype = l2 ? LINKTYPE_ETHERNET : LINKTYPE_RAW;
+	char *q;
+
+	if(!strcmp(name, "-"))
+		p->fd = 1;
+	else if((p->fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
+		perror(name);
+		return -1;
+	}
+	if((p->buf = malloc(PCAP_BUFSIZE)) == NULL) {
+		perror("OUT OF MEMORY!\n");
+		if(p->fd != 1) close(p->fd);
+		p->fd = -1;
+		return -1;
+	}
+	p->ng = ng;
+	p->l2 = l2;
+	p->used = 0;
+
+	q = p->buf;
+	if(!ng) {
+		put32(&q, PCAP_MAGIC_NS);
+		put16(&q, 2);			/* version 2.4 */
+		put16(&q, 4);
+		put32(&q, 0);			/* thiszone */
+		put32(&q, 0);			/* sigfigs */
+		put32(&q, PCAP_SNAPLEN);
+		put32(&q, linktype);
+	} else {
+		/* Section header */
+		put32(&q, PCAPNG_SHB);
+		put32(&q, 28);
+		put32(&q, PCAPNG_BOM);
+		put16(&q, 1);			/* version 1.0 */
+		put16(&q, 0);
+		put32(&q, 0xFFFFFFFF);		/* section length unknown */
+		put32(&q, 0xFFFFFFFF);
+		put32(&q, 28);
+		/* The one interface, with nanosecond timestamps */
+		put32(&q, PCAPNG_IDB);
+		put32(&q, 32);
+		put16(&q, linktype);
+		put16(&q, 0);
+		put32(&q, PCAP_SNAPLEN);
+		put16(&q, 9);			/* if_tsresol */
+		put16(&q, 1);
+		put32(&q, 9);			/* 10^-9, padded */
+		put32(&q, 0);			/* opt_endofopt */
+		put32(&q, 32);
+	}
+	p->used = q-p->buf;
+	return 0;
+}
+
+/* Add one packet, of len bytes, to the capture. Anything past the
+ * snap length is cut off, as a capture would.
+ */
+int pcap_write(pcap_out *p, const void *data, int len) {
+	struct timespec ts;
+	int l2len = p->l2 ? PCAP_ETHER : 0;
+	int origlen = l2len+len;
+	int caplen = (origlen > PCAP_SNAPLEN) ? PCAP_SNAPLEN : origlen;
+	int pad = (4-(caplen&3))&3;
+	char *q;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if(!p->ng) {
+		if((q = pcap_space(p, 16+caplen)) == NULL) return -1;
+		put32(&q, ts.tv_sec);
+		put32(&q, ts.tv_nsec);
+		put32(&q, caplen);
+		put32(&q, origlen);
+	} else {
+		u_int64_t t = (u_int64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+
+		if((q = pcap_space(p, 32+caplen+pad)) == NULL) return -1;
+		put32(&q, PCAPNG_EPB);
+		put32(&q, 32+caplen+pad);
+		put32(&q, 0);			/* interface */
+		put32(&q, t>>32);
+		put32(&q, t&0xFFFFFFFF);
+		put32(&q, caplen);
+		put32(&q, origlen);
+	}
+	if(l2len) {
+		memcpy(q, p->l2, l2len);
+		q += l2len;
+	}
+	memcpy(q, data, caplen-l2len);
+	q += caplen-l2len;
+	if(p->ng) {
+		memset(q, 0, pad);
+		q += pad;
+		put32(&q, 32+caplen+pad);
+	}
+	p->used = q-p->buf;
+	return 0;
+}
+
+int pcap_close(pcap_out *p) {
+	int ret=0;
+
+	if(p->fd < 0) return 0;
+	ret = pcap_drain(p);
+	if(p->fd != 1) close(p->fd);
+	free(p->buf);
+	pcap_init(p);
+	return ret;
+}
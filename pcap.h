@@ -0,0 +1,25 @@
+/* pcap.h - pcap and pcapng output for sendip
+ */
+#ifndef _SENDIP_PCAP_H
+#define _SENDIP_PCAP_H
+
+#define LINKTYPE_ETHERNET	1
+#define LINKTYPE_RAW		101	/* starts with the IP header */
+
+#define PCAP_SNAPLEN	262144
+#define PCAP_BUFSIZE	(1<<20)	/* bytes written out at a time */
+
+typedef struct {
+	int fd;			/* -1 when not writing a capture */
+	bool ng;		/* pcapng rather than pcap */
+	const u_int8_t *l2;	/* Ethernet header put in front, or NULL */
+	char *buf;
+	size_t used;
+} pcap_out;
+
+void pcap_init(pcap_out *p);
+int pcap_open(pcap_out *p, const char *name, bool ng, const u_int8_t *l2);
+int pcap_write(pcap_out *p, const void *data, int len);
+int pcap_close(pcap_out *p);
+
+#endif  /* _SENDIP_PCAP_H */
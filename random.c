@@ -0,0 +1,317 @@
+/* random.c - the random numbers behind rN, r and random header fields
+ *
+ * Everything random in sendip comes from one xoshiro256** generator
+ * (Blackman and Vigna), so a run started with the same --seed sends
+ * the same packets. randomstream() moves the generator on by a
+ * multiple of 2^128 numbers with xoshiro's jump function, giving each
+ * --threads worker a stream of its own that can't overlap the others.
+ *
+ * randomfill() writes straight into the caller's buffer. Long fills
+ * are done by four generators side by side, seeded from the main one,
+ * with their 64 bit outputs interleaved; AVX2 runs the four in one
+ * register, but the plain C version gives the same bytes, so runs are
+ * reproducible from one machine to the next.
+ *
+ * The state is per process, which suits the forked workers; it isn't
+ * safe to share between threads.
+ */
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <string.h>
+#include "sendip_module.h"
+
+/* Shortest fill done four wide */
+#define RANDOM_BATCH_MIN	256
+
+static u_int64_t rseed;
+static u_int64_t rstate[4];
+static bool rseeded = FALSE;
+
+static u_int64_t rotl(u_int64_t x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+/* Expands a seed into a full state (the seeding xoshiro recommends) */
+static u_int64_t splitmix64(u_int64_t *x) {
+	u_int64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static u_int64_t xoshiro(u_int64_t s[4]) {
+	u_int64_t result = rotl(s[1] * 5, 7) * 9;
+	u_int64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
+}
+
+/* Move on 2^128 numbers */
+static void xoshiro_jump(u_int64_t s[4]) {
+	static const u_int64_t jump[] = {
+		0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+		0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL
+	};
+	u_int64_t t[4] = { 0, 0, 0, 0 };
+	int i, b;
+
+	for (i=0; i<4; i++) {
+		for (b=0; b<64; b++) {
+			if (jump[i] & ((u_int64_t)1 << b)) {
+				t[0] ^= s[0];
+				t[1] ^= s[1];
+				t[2] ^= s[2];
+				t[3] ^= s[3];
+			}
+			(void)xoshiro(s);
+		}
+	}
+	memcpy(s, t, sizeof(t));
+}
+
+/* Start again from seed, on stream 0 */
+void randomseed(u_int64_t seed) {
+	u_int64_t x = seed;
+	int i;
+
+	rseed = seed;
+	for (i=0; i<4; i++)
+		rstate[i] = splitmix64(&x);
+	rseeded = TRUE;
+}
+
+/* Go to the start of stream n of the current seed */
+void randomstream(unsigned int n) {
+	randomseed(rseed);
+	while (n--)
+		xoshiro_jump(rstate);
+}
+
+u_int64_t randomseeded(void) {
+	return rseed;
+}
+
+/* A number that depends only on the seed, name and n, the same in every
+ * stream, so that each worker can work it out for itself
+ */
+u_int64_t randomkey(const char *name, unsigned int n) {
+	u_int64_t x = rseed ^ ((u_int64_t)n << 32);
+
+	for (; *name; name++)
+		x = (x ^ (u_int8_t)*name) * 0x100000001b3ULL;	/* FNV-1a */
+	return splitmix64(&x);
+}
+
+u_int64_t random64(void) {
+	if (!rseeded) randomseed(0);
+	return xoshiro(rstate);
+}
+
+u_int32_t random32(void) {
+	return (u_int32_t)(random64() >> 32);
+}
+
+/* Four xoshiro256** lanes, kept as s[word][lane] so that each word of
+ * state is one vector. Each step writes lane 0's output, then lane 1's
+ * and so on.
+ */
+typedef struct {
+	u_int64_t s[4][4];
+} random_lanes;
+
+static void random_lanes_words(random_lanes *r, u_int8_t *p, size_t words) {
+	u_int64_t out;
+	int l;
+
+	for (; words >= 4; words -= 4) {
+		for (l=0; l<4; l++) {
+			u_int64_t *s0 = &r->s[0][l], *s1 = &r->s[1][l];
+			u_int64_t *s2 = &r->s[2][l], *s3 = &r->s[3][l];
+			u_int64_t t = *s1 << 17;
+
+			out = rotl(*s1 * 5, 7) * 9;
+			*s2 ^= *s0;
+			*s3 ^= *s1;
+			*s1 ^= *s2;
+			*s0 ^= *s3;
+			*s2 ^= t;
+			*s3 = rotl(*s3, 45);
+			memcpy(p, &out, sizeof(out));
+			p += 8;
+		}
+	}
+}
+
+typedef void (*random_lanes_fn)(random_lanes *r, u_int8_t *p, size_t words);
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define RANDOM_X86
+#include <immintrin.h>
+
+#define RANDOM_ROTL(x, k) \
+	_mm256_or_si256(_mm256_slli_epi64((x), (k)), _mm256_srli_epi64((x), 64-(k)))
+
+__attribute__((target("avx2")))
+static void random_lanes_avx2(random_lanes *r, u_int8_t *p, size_t words) {
+	__m256i s0 = _mm256_loadu_si256((const __m256i *)r->s[0]);
+	__m256i s1 = _mm256_loadu_si256((const __m256i *)r->s[1]);
+	__m256i s2 = _mm256_loadu_si256((const __m256i *)r->s[2]);
+	__m256i s3 = _mm256_loadu_si256((const __m256i *)r->s[3]);
+	__m256i x, t;
+
+	for (; words >= 4; words -= 4) {
+		/* rotl(s1*5, 7)*9, the multiplies as shifts and adds */
+		x = _mm256_add_epi64(_mm256_slli_epi64(s1, 2), s1);
+		x = RANDOM_ROTL(x, 7);
+		x = _mm256_add_epi64(_mm256_slli_epi64(x, 3), x);
+		_mm256_storeu_si256((__m256i *)p, x);
+		p += 32;
+
+		t = _mm256_slli_epi64(s1, 17);
+		s2 = _mm256_xor_si256(s2, s0);
+		s3 = _mm256_xor_si256(s3, s1);
+		s1 = _mm256_xor_si256(s1, s2);
+		s0 = _mm256_xor_si256(s0, s3);
+		s2 = _mm256_xor_si256(s2, t);
+		s3 = RANDOM_ROTL(s3, 45);
+	}
+	_mm256_storeu_si256((__m256i *)r->s[0], s0);
+	_mm256_storeu_si256((__m256i *)r->s[1], s1);
+	_mm256_storeu_si256((__m256i *)r->s[2], s2);
+	_mm256_storeu_si256((__m256i *)r->s[3], s3);
+}
+#endif /* RANDOM_X86 */
+
+static void random_lanes_pick(random_lanes *r, u_int8_t *p, size_t words);
+static random_lanes_fn random_lanes_run = random_lanes_pick;
+
+static void random_lanes_pick(random_lanes *r, u_int8_t *p, size_t words) {
+	random_lanes_run = random_lanes_words;
+#ifdef RANDOM_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		random_lanes_run = random_lanes_avx2;
+#endif
+	random_lanes_run(r, p, words);
+}
+
+/* The four lanes of a long fill, seeded from one main stream number */
+static void random_lanes_seed(random_lanes *r) {
+	u_int64_t x = random64();
+	int w, l;
+
+	for (l=0; l<4; l++)
+		for (w=0; w<4; w++)
+			r->s[w][l] = splitmix64(&x);
+}
+
+static void random_fill_with(void *buf, size_t len, random_lanes_fn run) {
+	u_int8_t *p = buf;
+	u_int64_t w;
+
+	if (len >= RANDOM_BATCH_MIN) {
+		random_lanes r;
+		size_t n = len/32*4;
+		u_int8_t last[32];
+
+		random_lanes_seed(&r);
+		run(&r, p, n);
+		p += n*8;
+		len -= n*8;
+		if (len) {
+			run(&r, last, 4);
+			memcpy(p, last, len);
+		}
+		return;
+	}
+	for (; len >= 8; len -= 8) {
+		w = random64();
+		memcpy(p, &w, 8);
+		p += 8;
+	}
+	if (len) {
+		w = random64();
+		memcpy(p, &w, len);
+	}
+}
+
+/* Fill buf with len random bytes */
+void randomfill(void *buf, size_t len) {
+	random_fill_with(buf, len, random_lanes_run);
+}
+
+#ifdef RANDOM_TEST
+/* cc -DRANDOM_TEST -o randomtest random.c && ./randomtest
+ * Checks the xoshiro256** reference output, that the AVX2 and plain
+ * lanes agree, that seeds and streams repeat and streams differ.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures;
+
+static void fail(const char *what) {
+	fprintf(stderr, "%s\n", what);
+	failures++;
+}
+
+int main(void) {
+	static u_int8_t a[70000], b[70000];
+	/* xoshiro256** from state {1, 2, 3, 4} (the reference C) */
+	static const u_int64_t want[] = {
+		11520ULL, 0ULL, 1509978240ULL, 1215971899390074240ULL
+	};
+	u_int64_t s[4] = { 1, 2, 3, 4 };
+	size_t len;
+	int i;
+
+	for (i=0; i<4; i++)
+		if (xoshiro(s) != want[i])
+			fail("xoshiro256** doesn't match the reference");
+
+	/* Every length, short and long, both ways and against itself */
+	for (len=0; len<sizeof(a); len += (len < 1100 ? 1 : 1+random()%4000)) {
+		randomseed(len);
+		random_fill_with(a, len, random_lanes_words);
+		randomseed(len);
+		randomfill(b, len);
+		if (memcmp(a, b, len))
+			fail("randomfill() isn't the same on every CPU");
+	}
+
+	randomseed(42);
+	randomfill(a, 1000);
+	randomseed(42);
+	randomfill(b, 1000);
+	if (memcmp(a, b, 1000))
+		fail("randomseed() doesn't repeat");
+	randomstream(3);
+	randomfill(b, 1000);
+	if (!memcmp(a, b, 1000))
+		fail("stream 3 is the same as stream 0");
+	randomstream(3);
+	randomfill(a, 1000);
+	if (memcmp(a, b, 1000))
+		fail("randomstream() doesn't repeat");
+	randomstream(0);
+	randomfill(b, 1000);
+	randomseed(42);
+	randomfill(a, 1000);
+	if (memcmp(a, b, 1000))
+		fail("stream 0 isn't the seed's own");
+
+	if (failures)
+		fprintf(stderr, "%d failures\n", failures);
+	else
+		fprintf(stderr, "All random tests pass\n");
+	return failures != 0;
+}
+#endif /* RANDOM_TEST */
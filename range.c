@@ -0,0 +1,379 @@
+/* range.c - range arguments, first-last, for numbers and addresses
+ *
+ * An argument such as 1000-2000, 10.0.0.1-10.0.255.254 or
+ * 2001:db8::1-2001:db8::ffff gives the next value of the range each
+ * time it is evaluated, going back to the start after the last one.
+ * A suffix /+N steps N at a time; /% (or /%N) visits the values in a
+ * pseudorandom order instead, still each one exactly once per cycle,
+ * which is what you want for sweeping an address block without
+ * repeats or misses. IPv6 ranges may only vary in the last 64 bits.
+ *
+ * Each value has a rank, 0 up to the number of values less one, and a
+ * range just counts through the ranks. For /% the rank is put through
+ * a permutation first: a keyed bijection on the next power of two up
+ * (a multiply-add, xorshift, multiply and xorshift, all mod 2^k),
+ * applied again whenever it lands past the end of the range, so ranks
+ * map one to one onto values. Since the power of two is less than
+ * twice the range, that's under two goes on average, and it needs no
+ * state beyond the key. The key comes from the --seed and the
+ * argument, so a run repeats with the same seed, and every --threads
+ * worker gets the same order: worker k of n takes ranks k, k+n, k+2n,
+ * ... just as fileargument() shares out the lines of a file.
+ *
+ * Identical range arguments share one walk, as fF arguments share one
+ * file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "sendip_module.h"
+
+typedef struct _range {
+	struct _range *next;
+	char *arg;		/* as given */
+	int family;		/* AF_UNSPEC for plain numbers */
+	bool bad;		/* didn't parse; complained once already */
+	u_int64_t first;
+	u_int64_t step;
+	u_int64_t last;		/* highest rank, i.e. number of values - 1 */
+	u_int64_t rank;		/* rank of the next value */
+	bool permute;
+	u_int64_t mask;		/* the power of two permuted over, less 1 */
+	int shift;
+	u_int64_t a, b, c;	/* permutation key */
+	u_int8_t prefix[8];	/* IPv6: the top 64 bits */
+} Range;
+
+static Range *ranges;
+
+/* With --threads, worker k of n takes ranks k, k+n, k+2n, ... */
+static u_int64_t range_offset=0, range_stride=1;
+
+/* Tell whether input looks like a range: two numbers or addresses
+ * joined by -, with an optional /+N or /%N.
+ */
+bool
+isrange(const char *input)
+{
+	const char *p, *dash=NULL;
+
+	if (!input) return FALSE;
+	for (p=input; *p && *p != '/'; ++p) {
+		if (*p == '-') {
+			if (dash || p == input) return FALSE;
+			dash = p;
+		} else if (!isxdigit(*p) && *p != '.' && *p != ':'
+		           && *p != 'x' && *p != 'X') {
+			return FALSE;
+		}
+	}
+	if (!dash || dash+1 == p) return FALSE;
+	if (*p == '/') {
+		if (p[1] != '+' && p[1] != '%') return FALSE;
+		for (p+=2; *p; ++p)
+			if (!isxdigit(*p) && *p != 'x' && *p != 'X')
+				return FALSE;
+	}
+	return TRUE;
+}
+
+/* One end of a range, as a 64 bit number in host order */
+static bool
+range_end(Range *r, const char *s, u_int64_t *value)
+{
+	struct in_addr a4;
+	struct in6_addr a6;
+	char *end;
+	int i;
+
+	switch (r->family) {
+	case AF_INET:
+		if (inet_pton(AF_INET, s, &a4) <= 0) return FALSE;
+		*value = ntohl(a4.s_addr);
+		return TRUE;
+	case AF_INET6:
+		if (inet_pton(AF_INET6, s, &a6) <= 0) return FALSE;
+		if (s == r->arg) {
+			memcpy(r->prefix, a6.s6_addr, 8);
+		} else if (memcmp(r->prefix, a6.s6_addr, 8)) {
+			fprintf(stderr, "Range %s: only the last 64 bits can vary\n",
+			        r->arg);
+			return FALSE;
+		}
+		for (*value=0, i=8; i<16; ++i)
+			*value = (*value << 8) | a6.s6_addr[i];
+		return TRUE;
+	default:
+		*value = strtoull(s, &end, 0);
+		return *s && !*end;
+	}
+}
+
+static bool
+range_parse(Range *r)
+{
+	char *dash, *slash;
+	u_int64_t hi;
+	int bits;
+
+	dash = strchr(r->arg, '-');
+	*dash++ = '\0';
+	if ((slash = strchr(dash, '/')))
+		*slash++ = '\0';
+	if (!range_end(r, r->arg, &r->first) || !range_end(r, dash, &hi))
+		return FALSE;
+	if (hi < r->first) {
+		fprintf(stderr, "Range %s-%s: runs backwards\n", r->arg, dash);
+		return FALSE;
+	}
+	r->step = 1;
+	if (slash) {
+		r->permute = (*slash == '%');
+		if (slash[1] && !(r->step = strtoull(slash+1, NULL, 0))) {
+			fprintf(stderr, "Range %s-%s: step of 0\n", r->arg, dash);
+			return FALSE;
+		}
+	}
+	r->last = (hi - r->first)/r->step;
+
+	for (r->mask=r->last, bits=1; bits<64; bits<<=1)
+		r->mask |= r->mask >> bits;
+	for (bits=0; bits<64 && r->mask>>bits; ++bits)
+		;
+	r->shift = bits/2 + 1;
+	r->a = randomkey(r->arg, 0) | 1;
+	r->b = randomkey(r->arg, 1) | 1;
+	r->c = randomkey(r->arg, 2) | 1;
+	return TRUE;
+}
+
+/* n ranks on from where r is, wrapping round */
+static u_int64_t
+range_add(Range *r, u_int64_t n)
+{
+	u_int64_t count = r->last + 1;	/* 0 for all 2^64 */
+
+	if (count) n %= count;
+	if (r->last - r->rank < n)
+		return r->rank + n - count;
+	return r->rank + n;
+}
+
+/* Find the range for an argument, setting it up the first time */
+static Range *
+range_find(const char *input, int family)
+{
+	Range *r;
+
+	for (r=ranges; r; r=r->next)
+		if (r->family == family && !strcmp(r->arg, input))
+			break;
+	if (r) return r;
+
+	if (!(r = calloc(1, sizeof(Range))) || !(r->arg = strdup(input))) {
+		perror("OUT OF MEMORY!\n");
+		free(r);
+		return NULL;
+	}
+	r->family = family;
+	if (!range_parse(r)) {
+		fprintf(stderr, "Couldn't make sense of range %s\n", input);
+		r->bad = TRUE;
+	}
+	/* It's chopped up now; the key is the whole thing */
+	strcpy(r->arg, input);
+	r->rank = range_add(r, range_offset);
+	r->next = ranges;
+	ranges = r;
+	return r;
+}
+
+/* Where rank x is in the pseudorandom order */
+static u_int64_t
+range_permute(Range *r, u_int64_t x)
+{
+	do {
+		x = (x*r->a + r->c) & r->mask;
+		x ^= x >> r->shift;
+		x = (x*r->b) & r->mask;
+		x ^= x >> r->shift;
+	} while (x > r->last);
+	return x;
+}
+
+void
+range_shard(unsigned int offset, unsigned int stride)
+{
+	Range *r;
+
+	range_offset = offset;
+	range_stride = stride ? stride : 1;
+	for (r=ranges; r; r=r->next)
+		r->rank = range_add(r, range_offset);
+}
+
+/* Takes a range argument and stores its next value in *value: a
+ * u_int64_t in host order for AF_UNSPEC, an in_addr_t in network order
+ * for AF_INET, or a struct in6_addr for AF_INET6. Returns FALSE if the
+ * range makes no sense.
+ */
+bool
+rangeargument(const char *input, int family, void *value)
+{
+	Range *r;
+	u_int64_t v;
+	int i;
+
+	if (!(r = range_find(input, family)) || r->bad)
+		return FALSE;
+	v = r->first + r->step*(r->permute ? range_permute(r, r->rank) : r->rank);
+	r->rank = range_add(r, range_stride);
+
+	switch (family) {
+	case AF_INET:
+		*(in_addr_t *)value = htonl((u_int32_t)v);
+		break;
+	case AF_INET6:
+		memcpy(((struct in6_addr *)value)->s6_addr, r->prefix, 8);
+		for (i=15; i>=8; --i, v>>=8)
+			((struct in6_addr *)value)->s6_addr[i] = (u_int8_t)v;
+		break;
+	default:
+		*(u_int64_t *)value = v;
+		break;
+	}
+	return TRUE;
+}
+
+#ifdef RANGE_TEST
+/* cc -DRANGE_TEST -o rangetest range.c random.c && ./rangetest
+ * Checks that ranges, stepped and permuted, of assorted sizes give
+ * every value exactly once per cycle, including when shared out among
+ * workers, and that the order repeats for a seed and changes with it.
+ */
+static int failures;
+
+static void fail(const char *what, const char *arg) {
+	fprintf(stderr, "%s: %s\n", arg, what);
+	failures++;
+}
+
+/* Walk arg for one cycle as worker k of n, ticking off what it gives */
+static void walk(const char *arg, u_int64_t first, u_int64_t count,
+                 u_int64_t step, u_int8_t *seen, int k, int n) {
+	u_int64_t v, i;
+
+	ranges = NULL;
+	range_offset = 0;
+	range_stride = 1;
+	range_shard(k, n);
+	for (i=k; i<count; i+=n) {
+		if (!rangeargument(arg, AF_UNSPEC, &v)) {
+			fail("didn't parse", arg);
+			return;
+		}
+		if (v < first || (v-first)%step || (v-first)/step >= count)
+			fail("value out of range", arg);
+		else
+			seen[(v-first)/step]++;
+	}
+}
+
+static void check(u_int64_t first, u_int64_t count, u_int64_t step,
+                  const char *how, int n) {
+	char arg[100];
+	u_int8_t *seen = calloc(count, 1);
+	u_int64_t i;
+	int k;
+
+	sprintf(arg, "%llu-%llu%s", (unsigned long long)first,
+	        (unsigned long long)(first + (count-1)*step), how);
+	for (k=0; k<n; k++)
+		walk(arg, first, count, step, seen, k, n);
+	for (i=0; i<count; i++)
+		if (seen[i] != 1) {
+			fail(n > 1 ? "workers missed or repeated a value"
+			     : "missed or repeated a value", arg);
+			break;
+		}
+	free(seen);
+}
+
+int main(void) {
+	static const u_int64_t counts[] = {
+		1, 2, 3, 5, 255, 256, 257, 1000, 65535, 65536, 70001, 1<<20
+	};
+	u_int64_t v, order[8];
+	struct in6_addr a6;
+	in_addr_t a4;
+	unsigned int c;
+	int i;
+
+	randomseed(1);
+	for (c=0; c<sizeof(counts)/sizeof(counts[0]); c++) {
+		check(1000, counts[c], 1, "", 1);
+		check(7, counts[c], 3, "/+3", 1);
+		check(0, counts[c], 1, "/%", 1);
+		check(5, counts[c], 2, "/%2", 1);
+		check(1, counts[c], 1, "/%", 3);
+		check(1, counts[c], 1, "/+", 7);
+	}
+
+	/* The whole 64 bits can't be walked, but mustn't go wrong */
+	ranges = NULL;
+	range_shard(0, 1);
+	if (!rangeargument("0-0xffffffffffffffff/%", AF_UNSPEC, &v))
+		fail("didn't parse", "0-0xffffffffffffffff/%");
+
+	ranges = NULL;
+	if (!rangeargument("10.0.0.254-10.0.1.1", AF_INET, &a4)
+	    || a4 != inet_addr("10.0.0.254")
+	    || !rangeargument("10.0.0.254-10.0.1.1", AF_INET, &a4)
+	    || !rangeargument("10.0.0.254-10.0.1.1", AF_INET, &a4)
+	    || a4 != inet_addr("10.0.1.0"))
+		fail("wrong IPv4 address", "10.0.0.254-10.0.1.1");
+	if (!rangeargument("2001:db8::fffe-2001:db8::1:0", AF_INET6, &a6)
+	    || !rangeargument("2001:db8::fffe-2001:db8::1:0", AF_INET6, &a6)
+	    || !rangeargument("2001:db8::fffe-2001:db8::1:0", AF_INET6, &a6)
+	    || memcmp(&a6, "\x20\x01\x0d\xb8\0\0\0\0\0\0\0\0\0\x01\0\0", 16))
+		fail("wrong IPv6 address", "2001:db8::fffe-2001:db8::1:0");
+	if (rangeargument("2001:db8::1-2001:db9::1", AF_INET6, &a6))
+		fail("took a range wider than 64 bits", "2001:db8::1-2001:db9::1");
+	if (rangeargument("2000-1000", AF_UNSPEC, &v))
+		fail("took a range that runs backwards", "2000-1000");
+	if (isrange("10.0.0.0/24") || isrange("-1") || isrange("host-a.b")
+	    || !isrange("::1-::9/%") || !isrange("1-9/+0x2"))
+		fail("isrange() is wrong", "isrange");
+
+	ranges = NULL;
+	randomseed(2);
+	for (i=0; i<8; i++)
+		(void)rangeargument("1-1000000/%", AF_UNSPEC, &order[i]);
+	ranges = NULL;
+	randomseed(2);
+	for (i=0; i<8; i++) {
+		(void)rangeargument("1-1000000/%", AF_UNSPEC, &v);
+		if (v != order[i])
+			fail("order doesn't repeat with the seed", "1-1000000/%");
+	}
+	ranges = NULL;
+	randomseed(3);
+	for (i=0; i<8; i++) {
+		(void)rangeargument("1-1000000/%", AF_UNSPEC, &v);
+		if (v != order[i]) break;
+	}
+	if (i == 8)
+		fail("order doesn't change with the seed", "1-1000000/%");
+
+	if (failures)
+		fprintf(stderr, "%d failures\n", failures);
+	else
+		fprintf(stderr, "All range tests pass\n");
+	return failures != 0;
+}
+#endif /* RANGE_TEST */
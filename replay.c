@@ -0,0 +1,451 @@
+/* replay.c - replaying pcap and pcapng captures with sendip
+ * The capture is mmapped and read a record at a time. The link level
+ * header (Ethernet, with any VLAN tags, Linux cooked, BSD loopback, or
+ * none) is dropped, along with anything that isn't IPv4 or IPv6 or
+ * wasn't captured in full, and the IP packet handed back.
+ *
+ * sendip then points each module's header at the matching header in
+ * (a copy of) the packet, so the usual module options rewrite it in
+ * place, and replay_fixup() puts the checksums right afterwards. The
+ * checksums are done the same way as ipcsum(), udpcsum(), tcpcsum() and
+ * icmpcsum() do them, but straight from the packet rather than from
+ * the modules' headers.
+ */
+
+#define _SENDIP_MAIN
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include "sendip_module.h"
+#include "replay.h"
+#include "ipv4.h"
+#include "ipv6.h"
+#include "udp.h"
+#include "tcp.h"
+#include "icmp.h"
+
+#define PCAP_MAGIC	0xa1b2c3d4	/* microsecond timestamps */
+#define PCAP_MAGIC_NS	0xa1b23c4d	/* nanosecond timestamps */
+
+#define PCAPNG_SHB	0x0A0D0D0A
+#define PCAPNG_IDB	0x00000001
+#define PCAPNG_SPB	0x00000003
+#define PCAPNG_EPB	0x00000006
+#define PCAPNG_BOM	0x1A2B3C4D
+
+/* Link types we know how to strip */
+#define LINKTYPE_NULL		0
+#define LINKTYPE_ETHERNET	1
+#define LINKTYPE_RAW		101
+#define LINKTYPE_LINUX_SLL	113
+#define LINKTYPE_IPV4		228
+#define LINKTYPE_IPV6		229
+
+static u_int32_t rd32(replay_in *r, const u_int8_t *p) {
+	u_int32_t v;
+
+	memcpy(&v, p, 4);
+	if(r->swap)
+		v = (v>>24) | ((v>>8)&0xFF00) | ((v<<8)&0xFF0000) | (v<<24);
+	return v;
+}
+
+static u_int16_t rd16(replay_in *r, const u_int8_t *p) {
+	u_int16_t v;
+
+	memcpy(&v, p, 2);
+	if(r->swap) v = (v>>8) | (v<<8);
+	return v;
+}
+
+/* Timestamp resolution from an if_tsresol value */
+static void replay_tsresol(replay_iface *ifc, u_int8_t res) {
+	int e = res&0x7F;
+
+	ifc->mul = ifc->div = 1;
+	ifc->shift = 0;
+	if(res & 0x80) {
+		ifc->mul = 1000000000ULL;
+		ifc->shift = e;
+		return;
+	}
+	for(; e<9; e++) ifc->mul *= 10;
+	for(; e>9; e--) ifc->div *= 10;
+}
+
+static u_int64_t replay_ns(replay_iface *ifc, u_int64_t ts) {
+	if(ifc->shift)
+		return (u_int64_t)(((long double)ts*ifc->mul) / ((u_int64_t)1<<ifc->shift));
+	return ts*ifc->mul/ifc->div;
+}
+
+int replay_open(replay_in *r, const char *name) {
+	struct stat st;
+	u_int32_t magic;
+
+	memset(r, 0, sizeof(replay_in));
+	r->nshards = 1;
+	if((r->fd = open(name, O_RDONLY)) < 0 || fstat(r->fd, &st) < 0) {
+		perror(name);
+		if(r->fd >= 0) close(r->fd);
+		return -1;
+	}
+	r->len = st.st_size;
+	if(r->len < 24) {
+		fprintf(stderr,"%s: too short to be a capture\n",name);
+		close(r->fd);
+		return -1;
+	}
+	r->map = mmap(NULL, r->len, PROT_READ, MAP_PRIVATE, r->fd, 0);
+	if(r->map == MAP_FAILED) {
+		perror("Couldn't mmap capture");
+		close(r->fd);
+		return -1;
+	}
+	(void)madvise((void *)r->map, r->len, MADV_SEQUENTIAL);
+
+	memcpy(&magic, r->map, 4);
+	if(magic == PCAPNG_SHB) {
+		/* Sections, and their byte order, are dealt with as they come */
+		r->ng = TRUE;
+		r->first = 0;
+	} else {
+		replay_iface *ifc = &r->ifs[0];
+
+		r->swap = (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS);
+		magic = rd32(r, r->map);
+		if(magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS) {
+			fprintf(stderr,"%s: not a pcap or pcapng file\n",name);
+			replay_close(r);
+			return -1;
+		}
+		ifc->linktype = rd32(r, r->map+20) & 0xFFFF;
+		replay_tsresol(ifc, magic == PCAP_MAGIC_NS ? 9 : 6);
+		r->nifs = 1;
+		r->first = 24;
+	}
+	r->off = r->first;
+	return 0;
+}
+
+/* With --threads, worker shard of nshards replays packets shard,
+ * shard+nshards, ...
+ */
+void replay_shard(replay_in *r, unsigned int shard, unsigned int nshards) {
+	r->shard = shard;
+	r->nshards = nshards ? nshards : 1;
+}
+
+void replay_rewind(replay_in *r) {
+	r->off = r->first;
+	r->index = 0;
+}
+
+void replay_close(replay_in *r) {
+	if(r->map && r->map != MAP_FAILED) munmap((void *)r->map, r->len);
+	if(r->fd >= 0) close(r->fd);
+	r->map = NULL;
+	r->fd = -1;
+}
+
+/* Strip the link level header, and return the IP packet, if any */
+static const u_int8_t *replay_ip(int linktype, const u_int8_t *p, int *len) {
+	int off, type;
+
+	switch(linktype) {
+	case LINKTYPE_ETHERNET:
+		if(*len < 14) return NULL;
+		type = (p[12]<<8)|p[13];
+		off = 14;
+		/* 802.1Q and 802.1ad tags */
+		while((type == 0x8100 || type == 0x88A8) && *len >= off+4) {
+			type = (p[off+2]<<8)|p[off+3];
+			off += 4;
+		}
+		if(type != 0x0800 && type != 0x86DD) return NULL;
+		break;
+	case LINKTYPE_LINUX_SLL:
+		if(*len < 16) return NULL;
+		type = (p[14]<<8)|p[15];
+		if(type != 0x0800 && type != 0x86DD) return NULL;
+		off = 16;
+		break;
+	case LINKTYPE_NULL:
+		off = 4;
+		break;
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+		off = 0;
+		break;
+	default:
+		return NULL;
+	}
+	if(*len <= off) return NULL;
+	*len -= off;
+	p += off;
+	if((p[0]>>4) != 4 && (p[0]>>4) != 6) return NULL;
+	return p;
+}
+
+/* Find the next IP packet in the capture. Returns 1 with the packet,
+ * its length and its timestamp (ns), or 0 at the end of the capture.
+ */
+int replay_next(replay_in *r, const u_int8_t **pkt, int *len, u_int64_t *ts) {
+	const u_int8_t *rec, *data;
+	u_int32_t type, blen, caplen, origlen;
+	int ifidx;
+	u_int64_t t;
+
+	while(r->off < r->len) {
+		rec = r->map+r->off;
+		if(!r->ng) {
+			if(r->off+16 > r->len) break;
+			caplen = rd32(r, rec+8);
+			origlen = rd32(r, rec+12);
+			if(r->off+16+caplen > r->len) break;
+			r->off += 16+caplen;
+			data = rec+16;
+			ifidx = 0;
+			t = (u_int64_t)rd32(r, rec)*1000000000ULL +
+			    replay_ns(&r->ifs[0], rd32(r, rec+4));
+		} else {
+			if(r->off+12 > r->len) break;
+			memcpy(&type, rec, 4);
+			if(type == PCAPNG_SHB) {
+				u_int32_t bom;
+
+				memcpy(&bom, rec+8, 4);
+				r->swap = (bom != PCAPNG_BOM);
+				r->nifs = 0;
+			}
+			type = rd32(r, rec);
+			blen = rd32(r, rec+4);
+			if(blen < 12 || r->off+blen > r->len) break;
+			r->off += blen;
+			if(type == PCAPNG_IDB && blen >= 20) {
+				replay_iface *ifc = &r->ifs[r->nifs < REPLAY_IFACES ?
+				                            r->nifs : REPLAY_IFACES-1];
+				const u_int8_t *opt = rec+16;
+
+				ifc->linktype = rd16(r, rec+8);
+				replay_tsresol(ifc, 6);
+				/* Look for if_tsresol among the options */
+				while(opt+4 <= rec+blen-4) {
+					u_int16_t code = rd16(r, opt);
+					u_int16_t olen = rd16(r, opt+2);
+
+					if(code == 0) break;
+					if(code == 9 && olen == 1)
+						replay_tsresol(ifc, opt[4]);
+					opt += 4+((olen+3)&~3);
+				}
+				r->nifs++;
+				continue;
+			} else if(type == PCAPNG_EPB && blen >= 32) {
+				ifidx = rd32(r, rec+8);
+				caplen = rd32(r, rec+20);
+				origlen = rd32(r, rec+24);
+				if(28+caplen > blen) continue;
+				data = rec+28;
+				if(ifidx >= r->nifs || ifidx >= REPLAY_IFACES) continue;
+				t = replay_ns(&r->ifs[ifidx],
+				              ((u_int64_t)rd32(r, rec+12)<<32) | rd32(r, rec+16));
+			} else if(type == PCAPNG_SPB && blen >= 16) {
+				/* No timestamp, and only as much as fits in the block */
+				origlen = rd32(r, rec+8);
+				caplen = blen-16 < origlen ? blen-16 : origlen;
+				data = rec+12;
+				ifidx = 0;
+				if(!r->nifs) continue;
+				t = 0;
+			} else {
+				continue;
+			}
+		}
+
+		/* Every worker counts every packet, but only sends its own */
+		if((r->index++ % r->nshards) != r->shard) continue;
+		*len = caplen;
+		if(caplen < origlen ||
+		   (*pkt = replay_ip(r->ifs[ifidx].linktype, data, len)) == NULL ||
+		   *len > REPLAY_MAX) {
+			r->skipped++;
+			continue;
+		}
+		*ts = t;
+		return 1;
+	}
+	return 0;
+}
+
+/* Match the modules (by option character) against the packet's
+ * headers from the outside in. Returns how many of them match, with
+ * each one's offset and length in the packet.
+ */
+int replay_match(const u_int8_t *pkt, int len, const char *hdrs, int n,
+                 int *off, int *hlen) {
+	const u_int8_t *h;
+	int o=0, k, l, left;
+	int proto=-1;		/* -1: any IP header may come next */
+
+	for(k=0; k<n; k++) {
+		h = pkt+o;
+		left = len-o;
+		switch(hdrs[k]) {
+		case 'i':
+			if(proto != -1 && proto != IPPROTO_IPIP) return k;
+			if(left < 20 || (h[0]>>4) != 4) return k;
+			l = (h[0]&0x0F)*4;
+			if(l < 20 || l > left) return k;
+			/* Later fragments have no transport header */
+			proto = ((h[6]&0x1F) || h[7]) ? -2 : h[9];
+			break;
+		case '6':
+			if(proto != -1 && proto != IPPROTO_IPV6) return k;
+			if(left < 40 || (h[0]>>4) != 6) return k;
+			l = 40;
+			proto = h[6];
+			break;
+		case 'u':
+			if(proto != IPPROTO_UDP || left < 8) return k;
+			l = 8;
+			proto = -2;
+			break;
+		case 't':
+			if(proto != IPPROTO_TCP || left < 20) return k;
+			l = (h[12]>>4)*4;
+			if(l < 20 || l > left) return k;
+			proto = -2;
+			break;
+		case 'c':
+			if((proto != IPPROTO_ICMP && proto != IPPROTO_ICMPV6) ||
+			   left < (int)sizeof(icmp_header)) return k;
+			l = sizeof(icmp_header);
+			proto = -2;
+			break;
+		default:
+			return k;
+		}
+		off[k] = o;
+		hlen[k] = l;
+		o += l;
+	}
+	return n;
+}
+
+/* Checksum the transport header and data at l4, len bytes of it, with
+ * a pseudo header. Same sum as udpcsum() and friends.
+ */
+static u_int16_t replay_l4sum(const u_int8_t *pseudo, int plen,
+                              u_int8_t *l4, int len) {
+	u_int16_t *bufs[3];
+	int lens[3];
+
+	bufs[0] = (u_int16_t *)pseudo;
+	lens[0] = plen;
+	bufs[1] = (u_int16_t *)l4;
+	lens[1] = len;
+	lens[2] = 0;
+	if(!plen) {
+		bufs[0] = bufs[1];
+		lens[0] = lens[1];
+		lens[1] = 0;
+	}
+	return csumv(bufs, lens);
+}
+
+/* Redo the checksums of the packet from level on (one IP header, and
+ * whatever it carries), leaving alone any that the matching module was
+ * told to set.
+ */
+static void replay_fix(u_int8_t *pkt, int len, sendip_data *headers[],
+                       int n, int level) {
+	u_int16_t pseudo[20];	/* big enough for IPv6, and aligned */
+	u_int8_t *ph = (u_int8_t *)pseudo;
+	sendip_data *ipmod = level < n ? headers[level] : NULL;
+	sendip_data *l4mod = level+1 < n ? headers[level+1] : NULL;
+	int hl, l4len, plen, proto, at;
+	u_int8_t *l4;
+	u_int16_t sum;
+
+	if(len < 20) return;
+	if((pkt[0]>>4) == 4) {
+		ip_header *ip = (ip_header *)pkt;
+
+		hl = (pkt[0]&0x0F)*4;
+		if(hl < 20 || hl > len) return;
+		l4len = ntohs(ip->tot_len);
+		l4len = (l4len < len ? l4len : len) - hl;
+		proto = pkt[9];
+		/* Inner headers first, since they are covered below */
+		if(!(pkt[6]&0x3F) && !pkt[7] && l4len > 0) {
+			if(proto == IPPROTO_IPIP || proto == IPPROTO_IPV6)
+				replay_fix(pkt+hl, l4len, headers, n, level+1);
+		}
+		if(!ipmod || !(ipmod->modified & IP_MOD_CHECK)) {
+			ip->check = 0;
+			ip->check = csum((u_int16_t *)pkt, hl);
+		}
+		/* Fragments don't have a transport checksum we can do */
+		if((pkt[6]&0x3F) || pkt[7] || l4len <= 0) return;
+		memcpy(ph, pkt+12, 8);
+		ph[8] = 0;
+		ph[9] = proto;
+		ph[10] = l4len>>8;
+		ph[11] = l4len&0xFF;
+		plen = 12;
+	} else if((pkt[0]>>4) == 6 && len >= 40) {
+		hl = 40;
+		l4len = (pkt[4]<<8)|pkt[5];
+		if(l4len > len-hl) l4len = len-hl;
+		proto = pkt[6];
+		if(proto == IPPROTO_IPIP || proto == IPPROTO_IPV6)
+			replay_fix(pkt+hl, l4len, headers, n, level+1);
+		memset(ph, 0, 40);
+		memcpy(ph, pkt+8, 32);
+		ph[34] = l4len>>8;
+		ph[35] = l4len&0xFF;
+		ph[39] = proto;
+		plen = 40;
+	} else {
+		return;
+	}
+
+	l4 = pkt+hl;
+	switch(proto) {
+	case IPPROTO_UDP:
+		if(l4len < 8 || (l4mod && (l4mod->modified & UDP_MOD_CHECK))) return;
+		at = 6;
+		break;
+	case IPPROTO_TCP:
+		if(l4len < 20 || (l4mod && (l4mod->modified & TCP_MOD_CHECK))) return;
+		at = 16;
+		break;
+	case IPPROTO_ICMP:
+		if(l4len < 4 || (l4mod && (l4mod->modified & ICMP_MOD_CHECK))) return;
+		at = 2;
+		plen = 0;	/* no pseudo header for ICMPv4 */
+		break;
+	case IPPROTO_ICMPV6:
+		if(l4len < 4 || (l4mod && (l4mod->modified & ICMP_MOD_CHECK))) return;
+		at = 2;
+		break;
+	default:
+		return;
+	}
+	l4[at] = l4[at+1] = 0;
+	sum = replay_l4sum(ph, plen, l4, l4len);
+	/* A UDP checksum of 0 means there isn't one */
+	if(proto == IPPROTO_UDP && sum == 0) sum = 0xFFFF;
+	memcpy(l4+at, &sum, 2);
+}
+
+void replay_fixup(u_int8_t *pkt, int len, sendip_data *headers[], int n) {
+	replay_fix(pkt, len, headers, n, 0);
+}
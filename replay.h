@@ -0,0 +1,41 @@
+/* replay.h - replaying pcap and pcapng captures with sendip
+ */
+#ifndef _SENDIP_REPLAY_H
+#define _SENDIP_REPLAY_H
+
+#define REPLAY_IFACES	16	/* pcapng interfaces we keep track of */
+#define REPLAY_MAX	65535	/* longest IP packet we will replay */
+
+typedef struct {
+	int linktype;
+	u_int64_t mul, div;	/* timestamp units to ns: *mul/div */
+	int shift;		/* or, for binary resolutions, *1e9>>shift */
+} replay_iface;
+
+/* A capture file, mmapped, and where we are in it */
+typedef struct {
+	int fd;
+	const u_int8_t *map;
+	size_t len;
+	size_t off;		/* next record */
+	size_t first;		/* first record, to rewind to */
+	bool ng;		/* pcapng rather than pcap */
+	bool swap;		/* written with the other byte order */
+	replay_iface ifs[REPLAY_IFACES];
+	int nifs;
+	unsigned int shard, nshards;	/* with --threads, take every nshards'th */
+	unsigned long long index;	/* packets seen so far this pass */
+	unsigned long long skipped;	/* non-IP, cut short or too long */
+} replay_in;
+
+int replay_open(replay_in *r, const char *name);
+void replay_shard(replay_in *r, unsigned int shard, unsigned int nshards);
+int replay_next(replay_in *r, const u_int8_t **pkt, int *len, u_int64_t *ts);
+void replay_rewind(replay_in *r);
+void replay_close(replay_in *r);
+
+int replay_match(const u_int8_t *pkt, int len, const char *hdrs, int n,
+                 int *off, int *hlen);
+void replay_fixup(u_int8_t *pkt, int len, sendip_data *headers[], int n);
+
+#endif  /* _SENDIP_REPLAY_H */
@@ -22,12 +22,13 @@
 const char opt_char='r';
 
 sendip_data *initialize(void) {
-	sendip_data *ret = malloc(sizeof(sendip_data));
-	rip_header *rip = malloc(sizeof(rip_header));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
+	rip_header *rip = arena_alloc(sizeof(rip_header));
 	memset(rip,0,sizeof(rip_header));
 	ret->alloc_len = sizeof(rip_header);
 	ret->data = (void *)rip;
 	ret->modified=0;
+	ret->private=NULL;
 	return ret;
 }
 
@@ -51,7 +52,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 			usage_error("Warning: a real RIP-2 packet only has authentication on the first entry.\n");
 		}
 		pack->modified |= RIP_IS_AUTH;
-		pack->data = realloc(pack->data,pack->alloc_len+strlen(arg));
+		pack->data = arena_realloc(pack->data,pack->alloc_len+strlen(arg));
 		strcpy((char *)pack->data+pack->alloc_len,arg);
 		pack->alloc_len += strlen(arg);
 		break;
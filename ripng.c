@@ -35,12 +35,13 @@ static struct in6_addr inet6_addr(char *hostname) {
 }
 
 sendip_data *initialize(void) {
-	sendip_data *ret = malloc(sizeof(sendip_data));
-	ripng_header *rip = malloc(sizeof(ripng_header));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
+	ripng_header *rip = arena_alloc(sizeof(ripng_header));
 	memset(rip,0,sizeof(ripng_header));
 	ret->alloc_len = sizeof(ripng_header);
 	ret->data = (void *)rip;
 	ret->modified=0;
+	ret->private=NULL;
 	return ret;
 }
 
@@ -67,7 +68,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 		usage_error("Warning: a real RIP-2 packet only has authentication on the first entry.\n");
 	}
 	pack->modified |= RIP_IS_AUTH;
-	pack->data = realloc(pack->data,pack->alloc_len+strlen(arg));
+	pack->data = arena_realloc(pack->data,pack->alloc_len+strlen(arg));
 	strcpy(pack->data+pack->alloc_len,arg);
 	pack->alloc_len += strlen(arg);
 	break;
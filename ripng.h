@@ -39,6 +39,6 @@ sendip_option rip_opts[] = {
 
 /* Helpful macros */
 #define RIPNG_NUM_ENTRIES(d) (((d)->alloc_len-sizeof(ripng_header))/sizeof(ripng_entry))
-#define RIPNG_ADD_ENTRY(d) { (d)->data = realloc((d)->data,(d)->alloc_len+sizeof(ripng_entry)); (d)->alloc_len+=sizeof(ripng_entry); }
+#define RIPNG_ADD_ENTRY(d) { (d)->data = arena_realloc((d)->data,(d)->alloc_len+sizeof(ripng_entry)); (d)->alloc_len+=sizeof(ripng_entry); }
 #define RIPNG_ENTRY(d) ((ripng_entry *)((u_int32_t *)((d)->data)+((d)->alloc_len>>2)-(sizeof(ripng_entry)>>2)))
 #endif  /* _SENDIP_RIPNG_H */
@@ -36,10 +36,13 @@
 #include <fcntl.h>
 #include <ctype.h> /* isprint */
 #include "sendip_module.h"
-
-#ifdef __sun__  /* for EVILNESS workaround */
-#include "ipv4.h"
-#endif /* __sun__ */
+#include "xmit.h"
+#include "workers.h"
+#include "pace.h"
+#include "pcap.h"
+#include "replay.h"
+#include "builtin.h"
+#include "fastpath.h"
 
 /* Use our own getopt to ensure consistent behaviour on all platforms */
 #include "gnugetopt.h"
@@ -56,20 +59,57 @@ typedef struct _s_m {
 	bool (*set_addr)(char *hostname, sendip_data *pack);
 	bool (*finalize)(char *hdrs, sendip_data *headers[], int index,
 	                 sendip_data *data, sendip_data *pack);
+	bool (*finalize_batch)(char *hdrs, sendip_data *headers[], int index,
+	                       sendip_data data[], sendip_data *pack, int n,
+	                       int stride);
 	sendip_data *pack;
 	void *handle;
+	const builtin_module *builtin;	/* or NULL if loaded from a .so */
 	sendip_option *opts;
 	int num_opts;
+	sendip_field *fields;	/* optional, see put_field */
+	int num_fields;
 } sendip_module;
 
-/* sockaddr_storage struct is not defined everywhere, so here is our own
-	nasty version
-*/
-typedef struct {
-	u_int16_t ss_family;
-	u_int32_t ss_align;
-	char ss_padding[122];
-} _sockaddr_storage;
+/* Long options handled by sendip itself, rather than by a module. These
+ * have to be given with a double dash (--batch 64), since the first pass
+ * over the arguments only knows about them and the single letter ones.
+ */
+#define OPT_BATCH	256
+#define OPT_XMIT	257
+#define OPT_IFACE	258
+#define OPT_ETHER	259
+#define OPT_THREADS	260
+#define OPT_PIN	261
+#define OPT_PPS	262
+#define OPT_BPS	263
+#define OPT_BURST	264
+#define OPT_PCAP	265
+#define OPT_PCAPNG	266
+#define OPT_REPLAY	267
+#define OPT_SPEED	268
+#define OPT_SEED	269
+#define OPT_NOFAST	270
+
+static struct option core_opts[] = {
+	{"batch", required_argument, NULL, OPT_BATCH},
+	{"xmit", required_argument, NULL, OPT_XMIT},
+	{"iface", required_argument, NULL, OPT_IFACE},
+	{"ether", required_argument, NULL, OPT_ETHER},
+	{"threads", required_argument, NULL, OPT_THREADS},
+	{"pin", no_argument, NULL, OPT_PIN},
+	{"pps", required_argument, NULL, OPT_PPS},
+	{"bps", required_argument, NULL, OPT_BPS},
+	{"burst", required_argument, NULL, OPT_BURST},
+	{"pcap", required_argument, NULL, OPT_PCAP},
+	{"pcapng", required_argument, NULL, OPT_PCAPNG},
+	{"replay", required_argument, NULL, OPT_REPLAY},
+	{"speed", required_argument, NULL, OPT_SPEED},
+	{"seed", required_argument, NULL, OPT_SEED},
+	{"no-fastpath", no_argument, NULL, OPT_NOFAST},
+	{NULL, 0, NULL, 0}
+};
+#define NUM_CORE_OPTS	((int)(sizeof(core_opts)/sizeof(struct option))-1)
 
 static int num_opts=0;
 static sendip_module *first;
@@ -77,130 +117,6 @@ static sendip_module *last;
 
 static char *progname;
 
-static int sendpacket(sendip_data *data, char *hostname, int af_type,
-                      bool verbose) {
-	_sockaddr_storage *to = malloc(sizeof(_sockaddr_storage));
-	int tolen;
-
-	/* socket stuff */
-	int s;                            /* socket for sending       */
-
-	/* hostname stuff */
-	struct hostent *host = NULL;      /* result of gethostbyname2 */
-
-	/* casts for specific protocols */
-	struct sockaddr_in *to4 = (struct sockaddr_in *)to; /* IPv4 */
-	struct sockaddr_in6 *to6 = (struct sockaddr_in6 *)to; /* IPv6 */
-
-	int sent;                         /* number of bytes sent */
-
-	if(to==NULL) {
-		perror("OUT OF MEMORY!\n");
-		return -3;
-	}
-	memset(to, 0, sizeof(_sockaddr_storage));
-
-	if ((host = gethostbyname2(hostname, af_type)) == NULL) {
-		fprintf(stderr,"Couldn't get destination host %s (af %d): ",
-		        hostname, af_type);
-		perror("gethostbyname2");
-		free(to);
-		return -1;
-	}
-
-	switch (af_type) {
-	case AF_INET:
-		to4->sin_family = host->h_addrtype;
-		memcpy(&to4->sin_addr, host->h_addr, host->h_length);
-		tolen = sizeof(struct sockaddr_in);
-		break;
-	case AF_INET6:
-		to6->sin6_family = host->h_addrtype;
-		memcpy(&to6->sin6_addr, host->h_addr, host->h_length);
-		tolen = sizeof(struct sockaddr_in6);
-		break;
-	default:
-		return -2;
-		break;
-	}
-
-	if(verbose) {
-		int i, j;
-		fprintf(stderr, "Final packet data:\n");
-		for(i=0; i<data->alloc_len; ) {
-			for(j=0; j<4 && i+j<data->alloc_len; j++)
-				fprintf(stderr, "%02X ", ((unsigned char *)(data->data))[i+j]);
-			fprintf(stderr, "  ");
-			for(j=0; j<4 && i+j<data->alloc_len; j++) {
-				int c=(int) ((unsigned char *)(data->data))[i+j];
-				fprintf(stderr, "%c", isprint(c)?((char *)(data->data))[i+j]:'.');
-			}
-			fprintf(stderr, "\n");
-			i+=j;
-		}
-	}
-
-	if ((s = socket(af_type, SOCK_RAW, IPPROTO_RAW)) < 0) {
-		perror("Couldn't open RAW socket");
-		free(to);
-		return -1;
-	}
-	/* Need this for OpenBSD, shouldn't cause problems elsewhere */
-	/* TODO: should make it a command line option */
-	if(af_type == AF_INET) {
-		const int on=1;
-		if (setsockopt(s, IPPROTO_IP,IP_HDRINCL,(const void *)&on,sizeof(on)) <0) {
-			perror ("Couldn't setsockopt IP_HDRINCL");
-			free(to);
-			close(s);
-			return -2;
-		}
-	}
-
-	/* On Solaris, it seems that the only way to send IP options or packets
-		with a faked IP header length is to:
-		setsockopt(IP_OPTIONS) with the IP option data and size
-		decrease the total length of the packet accordingly
-		I'm sure this *shouldn't* work.  But it does.
-	*/
-#ifdef __sun__
-	if((*((char *)(data->data))&0x0F) != 5) {
-		ip_header *iphdr = (ip_header *)data->data;
-
-		int optlen = iphdr->header_len*4-20;
-
-		if(verbose)
-			fprintf(stderr, "Solaris workaround enabled for %d IP option bytes\n", optlen);
-
-		iphdr->tot_len = htons(ntohs(iphdr->tot_len)-optlen);
-
-		if(setsockopt(s,IPPROTO_IP,IP_OPTIONS,
-		              (void *)(((char *)(data->data))+20),optlen)) {
-			perror("Couldn't setsockopt IP_OPTIONS");
-			free(to);
-			close(s);
-			return -2;
-		}
-	}
-#endif /* __sun__ */
-
-	/* Send the packet */
-	sent = sendto(s, (char *)data->data, data->alloc_len, 0, (void *)to, tolen);
-	if (sent == data->alloc_len) {
-		if(verbose) fprintf(stderr, "Sent %d bytes to %s\n",sent,hostname);
-	} else {
-		if (sent < 0)
-			perror("sendto");
-		else {
-			if(verbose) fprintf(stderr, "Only sent %d of %d bytes to %s\n",
-				                    sent, data->alloc_len, hostname);
-		}
-	}
-	free(to);
-	close(s);
-	return sent;
-}
-
 static void unload_modules(bool freeit, int verbosity) {
 	sendip_module *mod, *p;
 	p = NULL;
@@ -209,14 +125,27 @@ static void unload_modules(bool freeit, int verbosity) {
 		if(p) free(p);
 		p = mod;
 		free(mod->name);
-		if(freeit) free(mod->pack->data);
-		free(mod->pack);
-		(void)dlclose(mod->handle);
+		if(freeit) arena_free(mod->pack->data);
+		arena_free(mod->pack);
+		if(mod->handle) (void)dlclose(mod->handle);
 		/* Do not free options - TODO should we? */
 	}
 	if(p) free(p);
 }
 
+/* dlsym(), or the same from the table of built-in modules */
+static void *module_sym(sendip_module *mod, const char *name) {
+	if(mod->builtin)
+		return builtin_sym_addr(mod->builtin, name);
+	return dlsym(mod->handle, name);
+}
+
+static const char *module_error(sendip_module *mod) {
+	if(mod->builtin)
+		return "not in the built-in module";
+	return dlerror();
+}
+
 static bool load_module(char *modname) {
 	sendip_module *newmod = malloc(sizeof(sendip_module));
 	/*@@
@@ -225,6 +154,8 @@ static bool load_module(char *modname) {
 	int (*n_opts)(void);
 	sendip_option * (*get_opts)(void);
 	char (*get_optchar)(void);
+	int (*n_fields)(void);
+	sendip_field * (*get_fields)(void);
 
 	/*@@
 	 * 	We allow multiple loads for the same module in case they
@@ -240,7 +171,10 @@ static bool load_module(char *modname) {
 	@@*/
 	newmod->name=malloc(strlen(modname)+strlen(SENDIP_LIBS)+strlen(".so")+2);
 	strcpy(newmod->name,modname);
-	if(NULL==(newmod->handle=dlopen(newmod->name,RTLD_NOW))) {
+	newmod->handle=NULL;
+	if((newmod->builtin=builtin_find(modname))) {
+		/* Linked in, nothing to open */
+	} else if(NULL==(newmod->handle=dlopen(newmod->name,RTLD_NOW))) {
 		char *error0=strdup(dlerror());
 		sprintf(newmod->name,"./%s.so",modname);
 		if(NULL==(newmod->handle=dlopen(newmod->name,RTLD_NOW))) {
@@ -265,43 +199,44 @@ static bool load_module(char *modname) {
 		free(error0);
 	}
 	strcpy(newmod->name,modname);
-	if(NULL==(newmod->initialize=dlsym(newmod->handle,"initialize"))) {
+	if(NULL==(newmod->initialize=module_sym(newmod,"initialize"))) {
 		fprintf(stderr,"%s doesn't have an initialize function: %s\n",modname,
-		        dlerror());
-		dlclose(newmod->handle);
+		        module_error(newmod));
+		if(newmod->handle) dlclose(newmod->handle);
 		free(newmod);
 		return FALSE;
 	}
-	if(NULL==(newmod->do_opt=dlsym(newmod->handle,"do_opt"))) {
+	if(NULL==(newmod->do_opt=module_sym(newmod,"do_opt"))) {
 		fprintf(stderr,"%s doesn't contain a do_opt function: %s\n",modname,
-		        dlerror());
-		dlclose(newmod->handle);
+		        module_error(newmod));
+		if(newmod->handle) dlclose(newmod->handle);
 		free(newmod);
 		return FALSE;
 	}
-	newmod->do_pad=dlsym(newmod->handle,"do_pad");
-	newmod->set_addr=dlsym(newmod->handle,"set_addr"); // don't care if fails
-	if(NULL==(newmod->finalize=dlsym(newmod->handle,"finalize"))) {
-		fprintf(stderr,"%s\n",dlerror());
-		dlclose(newmod->handle);
+	newmod->do_pad=module_sym(newmod,"do_pad");
+	newmod->set_addr=module_sym(newmod,"set_addr"); // don't care if fails
+	if(NULL==(newmod->finalize=module_sym(newmod,"finalize"))) {
+		fprintf(stderr,"%s\n",module_error(newmod));
+		if(newmod->handle) dlclose(newmod->handle);
 		free(newmod);
 		return FALSE;
 	}
-	if(NULL==(n_opts=dlsym(newmod->handle,"num_opts"))) {
-		fprintf(stderr,"%s\n",dlerror());
-		dlclose(newmod->handle);
+	newmod->finalize_batch=module_sym(newmod,"finalize_batch"); // optional
+	if(NULL==(n_opts=module_sym(newmod,"num_opts"))) {
+		fprintf(stderr,"%s\n",module_error(newmod));
+		if(newmod->handle) dlclose(newmod->handle);
 		free(newmod);
 		return FALSE;
 	}
-	if(NULL==(get_opts=dlsym(newmod->handle,"get_opts"))) {
-		fprintf(stderr,"%s\n",dlerror());
-		dlclose(newmod->handle);
+	if(NULL==(get_opts=module_sym(newmod,"get_opts"))) {
+		fprintf(stderr,"%s\n",module_error(newmod));
+		if(newmod->handle) dlclose(newmod->handle);
 		free(newmod);
 		return FALSE;
 	}
-	if(NULL==(get_optchar=dlsym(newmod->handle,"get_optchar"))) {
-		fprintf(stderr,"%s\n",dlerror());
-		dlclose(newmod->handle);
+	if(NULL==(get_optchar=module_sym(newmod,"get_optchar"))) {
+		fprintf(stderr,"%s\n",module_error(newmod));
+		if(newmod->handle) dlclose(newmod->handle);
 		free(newmod);
 		return FALSE;
 	}
@@ -309,6 +244,16 @@ static bool load_module(char *modname) {
 	newmod->optchar=get_optchar();
 	/* TODO: check uniqueness */
 	newmod->opts = get_opts();
+	/* Field tables are optional */
+	n_fields=module_sym(newmod,"num_fields");
+	get_fields=module_sym(newmod,"get_fields");
+	if(n_fields && get_fields) {
+		newmod->num_fields = n_fields();
+		newmod->fields = get_fields();
+	} else {
+		newmod->num_fields = 0;
+		newmod->fields = NULL;
+	}
 
 	num_opts+=newmod->num_opts;
 
@@ -328,15 +273,32 @@ static bool load_module(char *modname) {
 static void print_usage(void) {
 	sendip_module *mod;
 	int i;
-	fprintf(stderr, "Usage: %s [-v] [-D] [-l loopcount] [-t time] [-d data] [-h] [-f datafile] [-p module] [module options] [hostname]\n",progname);
+	fprintf(stderr, "Usage: %s [-v] [-D] [-l loopcount] [-t time] [-d data] [-h] [-f datafile] [-p module] [--batch n] [--xmit method] [--threads n] [module options] [hostname]\n",progname);
 	fprintf(stderr, " -d data\tadd this data as a string to the end of the packet\n");
 	fprintf(stderr, " -f datafile\tread packet data from file\n");
 	fprintf(stderr, " -h\t\thelp (this message)\n");
 	fprintf(stderr, " -l loopcount\trun loopcount times (0 means indefinitely)\n");
 	fprintf(stderr, " -p module\tload the specified module (see below)\n");
-	fprintf(stderr, " -T time\twait time seconds between each loop run (0 means as fast as possible)\n");
+	fprintf(stderr, " -T time\twait time seconds (fractions allowed) between packets (0 means as fast as possible)\n");
+	fprintf(stderr, " --pps rate\tsend at most rate packets per second (k, M and G suffixes allowed)\n");
+	fprintf(stderr, " --bps rate\tsend at most rate bits of IP packet per second\n");
+	fprintf(stderr, " --pcap file\twrite packets to a pcap file (- for stdout) instead of sending them\n");
+	fprintf(stderr, " --pcapng file\tthe same, in pcapng format\n");
+	fprintf(stderr, " --replay file\tsend the IP packets in a pcap or pcapng file, rewritten by any\n\t\tmodule options (-l is the number of passes over the file)\n");
+	fprintf(stderr, " --speed f\twith --replay, keep the capture's timing, f times faster\n\t\t(default as fast as possible)\n");
+	fprintf(stderr, " --burst n\tlet up to n packets go back to back when pacing (default 10ms worth)\n");
+	fprintf(stderr, " --seed n\tstart the random numbers from n, so that a run can be repeated\n\t\t(-v shows the seed used)\n");
+	fprintf(stderr, " --no-fastpath\tfinalize every packet with the modules, even for stacks\n\t\tsendip knows (ipv4/udp and the like)\n");
 	fprintf(stderr, " -v\t\tbe verbose\n");
 	fprintf(stderr, " -D\t\tdump packet(s) to stdout but don't send\n");
+	fprintf(stderr, " --batch n\tsend packets n at a time with a single system call\n");
+	fprintf(stderr, " --xmit method\thow to send packets: raw (default), packet, xdp or uring\n");
+	fprintf(stderr, "\t\t(packet: PF_PACKET ring, xdp: AF_XDP socket, both need --iface;\n\t\t uring: raw sockets driven through io_uring)\n");
+	fprintf(stderr, " --iface name\tinterface for link level transmit methods\n");
+	fprintf(stderr, " --ether dst[,src]\tEthernet header for link level transmit methods\n");
+	fprintf(stderr, " --threads n\tsplit the -l count between n worker processes\n");
+	fprintf(stderr, " --pin\t\tpin each worker to its own CPU\n");
+	fprintf(stderr, "\t\t(default broadcast, from the interface address)\n");
 
 	fprintf(stderr, "\n\nPacket data, and argument values for many header fields, may\n");
 	fprintf(stderr, "specified as\n");
@@ -405,7 +367,347 @@ static void print_usage(void) {
 
 }
 
-extern u_int32_t randomcalls;
+/* @@ When looping, the packet is normally rebuilt from scratch every
+ * time round: every module is re-initialized, the whole command line
+ * is parsed again, and the headers are re-assembled and re-finalized.
+ * Usually, though, only a few option arguments (rN, r, tN, fF, CIDR
+ * and the like) can actually produce anything different. So, after
+ * the first packet has been built, we keep it as a template and on
+ * later iterations re-apply just those options, in place, followed by
+ * finalize (which fixes up lengths and checksums).
+ *
+ * This only works if nothing changes size, so any dynamic option that
+ * resized its header, file (fF) packet data, or a finalize that trims
+ * the packet all mean we stay with the full rebuild. The same goes for
+ * modules with private data, since their finalize may consume it or
+ * transform the packet data in place (ah, esp).
+ */
+
+/* Packets built from the template and finalized together (see
+ * finalize_packets). Fixed, rather than --batch, so that a --seed run
+ * sends the same packets however they're sent.
+ */
+#define TMPL_BATCH	32
+
+typedef struct {
+	sendip_module *mod;
+	const char *optname;
+	const char *arg;
+	bool random;		/* bare "r" argument */
+	const sendip_field *field;	/* or NULL to go through do_opt */
+} dynamic_opt;
+
+/* The module's field table entry for option name (including the
+ * module's option character), if it has one
+ */
+static const sendip_field *find_field(sendip_module *mod, const char *name) {
+	int i;
+
+	if(name[0] != mod->optchar) return NULL;
+	for(i=0; i<mod->num_fields; i++)
+		if(!strcmp(mod->fields[i].optname, name+1))
+			return &mod->fields[i];
+	return NULL;
+}
+
+/* Do what the module's do_opt would for a field, writing the value
+ * straight into its header. A bare "r" gives the same value as the
+ * random number do_opt used to be handed as a string.
+ */
+static void put_field(sendip_module *mod, const sendip_field *f,
+                      const char *arg, bool random) {
+	u_int8_t *at = (u_int8_t *)mod->pack->data + f->offset;
+	u_int32_t value;
+	u_int16_t value16;
+	struct in6_addr addr;
+
+	if(f->type == SENDIP_FIELD_IPV6) {
+		if(random)
+			randomfill(at, sizeof(addr));
+		else if(ipv6argument(arg, &addr))
+			memcpy(at, &addr, sizeof(addr));
+		mod->pack->modified |= f->modified;
+		return;
+	}
+	if(random) {
+		value = random32();
+		if(f->type == SENDIP_FIELD_HOST)
+			value = f->width==1 ? (u_int8_t)value :
+			        f->width==2 ? (u_int16_t)value : value;
+		else
+			value = f->width==1 ? (u_int8_t)value :
+			        f->width==2 ? htons((u_int16_t)value) : htonl(value);
+	} else if(f->type == SENDIP_FIELD_IPV4) {
+		value = ipv4argument(arg, strlen(arg));
+	} else if(f->type == SENDIP_FIELD_HOST) {
+		value = hostintegerargument(arg, f->width);
+	} else {
+		value = integerargument(arg, f->width);
+	}
+	switch(f->width) {
+	case 1:
+		*at = (u_int8_t)value;
+		break;
+	case 2:
+		value16 = (u_int16_t)value;
+		memcpy(at, &value16, 2);
+		break;
+	default:
+		memcpy(at, &value, 4);
+		break;
+	}
+	mod->pack->modified |= f->modified;
+}
+
+static void patch_template(dynamic_opt *dyn, int ndyn) {
+	char rbuff[31];
+	int i;
+
+	for(i=0; i<ndyn; i++) {
+		const char *arg = dyn[i].arg;
+
+		/* --replay: this header isn't in the current packet */
+		if(!dyn[i].mod->pack->data) continue;
+		if(dyn[i].field) {
+			put_field(dyn[i].mod, dyn[i].field, arg, dyn[i].random);
+			continue;
+		}
+		if(dyn[i].random) {
+			sprintf(rbuff,"%lu",(unsigned long)random32());
+			arg = rbuff;
+		}
+		(void)dyn[i].mod->do_opt(dyn[i].optname,arg,dyn[i].mod->pack);
+	}
+}
+
+/* Finalize all the headers from inside out. Returns the (possibly
+ * trimmed) length of the packet. same says that the packet data hasn't
+ * changed since the last time, which lets the innermost header update
+ * its checksum rather than recompute it; datasum, if not NULL, is the
+ * data's partial checksum, worked out as it was copied in.
+ */
+static int finalize_packet(sendip_data *packet, int datalen, int num_modules,
+                           bool same, u_int32_t *datasum, bool verbosity) {
+	char hdrs[num_modules];
+	sendip_data *headers[num_modules];
+	sendip_data d;
+	sendip_module *mod;
+	int i;
+
+	d.alloc_len = datalen;
+	d.data = (char *)packet->data+packet->alloc_len-datalen;
+	d.modified = same ? SENDIP_DATA_SAME : 0;
+	if(datasum) {
+		d.modified |= SENDIP_DATA_SUMMED;
+		d.csum = *datasum;
+	}
+
+	for(i=0,mod=first; mod!=NULL; mod=mod->next,i++) {
+		hdrs[i]=mod->optchar;
+		headers[i]=mod->pack;
+	}
+
+	for(i=num_modules-1,mod=last; mod!=NULL; mod=mod->prev,i--) {
+
+		if(verbosity) fprintf(stderr, "Finalizing module %s\n",mod->name);
+		/* Remove this header from enclosing list */
+		/* @@ Don't erase the header type, so that
+		 * it's available to upper-level headers where
+		 * needed. Instead, we tell the upper-level
+		 * headers where they are in the list.
+		 */
+		/*@@hdrs[i]='\0';@@*/
+		/* @@ wesp needs to see the esp header info,
+		 * so now we can't erase that, either.
+		 */
+		/*@@headers[i] = NULL;*/
+
+		/* @@ */
+		mod->finalize(hdrs, headers, i, &d, mod->pack);
+
+		/* Get everything ready for the next call. Inner finalizes may
+		 * have changed anything (sequence numbers, say), so outer
+		 * headers always check everything.
+		 */
+		d.data=(char *)d.data-mod->pack->alloc_len;
+		d.alloc_len+=mod->pack->alloc_len;
+		d.modified=0;
+	}
+	/* @@ Trim back the packet length if need be */
+	if (d.alloc_len < packet->alloc_len)
+		return d.alloc_len;
+	return packet->alloc_len;
+}
+
+/* Move every header's data from one copy of the packet to another */
+static void move_headers(const void *from, void *to) {
+	sendip_module *mod;
+
+	for(mod=first; mod!=NULL; mod=mod->next)
+		mod->pack->data = (char *)to + ((char *)mod->pack->data - (char *)from);
+}
+
+/* Finalize n copies of the template, stride bytes apart from batch on,
+ * a module at a time from the inside out: with its finalize_batch if it
+ * has one, otherwise with finalize for each copy in turn. The headers
+ * point into the first copy, before and after. datasums are the partial
+ * checksums of each copy's data.
+ */
+static void finalize_packets(u_int8_t *batch, int n, int stride, int len,
+                             int datalen, int num_modules, bool same,
+                             u_int32_t *datasums, bool verbosity) {
+	char hdrs[num_modules];
+	sendip_data *headers[num_modules];
+	sendip_data d[n];
+	sendip_module *mod;
+	int inner = len-datalen;	/* where the current header's data starts */
+	int i, k;
+
+	for(i=0,mod=first; mod!=NULL; mod=mod->next,i++) {
+		hdrs[i]=mod->optchar;
+		headers[i]=mod->pack;
+	}
+	for(k=0; k<n; k++) {
+		d[k].data = batch+k*stride+inner;
+		d[k].alloc_len = datalen;
+		d[k].modified = SENDIP_DATA_SUMMED | (same ? SENDIP_DATA_SAME : 0);
+		d[k].csum = datasums[k];
+	}
+
+	for(i=num_modules-1,mod=last; mod!=NULL; mod=mod->prev,i--) {
+		if(verbosity)
+			fprintf(stderr, "Finalizing module %s for %d packets\n",mod->name,n);
+		if(mod->finalize_batch) {
+			mod->finalize_batch(hdrs, headers, i, d, mod->pack, n, stride);
+		} else {
+			for(k=0; k<n; k++) {
+				if(k) move_headers(batch+(k-1)*stride, batch+k*stride);
+				mod->finalize(hdrs, headers, i, &d[k], mod->pack);
+			}
+			if(n > 1) move_headers(batch+(n-1)*stride, batch);
+		}
+		inner -= mod->pack->alloc_len;
+		for(k=0; k<n; k++) {
+			d[k].data = batch+k*stride+inner;
+			d[k].alloc_len += mod->pack->alloc_len;
+			d[k].modified = 0;
+		}
+	}
+}
+
+/* Send (or dump, or capture) one finished packet */
+static int send_packet(xmit_ctx *xmit, pcap_out *pcap, bool dump,
+                       sendip_data *packet, const char *hostname, int af_type) {
+	int i;
+
+	if (pcap->fd >= 0) {
+		xmit_ethertype(xmit, af_type);
+		if ((i = pcap_write(pcap, packet->data, packet->alloc_len)) == 0) {
+			xmit->stats.packets++;
+			xmit->stats.bytes += packet->alloc_len;
+		}
+	} else if (dump) {
+		i = fwrite(packet->data, packet->alloc_len, 1, stdout);
+		if (i == 1) {
+			xmit->stats.packets++;
+			xmit->stats.bytes += packet->alloc_len;
+		}
+	}
+	else if (xmit->batch)
+		i = xmit_queue(xmit,packet,hostname,af_type);
+	else
+		i = xmit_send(xmit,packet,hostname,af_type);
+	return i;
+}
+
+/* --replay: send the packets from a capture, passes times over (0 means
+ * indefinitely). Each packet is copied into one buffer, and the headers
+ * of the modules that match its own are pointed at it, so that the
+ * module options (all of them, not just the dynamic ones) can be
+ * re-applied in place. Then the checksums are put right, but nothing
+ * else the modules' finalize would do is, so the capture's lengths,
+ * IDs and so on are left alone unless they were asked for.
+ */
+static void replay_packets(replay_in *rin, int passes, dynamic_opt *dyn,
+                           int ndyn, int num_modules, xmit_ctx *xmit,
+                           pcap_out *pcap, pacer *pace, bool dump,
+                           const char *hostname) {
+	char hdrs[num_modules];
+	sendip_data *headers[num_modules];
+	void *saved[num_modules];
+	int savedlen[num_modules];
+	int off[num_modules], hlen[num_modules];
+	sendip_data packet;
+	sendip_module *mod;
+	const u_int8_t *pkt;
+	u_int8_t *buf;
+	u_int64_t ts, base;
+	int len, n, i;
+	bool forever = (passes == 0);
+
+	if((buf = malloc(REPLAY_MAX)) == NULL) {
+		perror("OUT OF MEMORY!\n");
+		return;
+	}
+	for(i=0,mod=first; mod!=NULL; mod=mod->next,i++) {
+		hdrs[i]=mod->optchar;
+		headers[i]=mod->pack;
+		saved[i]=mod->pack->data;
+		savedlen[i]=mod->pack->alloc_len;
+	}
+	packet.data = buf;
+	packet.modified = 0;
+	packet.private = NULL;
+
+	while(forever || passes-- > 0) {
+		replay_rewind(rin);
+		pace_epoch(pace);
+		base = 0;
+		while(replay_next(rin, &pkt, &len, &ts)) {
+			memcpy(buf, pkt, len);
+			packet.alloc_len = len;
+			n = replay_match(buf, len, hdrs, num_modules, off, hlen);
+			for(i=0; i<num_modules; i++) {
+				headers[i]->data = (i < n) ? buf+off[i] : NULL;
+				headers[i]->alloc_len = (i < n) ? hlen[i] : 0;
+			}
+			patch_template(dyn, ndyn);
+			replay_fixup(buf, len, headers, n);
+
+			if(!base) base = ts;
+			pace_until(pace, xmit, ts > base ? ts-base : 0);
+			pace_wait(pace, xmit, len);
+			(void)send_packet(xmit, pcap, dump, &packet, hostname,
+			                  (buf[0]>>4) == 6 ? AF_INET6 : AF_INET);
+		}
+	}
+
+	if(xmit->verbose && rin->skipped)
+		fprintf(stderr, "Skipped %llu packet(s) that couldn't be replayed\n",
+		        rin->skipped);
+	for(i=0; i<num_modules; i++) {
+		headers[i]->data = saved[i];
+		headers[i]->alloc_len = savedlen[i];
+	}
+	free(buf);
+}
+
+/* Work out the -d data again into to, which has room for it. Random
+ * data is written straight in.
+ */
+static int regen_data(char *datarg, bool datarand, char *to) {
+	char *sdata;
+	int len;
+
+	if(datarand) {
+		len = atoi(datarg+1);
+		randomfill(to, len);
+		return len;
+	}
+	len = stringargument(datarg, &sdata);
+	memcpy(to, sdata, len);
+	return len;
+}
 
 int main(int argc, char *const argv[]) {
 	int i;
@@ -420,6 +722,8 @@ int main(int argc, char *const argv[]) {
 	int datafile=-1;
 	int datalen=0;
 	char *datarg=NULL;
+	bool datadyn=FALSE;	/* datarg is different for every packet */
+	bool datarand=FALSE;	/* datarg is rN */
 
 	sendip_module *mod, *currentmod;
 	int optc;
@@ -427,27 +731,103 @@ int main(int argc, char *const argv[]) {
 	int num_modules=0;
 
 	sendip_data packet;
+	xmit_ctx xmit;
+	bool xmit_bad=FALSE;
+	workers work;
+	int threads=0;
+	bool pin=FALSE;
+	int status=0;
 
 	/*@@*/
 	int loopcount=1;
-	unsigned int delaytime=0;
+	pacer pace;
+	bool pace_bad=FALSE;
+	pcap_out pcap;
+	char *pcapname=NULL;
+	bool pcapng=FALSE, ether_set=FALSE;
+	replay_in rin;
+	char *replayname=NULL;
+	bool replay_bad=FALSE;
+	int batch=0;
+
+	/* packet template (see patch_template) */
+	dynamic_opt *dyn=NULL;
+	int ndyn=0;
+	bool tmpl_ok=TRUE, tmpl_ready=FALSE;
+	u_int8_t *tmpl_batch=NULL;	/* TMPL_BATCH copies, tmpl_stride apart */
+	int tmpl_stride=0, tmpl_af=AF_INET;
+	u_int32_t tmpl_sums[TMPL_BATCH];
+	fastpath fast;		/* finalizing without the modules, if we can */
+	bool fast_ok=TRUE;
+	bool firstsent=TRUE;	/* for arena_counts.first_packet */
+	u_int32_t datasum=0;	/* partial checksum of the packet data */
+	bool odd;
 
 	num_opts = 0;
 	first=last=NULL;
 
 	progname=argv[0];
 
-	/* magic random seed that gives 4 really random octets */
-	srandom(time(NULL) ^ (getpid()+(42<<15)));
+	/* Different every run, unless --seed says otherwise */
+	randomseed((u_int64_t)time(NULL) ^ ((u_int64_t)getpid()<<32));
 
 	/*@@ init global tools */
 	fa_init();
+	xmit_init(&xmit, FALSE);
+	pace_init(&pace);
+	pcap_init(&pcap);
 
 	/* First, get all the builtin options, and load the modules */
 	gnuopterr=0;
 	gnuoptind=0;
-	while(gnuoptind<argc && (EOF != (optc=gnugetopt(argc,argv,"-p:l:T:vd:hf:D")))) {
+	while(gnuoptind<argc && (EOF != (optc=getopt_long(argc,argv,"-p:l:T:vd:hf:D",core_opts,&longindex)))) {
 		switch(optc) {
+		case OPT_BATCH:
+			batch = atoi(gnuoptarg);
+			break;
+		case OPT_XMIT:
+			if(xmit_backend(&xmit, gnuoptarg) < 0) xmit_bad = TRUE;
+			break;
+		case OPT_IFACE:
+			xmit.ifname = gnuoptarg;
+			break;
+		case OPT_ETHER:
+			if(xmit_ether(&xmit, gnuoptarg) < 0) xmit_bad = TRUE;
+			ether_set = TRUE;
+			break;
+		case OPT_THREADS:
+			threads = atoi(gnuoptarg);
+			break;
+		case OPT_PIN:
+			pin = TRUE;
+			break;
+		case OPT_PPS:
+			if(pace_rate(&pace, gnuoptarg, FALSE) < 0) pace_bad = TRUE;
+			break;
+		case OPT_BPS:
+			if(pace_rate(&pace, gnuoptarg, TRUE) < 0) pace_bad = TRUE;
+			break;
+		case OPT_BURST:
+			if((pace.burst = atoi(gnuoptarg)) < 0) pace.burst = 0;
+			break;
+		case OPT_PCAP:
+		case OPT_PCAPNG:
+			pcapname = gnuoptarg;
+			pcapng = (optc == OPT_PCAPNG);
+			dump = TRUE;
+			break;
+		case OPT_REPLAY:
+			replayname = gnuoptarg;
+			break;
+		case OPT_SPEED:
+			if(pace_speed(&pace, gnuoptarg) < 0) pace_bad = TRUE;
+			break;
+		case OPT_SEED:
+			randomseed(strtoull(gnuoptarg, NULL, 0));
+			break;
+		case OPT_NOFAST:
+			fast_ok = FALSE;
+			break;
 		case 'D':
 			dump=TRUE;
 			break;
@@ -459,20 +839,17 @@ int main(int argc, char *const argv[]) {
 			loopcount = atoi(gnuoptarg);
 			break;
 		case 'T':
-			delaytime = atoi(gnuoptarg);
+			if(pace_delay(&pace, gnuoptarg) < 0) pace_bad = TRUE;
 			break;
 		case 'v':
 			verbosity=TRUE;
 			break;
 		case 'd':
-			if (datafile == -1) {
-				char *sdata;
-
+			if (datafile == -1 && datarg == NULL) {
 				datarg = gnuoptarg;	/* save for regen */
-				datalen = stringargument(datarg, &sdata);
-				data=(char *)malloc(datalen);
-				memcpy(data, sdata, datalen);
-
+				/* Ask before compact_string() rewrites it */
+				datadyn = dynamicargument(datarg);
+				datarand = (*datarg == 'r' && isdigit(datarg[1]));
 			} else {
 				fprintf(stderr,"Only one -d or -f option can be given\n");
 				usage = TRUE;
@@ -482,7 +859,7 @@ int main(int argc, char *const argv[]) {
 			usage=TRUE;
 			break;
 		case 'f':
-			if(data == NULL) {
+			if(data == NULL && datarg == NULL) {
 				datafile=open(gnuoptarg,O_RDONLY);
 				if(datafile == -1) {
 					perror("Couldn't open data file");
@@ -521,39 +898,173 @@ int main(int argc, char *const argv[]) {
 		}
 	}
 
+	/* The data is only worked out now, so that --seed applies to it
+	 * wherever it was given
+	 */
+	if(datarg) {
+		char *sdata;
+
+		if(datarand) {
+			datalen = atoi(datarg+1);
+			data = (char *)malloc(datalen);
+			randomfill(data, datalen);
+		} else {
+			datalen = stringargument(datarg, &sdata);
+			data = (char *)malloc(datalen);
+			memcpy(data, sdata, datalen);
+		}
+	}
+	if(verbosity)
+		fprintf(stderr, "Random seed %llu\n",
+		        (unsigned long long)randomseeded());
+
+	/* Build the getopt listings */
+	opts = malloc((1+NUM_CORE_OPTS+num_opts)*sizeof(struct option));
+	if(opts==NULL) {
+		perror("OUT OF MEMORY!\n");
+		return 1;
+	}
+	memset(opts,'\0',(1+NUM_CORE_OPTS+num_opts)*sizeof(struct option));
+	for(i=0; i<NUM_CORE_OPTS; i++) {
+		opts[i] = core_opts[i];
+		opts[i].name = strdup(core_opts[i].name);
+	}
+	for(mod=first; mod!=NULL; mod=mod->next) {
+		int j;
+		char *s;   // nasty kludge because option.name is const
+		for(j=0; j<mod->num_opts; j++) {
+			/* +2 on next line is one for the char, one for the trailing null */
+			opts[i].name = s = malloc(strlen(mod->opts[j].optname)+2);
+			sprintf(s,"%c%s",mod->optchar,mod->opts[j].optname);
+			opts[i].has_arg = mod->opts[j].arg;
+			opts[i].flag = NULL;
+			opts[i].val = mod->optchar;
+			i++;
+		}
+	}
+	if(verbosity) fprintf(stderr, "Added %d options\n",num_opts);
+
+	xmit.verbose = verbosity;
+	if(xmit_bad || pace_bad) return 1;
+	if(pace.speed && !replayname) {
+		fprintf(stderr,"--speed only makes sense with --replay\n");
+		return 1;
+	}
+	if(replayname && replay_open(&rin, replayname) < 0)
+		return 1;
+	/* Captures get an Ethernet header if we would have sent one */
+	if(pcapname && pcap_open(&pcap, pcapname, pcapng,
+	               (ether_set || xmit.backend == XMIT_PACKET ||
+	                xmit.backend == XMIT_XDP) ? xmit.ether : NULL) < 0)
+		return 1;
+	if(batch > 1 && !dump && xmit_batch(&xmit, batch) < 0)
+		return 1;
+
+	/* Split the packets (and the rate) between the workers; the parent
+	 * sends none
+	 */
+	pace_start(&pace);
+	memset(&work, 0, sizeof(work));
+	work.id = -1;
+	if(threads > 1 && dump) {
+		fprintf(stderr,"--threads is ignored when dumping packets\n");
+	} else if(threads > 1) {
+		if(workers_start(&work, threads, pin) < 0)
+			return 1;
+		/* Replays deal out the capture's packets instead */
+		if(!replayname)
+			loopcount = workers_share(&work, loopcount);
+		else if(work.id >= 0)
+			replay_shard(&rin, work.id, threads);
+		else
+			loopcount = 0;
+		if(work.id >= 0) {
+			pace_share(&pace, threads);
+			pace_start(&pace);
+		}
+		/* The first packet's data was generated before the fork */
+		if(work.id >= 0 && datadyn)
+			datalen = regen_data(datarg, datarand, data);
+	}
+
+	/* Every option takes at most one argv slot. Replays re-apply every
+	 * module option to each packet, not just the dynamic ones.
+	 */
+	if(loopcount > 1 || replayname) {
+		dyn = malloc(argc*sizeof(dynamic_opt));
+		if(dyn == NULL) tmpl_ok = FALSE;
+	} else {
+		tmpl_ok = FALSE;
+	}
+	/* File data may change length from one packet to the next */
+	if(datarg && *datarg == 'f') tmpl_ok = FALSE;
+
 	/*@@ looping - needs to be after module loading, but before
 	 * module option processing ... */
 	while (--loopcount >= 0) {
 
-		/* Build the getopt listings */
-		opts = malloc((1+num_opts)*sizeof(struct option));
-		if(opts==NULL) {
-			perror("OUT OF MEMORY!\n");
-			return 1;
+		if(tmpl_ready) {
+			/* Copy the template, regenerate the data and the dynamic
+			 * fields in each copy, then finalize them all together
+			 */
+			int n = loopcount+1 < TMPL_BATCH ? loopcount+1 : TMPL_BATCH;
+			int k;
+
+			loopcount -= n-1;
+			for(k=0; k<n; k++) {
+				u_int8_t *copy = tmpl_batch+k*tmpl_stride;
+
+				memcpy(copy, packet.data, packet.alloc_len);
+				move_headers(k ? copy-tmpl_stride : (u_int8_t *)packet.data,
+				             copy);
+				tmpl_sums[k] = datasum;
+				if(datadyn) {
+					char *sdata, *at = (char *)copy+packet.alloc_len-datalen;
+
+					odd = FALSE;
+					if(datarand) {
+						randomfill(at, datalen);
+						tmpl_sums[k] = csum_partial(at, datalen, 0, &odd);
+					} else {
+						datalen = stringargument(datarg, &sdata);
+						tmpl_sums[k] = csum_partial_copy(at, sdata, datalen,
+						                                 0, &odd);
+					}
+				}
+				patch_template(dyn, ndyn);
+			}
+			move_headers(tmpl_batch+(n-1)*tmpl_stride, tmpl_batch);
+			if(fast.stack != FAST_NONE)
+				fast_finalize(&fast, tmpl_batch, n, tmpl_stride, tmpl_sums);
+			else
+				finalize_packets(tmpl_batch, n, tmpl_stride, packet.alloc_len,
+				                 datalen, num_modules, !datadyn, tmpl_sums,
+				                 verbosity);
+			move_headers(tmpl_batch, packet.data);
+
+			for(k=0; k<n; k++) {
+				sendip_data copy = packet;
+
+				copy.data = tmpl_batch+k*tmpl_stride;
+				pace_wait(&pace, &xmit, copy.alloc_len);
+				i = send_packet(&xmit, &pcap, dump, &copy, argv[gnuoptind],
+				                tmpl_af);
+			}
+			continue;
 		}
-		memset(opts,'\0',(1+num_opts)*sizeof(struct option));
-		i=0;
+
+		/* The last packet's headers are finished with */
 		for(mod=first; mod!=NULL; mod=mod->next) {
-			int j;
-			char *s;   // nasty kludge because option.name is const
-			for(j=0; j<mod->num_opts; j++) {
-				/* +2 on next line is one for the char, one for the trailing null */
-				opts[i].name = s = malloc(strlen(mod->opts[j].optname)+2);
-				sprintf(s,"%c%s",mod->optchar,mod->opts[j].optname);
-				opts[i].has_arg = mod->opts[j].arg;
-				opts[i].flag = NULL;
-				opts[i].val = mod->optchar;
-				i++;
-			}
+			/*@@ if looping, check if reloading */
+			/*@@*/if (mod->pack) arena_free(mod->pack);
 		}
-		if(verbosity) fprintf(stderr, "Added %d options\n",num_opts);
+		arena_reset();
 
 		/* Initialize all */
 		for(mod=first; mod!=NULL; mod=mod->next) {
 			if(verbosity) fprintf(stderr, "Initializing module %s\n",mod->name);
-			/*@@ if looping, check if reloading */
-			/*@@*/if (mod->pack) free(mod->pack);
 			mod->pack=mod->initialize();
+			if(mod->pack->private) tmpl_ok = FALSE;
 		}
 
 		/* Do the get opt */
@@ -582,6 +1093,21 @@ int main(int argc, char *const argv[]) {
 			case 'h':
 			case 'l':/*@@*/
 			case 'T':/*@@*/
+			case OPT_BATCH:
+			case OPT_XMIT:
+			case OPT_IFACE:
+			case OPT_ETHER:
+			case OPT_THREADS:
+			case OPT_PIN:
+			case OPT_PPS:
+			case OPT_BPS:
+			case OPT_BURST:
+			case OPT_PCAP:
+			case OPT_PCAPNG:
+			case OPT_REPLAY:
+			case OPT_SPEED:
+			case OPT_SEED:
+			case OPT_NOFAST:
 				/* Processed above */
 				break;
 			case ':':
@@ -604,18 +1130,42 @@ int main(int argc, char *const argv[]) {
 					}
 				}
 				if (mod) {
-					/* Random option arguments */
-					if(gnuoptarg != NULL && !strcmp(gnuoptarg,"r")) {
-						/* need a 32 bit number, but random() is signed and
-							nonnegative so only 31bits - we simply repeat one */
-						unsigned long r = (unsigned long)random()<<1;
-						r+=(r&0x00000040)>>6;
-						sprintf(rbuff,"%lu",r);
-						gnuoptarg = rbuff;
+					int oldlen = mod->pack->alloc_len;
+					bool isdyn = dyn && (replayname ||
+					                     dynamicargument(gnuoptarg));
+					const sendip_field *field = gnuoptarg ?
+						find_field(mod, opts[longindex].name) : NULL;
+
+					/* Remember anything that needs regenerating */
+					if(isdyn) {
+						dyn[ndyn].mod = mod;
+						dyn[ndyn].optname = opts[longindex].name;
+						dyn[ndyn].arg = gnuoptarg;
+						dyn[ndyn].random = gnuoptarg && !strcmp(gnuoptarg,"r");
+						dyn[ndyn].field = field;
+						ndyn++;
 					}
 
-					if(!mod->do_opt(opts[longindex].name,gnuoptarg,mod->pack)) {
-						usage=TRUE;
+					if(field) {
+						put_field(mod, field, gnuoptarg,
+						          !strcmp(gnuoptarg,"r"));
+					} else {
+						/* Random option arguments */
+						if(gnuoptarg != NULL && !strcmp(gnuoptarg,"r")) {
+							sprintf(rbuff,"%lu",(unsigned long)random32());
+							gnuoptarg = rbuff;
+						}
+						if(!mod->do_opt(opts[longindex].name,gnuoptarg,mod->pack)) {
+							usage=TRUE;
+						}
+					}
+					if(isdyn && mod->pack->alloc_len != oldlen) {
+						tmpl_ok = FALSE;
+						if(replayname) {
+							fprintf(stderr,"Option -%s changes the header length, so can't be used with --replay\n",
+							        opts[longindex].name);
+							replay_bad = usage = TRUE;
+						}
 					}
 				}
 				break;
@@ -640,14 +1190,8 @@ int main(int argc, char *const argv[]) {
 			}
 		}
 
-		/* free opts now we have finished with it */
-		for(i=0; i<(1+num_opts); i++) {
-			if(opts[i].name != NULL) free((void *)opts[i].name);
-		}
-		free(opts); /* don't need them any more */
-
 		if(usage) {
-			print_usage();
+			if(work.id <= 0 && !replay_bad) print_usage();
 			unload_modules(TRUE,verbosity);
 			if(datafile != -1) {
 				munmap(data,datalen);
@@ -655,7 +1199,17 @@ int main(int argc, char *const argv[]) {
 				datafile=-1;
 			}
 			if (datarg) free(data);
-			return 0;
+			return replay_bad;
+		}
+
+		if(replayname) {
+			if(data != NULL && work.id <= 0)
+				fprintf(stderr,"Packet data (-d, -f) is ignored with --replay\n");
+			replay_packets(&rin, loopcount+1, dyn, ndyn, num_modules, &xmit,
+			               &pcap, &pace, dump,
+			               dump ? NULL : argv[gnuoptind]);
+			replay_close(&rin);
+			break;
 		}
 
 		for(mod=first; mod!=NULL; mod=mod->next) {
@@ -685,56 +1239,27 @@ int main(int argc, char *const argv[]) {
 			packet.alloc_len+=mod->pack->alloc_len;
 		}
 		if(data != NULL) packet.alloc_len+=datalen;
-		packet.data = malloc(packet.alloc_len);
+		packet.data = arena_alloc(packet.alloc_len);
 		for(i=0, mod=first; mod!=NULL; mod=mod->next) {
 			memcpy((char *)packet.data+i,mod->pack->data,mod->pack->alloc_len);
-			free(mod->pack->data);
+			arena_free(mod->pack->data);
 			mod->pack->data = (char *)packet.data+i;
 			i+=mod->pack->alloc_len;
 		}
 
-		/* Add any data */
-		if(data != NULL) memcpy((char *)packet.data+i,data,datalen);
+		/* Add any data, summing it on the way for the checksums */
+		odd = FALSE;
+		datasum = 0;
+		if(data != NULL)
+			datasum = csum_partial_copy((char *)packet.data+i, data, datalen,
+			                            0, &odd);
 
 		/* Finalize from inside out */
-		{
-			char hdrs[num_modules];
-			sendip_data *headers[num_modules];
-			sendip_data d;
-
-			d.alloc_len = datalen;
-			d.data = (char *)packet.data+packet.alloc_len-datalen;
-
-			for(i=0,mod=first; mod!=NULL; mod=mod->next,i++) {
-				hdrs[i]=mod->optchar;
-				headers[i]=mod->pack;
-			}
-
-			for(i=num_modules-1,mod=last; mod!=NULL; mod=mod->prev,i--) {
-
-				if(verbosity) fprintf(stderr, "Finalizing module %s\n",mod->name);
-				/* Remove this header from enclosing list */
-				/* @@ Don't erase the header type, so that
-				 * it's available to upper-level headers where
-				 * needed. Instead, we tell the upper-level
-				 * headers where they are in the list.
-				 */
-				/*@@hdrs[i]='\0';@@*/
-				/* @@ wesp needs to see the esp header info,
-				 * so now we can't erase that, either.
-				 */
-				/*@@headers[i] = NULL;*/
-
-				/* @@ */
-				mod->finalize(hdrs, headers, i, &d, mod->pack);
-
-				/* Get everything ready for the next call */
-				d.data=(char *)d.data-mod->pack->alloc_len;
-				d.alloc_len+=mod->pack->alloc_len;
-			}
-			/* @@ Trim back the packet length if need be */
-			if (d.alloc_len < packet.alloc_len)
-				packet.alloc_len = d.alloc_len;
+		i = finalize_packet(&packet, datalen, num_modules, FALSE, &datasum,
+		                    verbosity);
+		if (i < packet.alloc_len) {
+			packet.alloc_len = i;
+			tmpl_ok = FALSE;
 		}
 		/* @@ We could (and should?) free any leftover priv data here. */
 
@@ -745,7 +1270,7 @@ int main(int argc, char *const argv[]) {
 				if(data == NULL) {
 					fprintf(stderr,"Nothing specified to send!\n");
 					print_usage();
-					free(packet.data);
+					arena_free(packet.data);
 					unload_modules(FALSE,verbosity);
 					return 1;
 				} else {
@@ -757,28 +1282,91 @@ int main(int argc, char *const argv[]) {
 			else {
 				fprintf(stderr,"Either IPv4 or IPv6 must be the outermost packet\n");
 				unload_modules(FALSE,verbosity);
-				free(packet.data);
+				arena_free(packet.data);
 				return 1;
 			}
-			if (dump)
-				i = fwrite(packet.data, packet.alloc_len, 1, stdout);
-			else
-				i = sendpacket(&packet,argv[gnuoptind],af_type,verbosity);
-			free(packet.data);
+			tmpl_af = af_type;
+			pace_wait(&pace, &xmit, packet.alloc_len);
+			i = send_packet(&xmit, &pcap, dump, &packet, argv[gnuoptind],
+			                af_type);
+		}
+		if(firstsent) {
+			arena_counts.first_packet = arena_counts.heap_allocs;
+			firstsent = FALSE;
 		}
-		/* @@ Regenerate data on subsequent loop calls */
-		if (loopcount && datarg) {
-			char *sdata;
 
-			datalen = stringargument(datarg, &sdata);
-			memcpy(data, sdata, datalen);
+		/* Keep the first packet as a template if we can */
+		if (dyn && !tmpl_ready) {
+			if (tmpl_ok) {
+				/* Copies start on cache lines */
+				tmpl_stride = (packet.alloc_len+63) & ~63;
+				tmpl_batch = malloc((size_t)TMPL_BATCH*tmpl_stride);
+				tmpl_ok = tmpl_batch != NULL;
+			}
+			if (tmpl_ok) {
+				const char *names[num_modules];
+				sendip_data *headers[num_modules];
+
+				tmpl_ready = TRUE;
+				/* The fast path only knows the field table options */
+				for(i=0; i<ndyn; i++)
+					if(!dyn[i].field) fast_ok = FALSE;
+				for(i=0, mod=first; mod!=NULL; mod=mod->next, i++) {
+					names[i] = mod->name;
+					headers[i] = mod->pack;
+				}
+				fast.stack = FAST_NONE;
+				if(fast_ok && fast_setup(&fast, names, headers, num_modules,
+				                         datalen) && verbosity)
+					fprintf(stderr, "Using the %s/%s fast path\n",
+					        names[0], names[1]);
+				if(verbosity)
+					fprintf(stderr, "Using packet template, %d dynamic field(s)\n",
+					        ndyn);
+			} else {
+				free(dyn);
+				dyn = NULL;
+			}
 		}
+		if (!tmpl_ready) arena_free(packet.data);
 
-		/*@@ looping */
-		if (loopcount && delaytime)
-			sleep(delaytime);
+		/* @@ Regenerate data on subsequent loop calls */
+		if (!tmpl_ready && loopcount && datadyn)
+			datalen = regen_data(datarg, datarand, data);
 	} /*@@ back to top of loop */
 
+	if (tmpl_ready) arena_free(packet.data);
+	free(tmpl_batch);
+	free(dyn);
+	xmit_flush(&xmit);
+	xmit_close(&xmit);
+	if(pcap_close(&pcap) < 0) status = 1;
+	if(work.id >= 0) {
+		workers_done(&work, &xmit.stats);
+		if(verbosity) {
+			char who[32];
+
+			sprintf(who, "Worker %d", work.id);
+			csum_report(who);
+			arena_report(who);
+		}
+	} else {
+		if(work.n && workers_wait(&work, &xmit.stats, verbosity))
+			status = 1;
+		xmit_report(&xmit);
+		pace_report(&pace, &xmit.stats, verbosity);
+		if(verbosity) {
+			csum_report("Packet");
+			arena_report("Packet");
+		}
+	}
+
+	/* free opts now we have finished with it */
+	for(i=0; i<(1+NUM_CORE_OPTS+num_opts); i++) {
+		if(opts[i].name != NULL) free((void *)opts[i].name);
+	}
+	free(opts);
+
 	/* cleanup */
 	if(datafile != -1) {
 		munmap(data,datalen);
@@ -787,12 +1375,13 @@ int main(int argc, char *const argv[]) {
 	}
 	if (datarg) free(data);
 
-	unload_modules(FALSE,verbosity);
+	/* A replay leaves the modules' own header buffers in place */
+	unload_modules(replayname != NULL,verbosity);
 	/*@@ global de-init */
 	fa_close();
+	arena_close();
 
 
-	/*@@fprintf(stderr, "%d random calls\n", randomcalls);*/
 
-	return 0;
+	return status;
 }
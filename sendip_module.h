@@ -6,6 +6,7 @@
 #endif
 
 #include <stdio.h>   // for fprintf
+#include <stddef.h>  // for offsetof, in field tables
 
 #include "types.h"
 
@@ -18,6 +19,25 @@ typedef struct {
 	const char *def;
 } sendip_option;
 
+/* Fields: options whose do_opt() does no more than put the value of
+ * its argument (as integerargument(), hostintegerargument(),
+ * ipv4argument() or ipv6argument() would give it) into the header and
+ * set a modified flag. sendip can then do that itself, straight into
+ * the packet, when it regenerates dynamic options for each packet.
+ */
+typedef struct {
+	const char *optname;	/* as in sendip_option */
+	unsigned short offset;	/* of the field in the header */
+	unsigned char width;	/* in bytes: 1, 2 or 4 (16 for IPv6 addresses) */
+	unsigned char type;	/* SENDIP_FIELD_... */
+	unsigned int modified;	/* flag do_opt() sets */
+} sendip_field;
+
+#define SENDIP_FIELD_NET	0	/* integer, network byte order */
+#define SENDIP_FIELD_HOST	1	/* integer, host byte order */
+#define SENDIP_FIELD_IPV4	2	/* IPv4 address */
+#define SENDIP_FIELD_IPV6	3	/* IPv6 address */
+
 /* Data
  */
 typedef struct {
@@ -26,8 +46,20 @@ typedef struct {
 	unsigned int modified;
 	unsigned int route_daddr;
 	void *private;		/* @@ Untouched by sendip main */
+	u_int32_t csum;		/* partial checksum of data, see below */
 } sendip_data;
 
+/* Set by sendip in the modified field of the data passed to finalize()
+ * when the data (everything after this header) is byte for byte what
+ * it was at the last finalize() of the same header, so checksums over
+ * it can be updated rather than redone (see csum_cover()).
+ */
+#define SENDIP_DATA_SAME	0x80000000
+/* Set when csum holds the csum_partial() sum of the data, worked out
+ * as it was put in the packet, so it doesn't need reading again
+ */
+#define SENDIP_DATA_SUMMED	0x40000000
+
 /* Prototypes */
 #ifndef _SENDIP_MAIN
 sendip_data *initialize(void);
@@ -38,6 +70,16 @@ bool finalize(char *hdrs, sendip_data *headers[], int index,
 int num_opts(void);
 sendip_option *get_opts(void);
 char get_optchar(void);
+/* Optional */
+int num_fields(void);
+sendip_field *get_fields(void);
+/* Finalize n packets laid out stride bytes apart, all alike but for
+ * their dynamic fields. headers[] and pack point into the first; data[k]
+ * is what's inside this header in packet k. Leave the pointers as they
+ * were found.
+ */
+bool finalize_batch(char *hdrs, sendip_data *headers[], int index,
+                    sendip_data data[], sendip_data *pack, int n, int stride);
 
 #endif  /* _SENDIP_MAIN */
 
@@ -46,16 +88,30 @@ char get_optchar(void);
 extern u_int16_t csum(u_int16_t *packet, int packlen);
 extern int compact_string(char *data_out);
 /*@@ added */
-#define MAXRAND	8192	/* maximum length of random data */
+#define MAXRAND	8192	/* maximum length of zN and tN data */
 u_int8_t * randombytes(int length);
+void randomseed(u_int64_t seed);
+void randomstream(unsigned int n);
+u_int64_t randomseeded(void);
+u_int32_t random32(void);
+u_int64_t random64(void);
+u_int64_t randomkey(const char *name, unsigned int n);
+void randomfill(void *buf, size_t len);
 int stringargument(char *input, char **output);
 u_int32_t integerargument(const char *input, int length);
 u_int32_t hostintegerargument(const char *input, int length);
 in_addr_t cidrargument(const char *input, char *slashpoint, int length);
 in_addr_t ipv4argument(const char *input, int length);
+bool ipv6argument(const char *input, struct in6_addr *addr);
 char *fileargument(const char *input);
+bool filecolumn(const char *input, int family, void *value);
+bool dynamicargument(const char *input);
 int fa_init(void);
+void fa_shard(unsigned int offset, unsigned int stride);
 void fa_close(void);
+bool isrange(const char *input);
+bool rangeargument(const char *input, int family, void *value);
+void range_shard(unsigned int offset, unsigned int stride);
 
 const char * proto_to_name(u_int8_t proto, int nolookup);
 u_int8_t name_to_proto(char *s);
@@ -64,6 +120,39 @@ int outer_header(const char *hdrs, int index, const char *choices);
 int inner_header(const char *hdrs, int index, const char *choices);
 
 extern u_int16_t csumv(u_int16_t *packet[], int packlen[]);
+extern u_int32_t csum_partial(const void *buf, int len, u_int32_t sum, bool *odd);
+extern u_int16_t csum_fold(u_int32_t sum);
+#define CSUM_COVER_MAX	128	/* most pseudo header and header bytes csum_cover() keeps */
+extern u_int32_t csum_partial_copy(void *dst, const void *src, int len,
+                                   u_int32_t sum, bool *odd);
+extern u_int16_t csum_cover(const void *key, const void *pseudo, int plen,
+                            const void *hdr, int hlen, sendip_data *data);
+/* Where csum_cover() got the sum of each region from */
+typedef struct {
+	unsigned long long cover_hits;		/* header and pseudo header unchanged */
+	unsigned long long cover_updates;	/* a few words changed */
+	unsigned long long cover_misses;	/* summed from scratch */
+	unsigned long long data_hits;		/* data unchanged */
+	unsigned long long data_summed;		/* summed as it was copied in */
+	unsigned long long data_misses;		/* read again */
+} csum_stats;
+extern csum_stats csum_counts;
+extern void csum_report(const char *who);
+/* Memory for a packet's headers, all given back before the next packet
+ * (see arena.c). Modules use these for their sendip_data and headers.
+ */
+void *arena_alloc(size_t len);
+void *arena_realloc(void *p, size_t len);
+void arena_free(void *p);
+void arena_reset(void);
+void arena_close(void);
+typedef struct {
+	unsigned long long allocs;		/* served from the arena */
+	unsigned long long heap_allocs;		/* blocks, and anything passed on */
+	unsigned long long first_packet;	/* heap_allocs once it was sent */
+} arena_stats;
+extern arena_stats arena_counts;
+extern void arena_report(const char *who);
 /*@@ end added */
 
 #endif  /* _SENDIP_MODULE_H */
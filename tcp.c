@@ -32,13 +32,9 @@ static void tcpcsum(sendip_data *ip_hdr, sendip_data *tcp_hdr,
                     sendip_data *data) {
 	tcp_header *tcp = (tcp_header *)tcp_hdr->data;
 	ip_header  *ip  = (ip_header *)ip_hdr->data;
-	u_int16_t *buf = malloc(12+tcp_hdr->alloc_len+data->alloc_len);
-	u_int8_t *tempbuf = (u_int8_t *)buf;
+	u_int16_t phdr[6];
+	u_int8_t *tempbuf = (u_int8_t *)phdr;
 	tcp->check=0;
-	if(tempbuf == NULL) {
-		fprintf(stderr,"Out of memory: TCP checksum not computed\n");
-		return;
-	}
 	/* Set up the pseudo header */
 	memcpy(tempbuf,&(ip->saddr),sizeof(u_int32_t));
 	memcpy(&(tempbuf[4]),&(ip->daddr),sizeof(u_int32_t));
@@ -46,12 +42,9 @@ static void tcpcsum(sendip_data *ip_hdr, sendip_data *tcp_hdr,
 	tempbuf[9]=(u_int16_t)ip->protocol;
 	tempbuf[10]=(u_int16_t)((tcp_hdr->alloc_len+data->alloc_len)&0xFF00)>>8;
 	tempbuf[11]=(u_int16_t)((tcp_hdr->alloc_len+data->alloc_len)&0x00FF);
-	/* Copy the TCP header and data */
-	memcpy(tempbuf+12,tcp_hdr->data,tcp_hdr->alloc_len);
-	memcpy(tempbuf+12+tcp_hdr->alloc_len,data->data,data->alloc_len);
-	/* CheckSum it */
-	tcp->check = csum(buf,12+tcp_hdr->alloc_len+data->alloc_len);
-	free(buf);
+	/* CheckSum it, with the TCP header and data where they are */
+	tcp->check = csum_cover(tcp_hdr,phdr,sizeof(phdr),
+	                        tcp_hdr->data,tcp_hdr->alloc_len,data);
 }
 
 static void tcp6csum(sendip_data *ipv6_hdr, sendip_data *tcp_hdr,
@@ -59,14 +52,7 @@ static void tcp6csum(sendip_data *ipv6_hdr, sendip_data *tcp_hdr,
 	tcp_header *tcp = (tcp_header *)tcp_hdr->data;
 	ipv6_header  *ipv6  = (ipv6_header *)ipv6_hdr->data;
 	struct ipv6_pseudo_hdr phdr;
-
-	u_int16_t *buf = malloc(sizeof(phdr)+tcp_hdr->alloc_len+data->alloc_len);
-	u_int8_t *tempbuf = (u_int8_t *)buf;
 	tcp->check=0;
-	if(tempbuf == NULL) {
-		fprintf(stderr,"Out of memory: TCP checksum not computed\n");
-		return;
-	}
 
 	/* Set up the pseudo header */
 	memset(&phdr,0,sizeof(phdr));
@@ -75,20 +61,14 @@ static void tcp6csum(sendip_data *ipv6_hdr, sendip_data *tcp_hdr,
 	phdr.ulp_length=htonl(tcp_hdr->alloc_len+data->alloc_len);
 	phdr.nexthdr=IPPROTO_TCP;
 
-	memcpy(tempbuf,&phdr,sizeof(phdr));
-
-	/* Copy the TCP header and data */
-	memcpy(tempbuf+sizeof(phdr),tcp_hdr->data,tcp_hdr->alloc_len);
-	memcpy(tempbuf+sizeof(phdr)+tcp_hdr->alloc_len,data->data,data->alloc_len);
-
-	/* CheckSum it */
-	tcp->check = csum(buf,sizeof(phdr)+tcp_hdr->alloc_len+data->alloc_len);
-	free(buf);
+	/* CheckSum it, with the TCP header and data where they are */
+	tcp->check = csum_cover(tcp_hdr,&phdr,sizeof(phdr),
+	                        tcp_hdr->data,tcp_hdr->alloc_len,data);
 }
 
 static void addoption(u_int8_t opt, u_int8_t len, u_int8_t *data,
                       sendip_data *pack) {
-	pack->data = realloc(pack->data, pack->alloc_len + len);
+	pack->data = arena_realloc(pack->data, pack->alloc_len + len);
 	*((u_int8_t *)pack->data+pack->alloc_len) = opt;
 	if(len > 1)
 		*((u_int8_t *)pack->data+pack->alloc_len+1)=len;
@@ -98,12 +78,13 @@ static void addoption(u_int8_t opt, u_int8_t len, u_int8_t *data,
 }
 
 sendip_data *initialize(void) {
-	sendip_data *ret = malloc(sizeof(sendip_data));
-	tcp_header *tcp = malloc(sizeof(tcp_header));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
+	tcp_header *tcp = arena_alloc(sizeof(tcp_header));
 	memset(tcp,0,sizeof(tcp_header));
 	ret->alloc_len = sizeof(tcp_header);
 	ret->data = (void *)tcp;
 	ret->modified=0;
+	ret->private=NULL;
 	return ret;
 }
 
@@ -208,7 +189,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 		/* TCP OPTIONS */
 		if(!strcmp(opt+2, "num")) {
 			/* Other options (auto length) */
-			u_int8_t *data = malloc(strlen(arg)+2);
+			u_int8_t *data = arena_alloc(strlen(arg)+2);
 			int len;
 			if(!data) {
 				fprintf(stderr,"Out of memory!\n");
@@ -220,7 +201,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 				addoption(*data,1,NULL,pack);
 			else
 				addoption(*data,len+1,data+1,pack);
-			free(data);
+			arena_free(data);
 		} else if (!strcmp(opt+2, "eol")) {
 			/* End of options list RFC 793 kind 0, no length */
 			addoption(0,1,NULL,pack);
@@ -253,7 +234,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 				if(next) next++;
 			}
 
-			comb = malloc(count*8);
+			comb = arena_alloc(count*8);
 			c = comb;
 
 			next=arg;
@@ -286,7 +267,7 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 				c+=8;
 			}
 			addoption(5,count*8+2,comb,pack);
-			free(comb);
+			arena_free(comb);
 		} else if (!strcmp(opt+2, "ts")) {
 			/* Timestamp rfc1323 */
 			u_int32_t tsval=0, tsecr=0;
@@ -322,71 +303,100 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 
 }
 
-bool finalize(char *hdrs, sendip_data *headers[], int index,
-              sendip_data *data, sendip_data *pack) {
-	tcp_header *tcp = (tcp_header *)pack->data;
-	int i;
+/* Finalize n packets, stride bytes apart, with the enclosing IP header
+ * found once for them all
+ */
+bool finalize_batch(char *hdrs, sendip_data *headers[], int index,
+                    sendip_data data[], sendip_data *pack, int n, int stride) {
+	u_int8_t *at = (u_int8_t *)pack->data;
+	u_int8_t *ipat = NULL;
+	u_int16_t off = (u_int16_t)((pack->alloc_len+3)/4) & 0x0F;
+	char ip = 0;
+	bool setproto = FALSE;
+	int i, k;
 
-	/* Set relevant fields */
-	if(!(pack->modified&TCP_MOD_SEQ)) {
-		tcp->seq = (u_int32_t)rand();
-	}
-	if(!(pack->modified&TCP_MOD_OFF)) {
-		tcp->off = (u_int16_t)((pack->alloc_len+3)/4) & 0x0F;
-	}
-	if(!(pack->modified&TCP_MOD_SYN)) {
-		tcp->syn=1;
+	/* Find enclosing IP header */
+	i = outer_header(hdrs, index, "i6");/*@@*/
+	if(i >= 0) {
+		ip = hdrs[i];
+		ipat = (u_int8_t *)headers[i]->data;
+	} else if(!(pack->modified&TCP_MOD_CHECK)) {
+		usage_error("TCP checksum not defined when TCP is not embedded in IP\n");
+		return FALSE;
 	}
-	if(!(pack->modified&TCP_MOD_WINDOW)) {
-		tcp->window=htons((u_int16_t)65535);
+	if(ip=='i' && !(headers[i]->modified&IP_MOD_PROTOCOL)) {
+		setproto = TRUE;
+		headers[i]->modified |= IP_MOD_PROTOCOL;
 	}
 
-	/* Find enclosing IP header and do the checksum */
-	i = outer_header(hdrs, index, "i6");/*@@*/
-	if(hdrs[i]=='i') {
-		unsigned int old_daddr = 0;
-		if(!(headers[i]->modified&IP_MOD_PROTOCOL)) {
-			((ip_header *)(headers[i]->data))->protocol=IPPROTO_TCP;
-			headers[i]->modified |= IP_MOD_PROTOCOL;
-		}
-		//replace ip daddr
-		if((headers[i]->modified & IP_MOD_ROUTE_DADDR)) {
-			old_daddr=((ip_header *)(headers[i]->data))->daddr;
-			((ip_header *)(headers[i]->data))->daddr=headers[i]->route_daddr;
+	for(k=0; k<n; k++) {
+		tcp_header *tcp = (tcp_header *)(at+k*stride);
+
+		pack->data = tcp;
+		if(ip) headers[i]->data = ipat+k*stride;
+
+		/* Set relevant fields */
+		if(!(pack->modified&TCP_MOD_SEQ)) {
+			tcp->seq = random32();
 		}
-		if(!(pack->modified&TCP_MOD_CHECK)) {
-			tcpcsum(headers[i],pack,data);
+		if(!(pack->modified&TCP_MOD_OFF)) {
+			tcp->off = off;
 		}
-		//restore ip daddr
-		if((headers[i]->modified & IP_MOD_ROUTE_DADDR)) {
-			((ip_header *)(headers[i]->data))->daddr=old_daddr;
+		if(!(pack->modified&TCP_MOD_SYN)) {
+			tcp->syn=1;
 		}
-	} else if(hdrs[i]=='6') {
-		// @@ This is subsumed by my new code which determines the
-		// next header type in the ipv6 module.
-		//if(!(headers[i]->modified&IPV6_MOD_NXT)) {
-		//	((ipv6_header *)(headers[i]->data))->ip6_nxt=IPPROTO_TCP;
-		//	headers[i]->modified |= IPV6_MOD_NXT;
-		//}
-		if(!(pack->modified&TCP_MOD_CHECK)) {
-			tcp6csum(headers[i],pack,data);
+		if(!(pack->modified&TCP_MOD_WINDOW)) {
+			tcp->window=htons((u_int16_t)65535);
 		}
-	} else {
-		if(!(pack->modified&TCP_MOD_CHECK)) {
-			usage_error("TCP checksum not defined when TCP is not embedded in IP\n");
-			return FALSE;
+
+		/* And the checksum */
+		if(ip=='i') {
+			unsigned int old_daddr = 0;
+			if(setproto) {
+				((ip_header *)(headers[i]->data))->protocol=IPPROTO_TCP;
+			}
+			//replace ip daddr
+			if((headers[i]->modified & IP_MOD_ROUTE_DADDR)) {
+				old_daddr=((ip_header *)(headers[i]->data))->daddr;
+				((ip_header *)(headers[i]->data))->daddr=headers[i]->route_daddr;
+			}
+			if(!(pack->modified&TCP_MOD_CHECK)) {
+				tcpcsum(headers[i],pack,&data[k]);
+			}
+			//restore ip daddr
+			if((headers[i]->modified & IP_MOD_ROUTE_DADDR)) {
+				((ip_header *)(headers[i]->data))->daddr=old_daddr;
+			}
+		} else if(ip=='6') {
+			// @@ This is subsumed by my new code which determines the
+			// next header type in the ipv6 module.
+			if(!(pack->modified&TCP_MOD_CHECK)) {
+				tcp6csum(headers[i],pack,&data[k]);
+			}
 		}
 	}
-
+	pack->data = at;
+	if(ip) headers[i]->data = ipat;
 	return TRUE;
 }
 
+bool finalize(char *hdrs, sendip_data *headers[], int index,
+              sendip_data *data, sendip_data *pack) {
+	return finalize_batch(hdrs, headers, index, data, pack, 1, 0);
+}
+
 int num_opts() {
 	return sizeof(tcp_opts)/sizeof(sendip_option);
 }
 sendip_option *get_opts() {
 	return tcp_opts;
 }
+int num_fields() {
+	return sizeof(tcp_fields)/sizeof(sendip_field);
+}
+sendip_field *get_fields() {
+	return tcp_fields;
+}
 char get_optchar() {
 	return opt_char;
 }
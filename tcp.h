@@ -67,6 +67,7 @@ typedef struct {
 #define TCP_MOD_CHECK  1<<15
 #define TCP_MOD_URGPTR 1<<16
 
+#ifndef _SENDIP_MAIN
 /* Options
  */
 sendip_option tcp_opts[] = {
@@ -97,4 +98,16 @@ sendip_option tcp_opts[] = {
 	{"ots",1,"TCP option: timestamp (rfc1323), format is tsval:tsecr", NULL }
 };
 
+/* Options sendip may set without calling do_opt. Not -ta or -tu, which
+ * also set a flag, nor -tt or -tr, which are bitfields.
+ */
+sendip_field tcp_fields[] = {
+	{"s",offsetof(tcp_header,source),2,SENDIP_FIELD_NET,TCP_MOD_SOURCE},
+	{"d",offsetof(tcp_header,dest),2,SENDIP_FIELD_NET,TCP_MOD_DEST},
+	{"n",offsetof(tcp_header,seq),4,SENDIP_FIELD_NET,TCP_MOD_SEQ},
+	{"w",offsetof(tcp_header,window),2,SENDIP_FIELD_NET,TCP_MOD_WINDOW},
+	{"c",offsetof(tcp_header,check),2,SENDIP_FIELD_NET,TCP_MOD_CHECK}
+};
+#endif  /* _SENDIP_MAIN */
+
 #endif  /* _SENDIP_TCP_H */
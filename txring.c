@@ -0,0 +1,222 @@
+/* txring.c - PF_PACKET transmit ring backend for sendip
+ * Rather than one sendto() (and one copy into the kernel) per packet,
+ * finished packets are written, behind an Ethernet header, straight
+ * into a PACKET_TX_RING shared with the kernel. The kernel is only
+ * kicked once every batch of frames (--batch, default TXRING_KICK).
+ *
+ * The ring uses TPACKET_V3 with fixed size frames, set up when the
+ * first packet arrives. The frames are sized for the interface's MTU,
+ * the most the kernel will put on the wire from a ring, and there are
+ * as many of them as fit in TXRING_MAX bytes, up to TXRING_FRAMES. A
+ * packet too big for a frame is handed back (TXRING_TOO_BIG) for
+ * xmit_send() to send through an ordinary raw socket.
+ *
+ * Linux only. Works on any interface with an Ethernet style header,
+ * such as veth pairs. Frames put on loopback are seen by sniffers but
+ * are not delivered to local sockets.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "sendip_module.h"
+#include "xmit.h"
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+#define TXRING_FRAMES	1024	/* most frames in the ring */
+#define TXRING_MAX	(8<<20)	/* most bytes in the ring */
+#define TXRING_MTU	1500	/* if the interface won't say */
+#define TXRING_KICK	64	/* frames between kicks without --batch */
+#define TXRING_BLOCK	(1<<16)	/* minimum ring block size */
+
+/* Packet data starts right after the (aligned) frame header */
+#define TXRING_DATA	TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+
+static int txring_open(xmit_ctx *ctx) {
+	struct tpacket_req3 req;
+	struct sockaddr_ll ll;
+	struct ifreq ifr;
+	int mtu = TXRING_MTU;
+	int version = TPACKET_V3;
+	int loss = 1;
+	unsigned int ifindex;
+	int s;
+
+	if(!ctx->ifname || !(ifindex = if_nametoindex(ctx->ifname))) {
+		fprintf(stderr,"Packet transmit needs a valid interface (--iface)\n");
+		return -1;
+	}
+
+	/* Protocol 0: we never want to receive anything on this socket */
+	if((s = socket(PF_PACKET, SOCK_RAW, 0)) < 0) {
+		perror("Couldn't open PF_PACKET socket");
+		return -1;
+	}
+	if(setsockopt(s, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		perror("Couldn't setsockopt PACKET_VERSION");
+		close(s);
+		return -1;
+	}
+	if(!ctx->ether_src)
+		xmit_ether_src(ctx, s);
+	/* Skip malformed frames rather than stopping the ring */
+	(void)setsockopt(s, SOL_PACKET, PACKET_LOSS, &loss, sizeof(loss));
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ctx->ifname, IFNAMSIZ-1);
+	if(ioctl(s, SIOCGIFMTU, &ifr) == 0 && ifr.ifr_mtu > 0)
+		mtu = ifr.ifr_mtu;
+	for(ctx->frame_size=2048;
+	    ctx->frame_size < TXRING_DATA+ETH_HLEN+mtu; ctx->frame_size<<=1)
+		;
+	ctx->ring_frames = TXRING_MAX/ctx->frame_size;
+	if(ctx->ring_frames > TXRING_FRAMES)
+		ctx->ring_frames = TXRING_FRAMES;
+	memset(&req, 0, sizeof(req));
+	req.tp_frame_size = ctx->frame_size;
+	req.tp_frame_nr = ctx->ring_frames;
+	req.tp_block_size = ctx->frame_size > TXRING_BLOCK ?
+	                    ctx->frame_size : TXRING_BLOCK;
+	req.tp_block_nr = ((size_t)ctx->ring_frames*ctx->frame_size)/req.tp_block_size;
+	if(setsockopt(s, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+		perror("Couldn't setsockopt PACKET_TX_RING");
+		close(s);
+		return -1;
+	}
+	ctx->ring_len = (size_t)req.tp_block_size*req.tp_block_nr;
+	ctx->ring = mmap(NULL, ctx->ring_len, PROT_READ|PROT_WRITE, MAP_SHARED,
+	                 s, 0);
+	if(ctx->ring == MAP_FAILED) {
+		perror("Couldn't mmap transmit ring");
+		ctx->ring = NULL;
+		close(s);
+		return -1;
+	}
+
+	memset(&ll, 0, sizeof(ll));
+	ll.sll_family = AF_PACKET;
+	ll.sll_ifindex = ifindex;
+	if(bind(s, (struct sockaddr *)&ll, sizeof(ll)) < 0) {
+		perror("Couldn't bind to interface");
+		munmap(ctx->ring, ctx->ring_len);
+		ctx->ring = NULL;
+		close(s);
+		return -1;
+	}
+
+	ctx->ring_fd = s;
+	ctx->ring_next = 0;
+	ctx->ring_pending = 0;
+	if(ctx->verbose)
+		fprintf(stderr, "Transmit ring on %s: %d frames of %d bytes\n",
+		        ctx->ifname, ctx->ring_frames, ctx->frame_size);
+	return 0;
+}
+
+/* Tell the kernel to send whatever frames are ready. If wait is set,
+ * don't return until it has.
+ */
+int txring_flush(xmit_ctx *ctx, bool wait) {
+	int ret;
+
+	if(!ctx->ring) return 0;
+	if(!ctx->ring_pending && !wait) return 0;
+	do {
+		ret = send(ctx->ring_fd, NULL, 0, wait ? 0 : MSG_DONTWAIT);
+	} while(ret < 0 && errno == EINTR);
+	ctx->stats.calls++;
+	if(ret < 0 && errno != EAGAIN && errno != ENOBUFS) {
+		perror("Couldn't kick transmit ring");
+		return -1;
+	}
+	ctx->ring_pending = 0;
+	return 0;
+}
+
+int txring_queue(xmit_ctx *ctx, sendip_data *data, int af_type) {
+	volatile struct tpacket3_hdr *hdr;
+	u_int8_t *frame;
+	struct pollfd pfd;
+
+	if(!ctx->ring && txring_open(ctx) < 0) {
+		ctx->stats.errors++;
+		return -1;
+	}
+	if(TXRING_DATA+ETH_HLEN+data->alloc_len > ctx->frame_size) {
+		/* Send what's before it first, to keep them in order */
+		txring_flush(ctx, TRUE);
+		return TXRING_TOO_BIG;
+	}
+
+	frame = (u_int8_t *)ctx->ring + (size_t)ctx->ring_next*ctx->frame_size;
+	hdr = (volatile struct tpacket3_hdr *)frame;
+
+	/* Wait for the kernel to give the frame back */
+	while(hdr->tp_status & (TP_STATUS_SEND_REQUEST|TP_STATUS_SENDING)) {
+		txring_flush(ctx, FALSE);
+		pfd.fd = ctx->ring_fd;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+		if(poll(&pfd, 1, 100) < 0 && errno != EINTR) {
+			perror("poll");
+			ctx->stats.errors++;
+			return -1;
+		}
+	}
+	if(hdr->tp_status & TP_STATUS_WRONG_FORMAT)
+		ctx->stats.errors++;
+
+	xmit_ethertype(ctx, af_type);
+	memcpy(frame+TXRING_DATA, ctx->ether, ETH_HLEN);
+	memcpy(frame+TXRING_DATA+ETH_HLEN, data->data, data->alloc_len);
+	hdr->tp_len = ETH_HLEN+data->alloc_len;
+	hdr->tp_next_offset = 0;
+	__sync_synchronize();
+	hdr->tp_status = TP_STATUS_SEND_REQUEST;
+
+	ctx->stats.packets++;
+	ctx->stats.bytes += data->alloc_len;
+	if(++ctx->ring_next == ctx->ring_frames)
+		ctx->ring_next = 0;
+	if(++ctx->ring_pending >= (ctx->batch ? ctx->batch : TXRING_KICK))
+		txring_flush(ctx, FALSE);
+	return data->alloc_len;
+}
+
+void txring_close(xmit_ctx *ctx) {
+	if(!ctx->ring) return;
+	txring_flush(ctx, TRUE);
+	munmap(ctx->ring, ctx->ring_len);
+	close(ctx->ring_fd);
+	ctx->ring = NULL;
+	ctx->ring_fd = -1;
+}
+
+#else /* !__linux__ */
+
+int txring_queue(xmit_ctx *ctx, sendip_data *data, int af_type) {
+	fprintf(stderr,"Packet transmit ring is only available on Linux\n");
+	ctx->stats.errors++;
+	return -1;
+}
+
+int txring_flush(xmit_ctx *ctx, bool wait) {
+	return 0;
+}
+
+void txring_close(xmit_ctx *ctx) {
+}
+
+#endif /* __linux__ */
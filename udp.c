@@ -25,13 +25,9 @@ static void udpcsum(sendip_data *ip_hdr, sendip_data *udp_hdr,
                     sendip_data *data) {
 	udp_header *udp = (udp_header *)udp_hdr->data;
 	ip_header  *ip  = (ip_header *)ip_hdr->data;
-	u_int16_t *buf = malloc(12+udp_hdr->alloc_len+data->alloc_len);
-	u_int8_t *tempbuf = (u_int8_t *)buf;
+	u_int16_t phdr[6];
+	u_int8_t *tempbuf = (u_int8_t *)phdr;
 	udp->check=0;
-	if(tempbuf == NULL) {
-		fprintf(stderr,"Out of memory: UDP checksum not computed\n");
-		return;
-	}
 	/* Set up the pseudo header */
 	memcpy(tempbuf,&(ip->saddr),sizeof(u_int32_t));
 	memcpy(&(tempbuf[4]),&(ip->daddr),sizeof(u_int32_t));
@@ -39,12 +35,9 @@ static void udpcsum(sendip_data *ip_hdr, sendip_data *udp_hdr,
 	tempbuf[9]=(u_int16_t)ip->protocol;
 	tempbuf[10]=(u_int16_t)((udp_hdr->alloc_len+data->alloc_len)&0xFF00)>>8;
 	tempbuf[11]=(u_int16_t)((udp_hdr->alloc_len+data->alloc_len)&0x00FF);
-	/* Copy the UDP header and data */
-	memcpy(tempbuf+12,udp_hdr->data,udp_hdr->alloc_len);
-	memcpy(tempbuf+12+udp_hdr->alloc_len,data->data,data->alloc_len);
-	/* CheckSum it */
-	udp->check = csum(buf,12+udp_hdr->alloc_len+data->alloc_len);
-	free(buf);
+	/* CheckSum it, with the UDP header and data where they are */
+	udp->check = csum_cover(udp_hdr,phdr,sizeof(phdr),
+	                        udp_hdr->data,udp_hdr->alloc_len,data);
 }
 
 static void udp6csum(sendip_data *ipv6_hdr, sendip_data *udp_hdr,
@@ -52,14 +45,7 @@ static void udp6csum(sendip_data *ipv6_hdr, sendip_data *udp_hdr,
 	udp_header *udp = (udp_header *)udp_hdr->data;
 	ipv6_header  *ipv6  = (ipv6_header *)ipv6_hdr->data;
 	struct ipv6_pseudo_hdr phdr;
-
-	u_int16_t *buf = malloc(sizeof(phdr)+udp_hdr->alloc_len+data->alloc_len);
-	u_int8_t *tempbuf = (u_int8_t *)buf;
 	udp->check=0;
-	if(tempbuf == NULL) {
-		fprintf(stderr,"Out of memory: UDP checksum not computed\n");
-		return;
-	}
 
 	/* Set up the pseudo header */
 	memset(&phdr,0,sizeof(phdr));
@@ -68,24 +54,19 @@ static void udp6csum(sendip_data *ipv6_hdr, sendip_data *udp_hdr,
 	phdr.ulp_length=htonl(udp_hdr->alloc_len+data->alloc_len);
 	phdr.nexthdr=IPPROTO_UDP;
 
-	memcpy(tempbuf,&phdr,sizeof(phdr));
-
-	/* Copy the UDP header and data */
-	memcpy(tempbuf+sizeof(phdr),udp_hdr->data,udp_hdr->alloc_len);
-	memcpy(tempbuf+sizeof(phdr)+udp_hdr->alloc_len,data->data,data->alloc_len);
-
-	/* CheckSum it */
-	udp->check = csum(buf,sizeof(phdr)+udp_hdr->alloc_len+data->alloc_len);
-	free(buf);
+	/* CheckSum it, with the UDP header and data where they are */
+	udp->check = csum_cover(udp_hdr,&phdr,sizeof(phdr),
+	                        udp_hdr->data,udp_hdr->alloc_len,data);
 }
 
 sendip_data *initialize(void) {
-	sendip_data *ret = malloc(sizeof(sendip_data));
-	udp_header *udp = malloc(sizeof(udp_header));
+	sendip_data *ret = arena_alloc(sizeof(sendip_data));
+	udp_header *udp = arena_alloc(sizeof(udp_header));
 	memset(udp,0,sizeof(udp_header));
 	ret->alloc_len = sizeof(udp_header);
 	ret->data = (void *)udp;
 	ret->modified=0;
+	ret->private=NULL;
 	return ret;
 }
 
@@ -117,63 +98,91 @@ bool do_opt(char *opt, char *arg, sendip_data *pack) {
 
 }
 
-bool finalize(char *hdrs, sendip_data *headers[], int index,
-              sendip_data *data, sendip_data *pack) {
-	udp_header *udp = (udp_header *)pack->data;
-	int i;
-
-	/* Set relevant fields */
-	if(!(pack->modified&UDP_MOD_LEN)) {
-		udp->len=htons(pack->alloc_len+data->alloc_len);
+/* Finalize n packets, stride bytes apart, with the enclosing IP header
+ * found once for them all
+ */
+bool finalize_batch(char *hdrs, sendip_data *headers[], int index,
+                    sendip_data data[], sendip_data *pack, int n, int stride) {
+	u_int8_t *at = (u_int8_t *)pack->data;
+	u_int8_t *ipat = NULL;
+	u_int16_t len = htons(pack->alloc_len+data[0].alloc_len);
+	char ip = 0;
+	bool setproto = FALSE;
+	int i, k;
+
+	/* Find enclosing IP header */
+	i = outer_header(hdrs, index, "i6");/*@@*/
+	if(i >= 0) {
+		ip = hdrs[i];
+		ipat = (u_int8_t *)headers[i]->data;
+	} else if(!(pack->modified&UDP_MOD_CHECK)) {
+		usage_error("UDP checksum not defined when UDP is not embedded in IP\n");
+		return FALSE;
+	}
+	if(ip=='i' && !(headers[i]->modified&IP_MOD_PROTOCOL)) {
+		setproto = TRUE;
+		headers[i]->modified |= IP_MOD_PROTOCOL;
 	}
 
-	/* Find enclosing IP header and do the checksum */
-	i = outer_header(hdrs, index, "i6");/*@@*/
-	if(hdrs[i]=='i') {
-		unsigned int old_daddr = 0;
-		if(!(headers[i]->modified&IP_MOD_PROTOCOL)) {
-			((ip_header *)(headers[i]->data))->protocol=IPPROTO_UDP;
-			headers[i]->modified |= IP_MOD_PROTOCOL;
-		}
-		//replace ip daddr
-		if((headers[i]->modified & IP_MOD_ROUTE_DADDR)) {
-			old_daddr=((ip_header *)(headers[i]->data))->daddr;
-			((ip_header *)(headers[i]->data))->daddr=headers[i]->route_daddr;
-		}
-		if(!(pack->modified&UDP_MOD_CHECK)) {
-			udpcsum(headers[i],pack,data);
-		}
-		//restore ip daddr
-		if((headers[i]->modified & IP_MOD_ROUTE_DADDR)) {
-			((ip_header *)(headers[i]->data))->daddr=old_daddr;
-		}
-	} else if(hdrs[i]=='6') {
-		// @@ This is subsumed by my new code which determines the
-		// next header type in the ipv6 module.
-		//if(!(headers[i]->modified&IPV6_MOD_NXT)) {
-		//	((ipv6_header *)(headers[i]->data))->ip6_nxt=IPPROTO_UDP;
-		//	headers[i]->modified |= IPV6_MOD_NXT;
-		//}
-		if(!(pack->modified&UDP_MOD_CHECK)) {
-			udp6csum(headers[i],pack,data);
+	for(k=0; k<n; k++) {
+		udp_header *udp = (udp_header *)(at+k*stride);
+
+		pack->data = udp;
+		if(ip) headers[i]->data = ipat+k*stride;
+
+		/* Set relevant fields */
+		if(!(pack->modified&UDP_MOD_LEN)) {
+			udp->len=len;
 		}
 
-	} else {
-		if(!(pack->modified&UDP_MOD_CHECK)) {
-			usage_error("UDP checksum not defined when UDP is not embedded in IP\n");
-			return FALSE;
+		/* And the checksum */
+		if(ip=='i') {
+			unsigned int old_daddr = 0;
+			if(setproto) {
+				((ip_header *)(headers[i]->data))->protocol=IPPROTO_UDP;
+			}
+			//replace ip daddr
+			if((headers[i]->modified & IP_MOD_ROUTE_DADDR)) {
+				old_daddr=((ip_header *)(headers[i]->data))->daddr;
+				((ip_header *)(headers[i]->data))->daddr=headers[i]->route_daddr;
+			}
+			if(!(pack->modified&UDP_MOD_CHECK)) {
+				udpcsum(headers[i],pack,&data[k]);
+			}
+			//restore ip daddr
+			if((headers[i]->modified & IP_MOD_ROUTE_DADDR)) {
+				((ip_header *)(headers[i]->data))->daddr=old_daddr;
+			}
+		} else if(ip=='6') {
+			// @@ This is subsumed by my new code which determines the
+			// next header type in the ipv6 module.
+			if(!(pack->modified&UDP_MOD_CHECK)) {
+				udp6csum(headers[i],pack,&data[k]);
+			}
 		}
 	}
-
+	pack->data = at;
+	if(ip) headers[i]->data = ipat;
 	return TRUE;
 }
 
+bool finalize(char *hdrs, sendip_data *headers[], int index,
+              sendip_data *data, sendip_data *pack) {
+	return finalize_batch(hdrs, headers, index, data, pack, 1, 0);
+}
+
 int num_opts() {
 	return sizeof(udp_opts)/sizeof(sendip_option);
 }
 sendip_option *get_opts() {
 	return udp_opts;
 }
+int num_fields() {
+	return sizeof(udp_fields)/sizeof(sendip_field);
+}
+sendip_field *get_fields() {
+	return udp_fields;
+}
 char get_optchar() {
 	return opt_char;
 }
@@ -19,6 +19,7 @@ typedef struct {
 #define UDP_MOD_LEN     1<<2
 #define UDP_MOD_CHECK   1<<3
 
+#ifndef _SENDIP_MAIN
 /* Options
  */
 sendip_option udp_opts[] = {
@@ -28,4 +29,14 @@ sendip_option udp_opts[] = {
 	{"c",1,"UDP checksum","Correct"}
 };
 
+/* Options sendip may set without calling do_opt
+ */
+sendip_field udp_fields[] = {
+	{"s",offsetof(udp_header,source),2,SENDIP_FIELD_NET,UDP_MOD_SOURCE},
+	{"d",offsetof(udp_header,dest),2,SENDIP_FIELD_NET,UDP_MOD_DEST},
+	{"l",offsetof(udp_header,len),2,SENDIP_FIELD_NET,UDP_MOD_LEN},
+	{"c",offsetof(udp_header,check),2,SENDIP_FIELD_NET,UDP_MOD_CHECK}
+};
+#endif  /* _SENDIP_MAIN */
+
 #endif  /* _SENDIP_UDP_H */
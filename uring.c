@@ -0,0 +1,403 @@
+/* uring.c - io_uring transmit backend for sendip
+ * Packets go out through the usual raw sockets, but rather than
+ * blocking in sendto() for each one they are copied into a slot and
+ * an IORING_OP_SENDMSG request for them is queued. Requests are
+ * submitted once every batch of packets (--batch, default URING_KICK),
+ * and completions are reaped as they turn up, so building the next
+ * packets overlaps with the kernel sending the last ones. A slot is
+ * only reused once its completion has been seen.
+ *
+ * The slots are sized for the first packet, rounded up to a power of
+ * two, rather than for the biggest packet there could be; a bigger one
+ * later waits for everything in flight and then has the slots grown
+ * to fit it.
+ *
+ * The raw sockets are registered as fixed files, so the kernel doesn't
+ * have to look them up for every request.
+ *
+ * Linux only, and needs a 5.5 or later kernel.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "sendip_module.h"
+#include "xmit.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#define URING_DEPTH	256	/* minimum slots (and ring entries) */
+#define URING_KICK	32	/* packets between submits without --batch */
+#define URING_SLOT	2048	/* minimum slot size */
+
+/* One packet in flight */
+typedef struct {
+	struct msghdr msg;
+	struct iovec iov;
+	char *buf;		/* slot_size bytes in the arena */
+} uring_slot;
+
+typedef struct {
+	int fd;
+	unsigned int depth;
+	int files[2];		/* registered raw sockets: AF_INET, AF_INET6 */
+
+	/* submission ring */
+	void *sq_map;
+	size_t sq_map_len;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	unsigned int sq_local;	/* our copy of the tail */
+
+	/* completion ring */
+	void *cq_map;
+	size_t cq_map_len;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	char *arena;
+	unsigned int slot_size;
+	uring_slot *slots;
+	unsigned int *free;	/* indices of slots not in flight */
+	unsigned int nfree;
+	unsigned int pending;	/* requests queued but not submitted */
+} uring_state;
+
+static int uring_enter(uring_state *u, unsigned int submit,
+                       unsigned int wait) {
+	return syscall(__NR_io_uring_enter, u->fd, submit, wait,
+	               wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static void uring_free(uring_state *u) {
+	if(u->sqes) munmap(u->sqes, u->sqes_len);
+	if(u->cq_map && u->cq_map != u->sq_map) munmap(u->cq_map, u->cq_map_len);
+	if(u->sq_map) munmap(u->sq_map, u->sq_map_len);
+	if(u->fd >= 0) close(u->fd);
+	free(u->arena);
+	free(u->slots);
+	free(u->free);
+	free(u);
+}
+
+static int uring_submit(xmit_ctx *ctx, uring_state *u, unsigned int wait);
+
+/* Make the slots big enough for pktlen bytes. Nothing can be in flight
+ * while the arena moves, so anything that is gets waited for first.
+ */
+static int uring_slots(xmit_ctx *ctx, uring_state *u, int pktlen) {
+	unsigned int size;
+	unsigned int i;
+	char *arena;
+
+	for(size=URING_SLOT; size < pktlen; size<<=1)
+		;
+	if(u->nfree < u->depth && uring_submit(ctx, u, 0) < 0)
+		return -1;
+	while(u->nfree < u->depth) {
+		if(uring_submit(ctx, u, u->depth-u->nfree) < 0)
+			return -1;
+	}
+	if((arena = realloc(u->arena, (size_t)u->depth*size)) == NULL) {
+		perror("OUT OF MEMORY!\n");
+		return -1;
+	}
+	u->arena = arena;
+	u->slot_size = size;
+	for(i=0; i<u->depth; i++) {
+		u->slots[i].buf = u->arena+(size_t)i*size;
+		u->slots[i].iov.iov_base = u->slots[i].buf;
+	}
+	if(ctx->verbose)
+		fprintf(stderr, "io_uring transmit: %u slots of %u bytes\n",
+		        u->depth, size);
+	return 0;
+}
+
+static uring_state *uring_open(xmit_ctx *ctx) {
+	uring_state *u;
+	struct io_uring_params p;
+	unsigned int i;
+
+	if((u = malloc(sizeof(uring_state))) == NULL) {
+		perror("OUT OF MEMORY!\n");
+		return NULL;
+	}
+	memset(u, 0, sizeof(uring_state));
+	for(u->depth=URING_DEPTH; u->depth < ctx->batch; u->depth<<=1)
+		;
+	u->files[0] = u->files[1] = -1;
+
+	memset(&p, 0, sizeof(p));
+	if((u->fd = syscall(__NR_io_uring_setup, u->depth, &p)) < 0) {
+		perror("Couldn't set up io_uring");
+		u->fd = -1;
+		uring_free(u);
+		return NULL;
+	}
+
+	u->sq_map_len = p.sq_off.array + p.sq_entries*sizeof(unsigned int);
+	u->cq_map_len = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		if(u->cq_map_len > u->sq_map_len)
+			u->sq_map_len = u->cq_map_len;
+	}
+	u->sq_map = mmap(NULL, u->sq_map_len, PROT_READ|PROT_WRITE,
+	                 MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if(u->sq_map == MAP_FAILED) {
+		u->sq_map = NULL;
+		perror("Couldn't mmap io_uring");
+		uring_free(u);
+		return NULL;
+	}
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_map = u->sq_map;
+	} else {
+		u->cq_map = mmap(NULL, u->cq_map_len, PROT_READ|PROT_WRITE,
+		                 MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if(u->cq_map == MAP_FAILED) {
+			u->cq_map = NULL;
+			perror("Couldn't mmap io_uring");
+			uring_free(u);
+			return NULL;
+		}
+	}
+	u->sqes_len = p.sq_entries*sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ|PROT_WRITE,
+	               MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if(u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		perror("Couldn't mmap io_uring");
+		uring_free(u);
+		return NULL;
+	}
+	u->sq_tail = (unsigned int *)((char *)u->sq_map + p.sq_off.tail);
+	u->sq_mask = (unsigned int *)((char *)u->sq_map + p.sq_off.ring_mask);
+	u->sq_array = (unsigned int *)((char *)u->sq_map + p.sq_off.array);
+	u->cq_head = (unsigned int *)((char *)u->cq_map + p.cq_off.head);
+	u->cq_tail = (unsigned int *)((char *)u->cq_map + p.cq_off.tail);
+	u->cq_mask = (unsigned int *)((char *)u->cq_map + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_map + p.cq_off.cqes);
+	u->sq_local = *u->sq_tail;
+
+	/* Both slots start out empty and get filled in as sockets open */
+	if(syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_FILES,
+	           u->files, 2) < 0) {
+		perror("Couldn't register files with io_uring");
+		uring_free(u);
+		return NULL;
+	}
+
+	/* The arena itself comes with the first packet (uring_slots()) */
+	u->slots = calloc(u->depth, sizeof(uring_slot));
+	u->free = malloc(u->depth*sizeof(unsigned int));
+	if(!u->slots || !u->free) {
+		perror("OUT OF MEMORY!\n");
+		uring_free(u);
+		return NULL;
+	}
+	for(i=0; i<u->depth; i++) {
+		u->slots[i].msg.msg_iov = &u->slots[i].iov;
+		u->slots[i].msg.msg_iovlen = 1;
+		u->free[i] = u->depth-1-i;
+	}
+	u->nfree = u->depth;
+	return u;
+}
+
+/* Make sure the raw socket for af_type is in the fixed file table,
+ * and return its index there.
+ */
+static int uring_file(xmit_ctx *ctx, uring_state *u, int af_type) {
+	struct io_uring_files_update up;
+	int idx = (af_type == AF_INET6) ? 1 : 0;
+	int s;
+
+	if((s = xmit_socket(ctx, af_type)) < 0) return -1;
+	if(u->files[idx] == s) return idx;
+	memset(&up, 0, sizeof(up));
+	up.offset = idx;
+	up.fds = (unsigned long)&s;
+	if(syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_FILES_UPDATE,
+	           &up, 1) < 0) {
+		perror("Couldn't register socket with io_uring");
+		return -1;
+	}
+	u->files[idx] = s;
+	return idx;
+}
+
+/* Count up whatever has completed, and free the slots */
+static void uring_reap(xmit_ctx *ctx, uring_state *u) {
+	unsigned int head = *u->cq_head;
+	unsigned int tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	struct io_uring_cqe *cqe;
+	uring_slot *slot;
+
+	while(head != tail) {
+		cqe = &u->cqes[head & *u->cq_mask];
+		slot = &u->slots[cqe->user_data];
+		if(cqe->res == (int)slot->iov.iov_len) {
+			ctx->stats.packets++;
+			ctx->stats.bytes += cqe->res;
+		} else {
+			ctx->stats.errors++;
+			if(cqe->res < 0) {
+				errno = -cqe->res;
+				perror("sendmsg");
+			} else if(ctx->verbose) {
+				fprintf(stderr, "Only sent %d of %d bytes\n",
+				        cqe->res, (int)slot->iov.iov_len);
+			}
+		}
+		u->free[u->nfree++] = cqe->user_data;
+		head++;
+	}
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Submit the queued requests, waiting for at least wait of the ones in
+ * flight to complete
+ */
+static int uring_submit(xmit_ctx *ctx, uring_state *u, unsigned int wait) {
+	int ret;
+
+	__atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+	while(u->pending || wait) {
+		ret = uring_enter(u, u->pending, wait);
+		ctx->stats.calls++;
+		if(ret < 0) {
+			if(errno == EINTR) continue;
+			if(errno == EAGAIN || errno == EBUSY) {
+				/* Out of resources: let something complete */
+				uring_reap(ctx, u);
+				wait = 1;
+				continue;
+			}
+			perror("io_uring_enter");
+			return -1;
+		}
+		u->pending -= ret;
+		wait = 0;
+	}
+	uring_reap(ctx, u);
+	return 0;
+}
+
+int uring_flush(xmit_ctx *ctx) {
+	uring_state *u = (uring_state *)ctx->uring;
+
+	if(!u) return 0;
+	return uring_submit(ctx, u, 0);
+}
+
+int uring_queue(xmit_ctx *ctx, sendip_data *data, const char *hostname,
+                int af_type) {
+	uring_state *u = (uring_state *)ctx->uring;
+	struct io_uring_sqe *sqe;
+	uring_slot *slot;
+	xmit_dest *dest;
+	unsigned int idx;
+	int file;
+
+	if(!u && (ctx->uring = u = uring_open(ctx)) == NULL) {
+		ctx->stats.errors++;
+		return -1;
+	}
+	if((dest = xmit_lookup(ctx, hostname, af_type)) == NULL ||
+	   (file = uring_file(ctx, u, af_type)) < 0) {
+		ctx->stats.errors++;
+		return -1;
+	}
+	if(data->alloc_len > XMIT_SLOT) {
+		fprintf(stderr,"Packet of %d bytes too big for io_uring\n",
+		        data->alloc_len);
+		ctx->stats.errors++;
+		return -1;
+	}
+	if(data->alloc_len > u->slot_size &&
+	   uring_slots(ctx, u, data->alloc_len) < 0) {
+		ctx->stats.errors++;
+		return -1;
+	}
+
+	/* Every slot in flight: wait for one to come back */
+	if(!u->nfree) uring_reap(ctx, u);
+	while(!u->nfree) {
+		if(uring_submit(ctx, u, 1) < 0) {
+			ctx->stats.errors++;
+			return -1;
+		}
+	}
+
+	idx = u->free[--u->nfree];
+	slot = &u->slots[idx];
+	memcpy(slot->buf, data->data, data->alloc_len);
+	slot->iov.iov_len = data->alloc_len;
+	slot->msg.msg_name = (void *)&dest->to;
+	slot->msg.msg_namelen = dest->tolen;
+
+	sqe = &u->sqes[u->sq_local & *u->sq_mask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = file;
+	sqe->addr = (unsigned long)&slot->msg;
+	sqe->len = 1;
+	sqe->user_data = idx;
+	u->sq_array[u->sq_local & *u->sq_mask] = u->sq_local & *u->sq_mask;
+	u->sq_local++;
+
+	if(++u->pending >= (ctx->batch ? ctx->batch : URING_KICK))
+		uring_submit(ctx, u, 0);
+	return data->alloc_len;
+}
+
+void uring_close(xmit_ctx *ctx) {
+	uring_state *u = (uring_state *)ctx->uring;
+
+	if(!u) return;
+	/* Everything has to complete before the slots can go */
+	uring_submit(ctx, u, 0);
+	while(u->nfree < u->depth) {
+		if(uring_submit(ctx, u, u->depth-u->nfree) < 0)
+			break;
+	}
+	uring_free(u);
+	ctx->uring = NULL;
+}
+
+#else /* no io_uring */
+
+int uring_queue(xmit_ctx *ctx, sendip_data *data, const char *hostname,
+                int af_type) {
+	fprintf(stderr,"io_uring transmit is only available on Linux\n");
+	ctx->stats.errors++;
+	return -1;
+}
+
+int uring_flush(xmit_ctx *ctx) {
+	return 0;
+}
+
+void uring_close(xmit_ctx *ctx) {
+}
+
+#endif /* io_uring */
@@ -0,0 +1,149 @@
+/* workers.c - parallel packet generation for sendip (--threads)
+ * The parent forks n workers once everything has been parsed and the
+ * modules are loaded, but before any packets are built. Each worker
+ * then builds and sends its share of the -l count on its own, with its
+ * own random number streams and, for file (fF) and range arguments,
+ * its own stride through the file or range. When they have all
+ * finished, the parent adds up their statistics.
+ */
+
+#define _GNU_SOURCE	/* for sched_setaffinity */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include "sendip_module.h"
+#include "xmit.h"
+#include "workers.h"
+
+#ifdef __linux__
+#include <sched.h>
+
+/* Pin the calling process to the k'th CPU it is allowed to run on */
+static void workers_pin(int k) {
+	cpu_set_t allowed, mine;
+	int cpu, count;
+
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+		perror("sched_getaffinity");
+		return;
+	}
+	count = CPU_COUNT(&allowed);
+	k %= count;
+	for(cpu=0; cpu<CPU_SETSIZE; cpu++) {
+		if(CPU_ISSET(cpu, &allowed) && k-- == 0)
+			break;
+	}
+	CPU_ZERO(&mine);
+	CPU_SET(cpu, &mine);
+	if(sched_setaffinity(0, sizeof(mine), &mine) < 0)
+		perror("sched_setaffinity");
+}
+#else
+static void workers_pin(int k) {
+	fprintf(stderr,"CPU pinning is only available on Linux\n");
+}
+#endif /* __linux__ */
+
+/* Fork n workers. Returns 0 in each worker (with w->id set) and in the
+ * parent (with w->id -1), or -1 if they couldn't all be started.
+ */
+int workers_start(workers *w, int n, bool pin) {
+	pid_t pid;
+	int k;
+
+	memset(w, 0, sizeof(workers));
+	w->id = -1;
+	w->stats_len = n*sizeof(xmit_stats);
+	w->stats = mmap(NULL, w->stats_len, PROT_READ|PROT_WRITE,
+	                MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	w->pids = malloc(n*sizeof(pid_t));
+	if(w->stats == MAP_FAILED || !w->pids) {
+		perror("OUT OF MEMORY!\n");
+		if(w->stats != MAP_FAILED) munmap(w->stats, w->stats_len);
+		free(w->pids);
+		return -1;
+	}
+	memset(w->stats, 0, w->stats_len);
+
+	/* Don't let the workers write out our buffered output again */
+	fflush(NULL);
+	for(k=0; k<n; k++) {
+		if((pid = fork()) < 0) {
+			/* Their shares assumed n workers, so stop them all */
+			perror("Couldn't start worker");
+			while(--k >= 0) {
+				kill(w->pids[k], SIGTERM);
+				waitpid(w->pids[k], NULL, 0);
+			}
+			munmap(w->stats, w->stats_len);
+			free(w->pids);
+			return -1;
+		}
+		if(pid == 0) {
+			free(w->pids);
+			w->pids = NULL;
+			w->n = n;
+			w->id = k;
+			if(pin) workers_pin(k);
+			/* Stream 0 is the parent's */
+			randomstream(k+1);
+			fa_shard(k, n);
+			range_shard(k, n);
+			return 0;
+		}
+		w->pids[k] = pid;
+	}
+	w->n = n;
+	return 0;
+}
+
+/* This worker's part of total packets. The parent sends none. */
+int workers_share(workers *w, int total) {
+	if(w->id < 0) return 0;
+	return total/w->n + (w->id < total%w->n);
+}
+
+/* Hand our statistics back to the parent */
+void workers_done(workers *w, xmit_stats *stats) {
+	if(w->id < 0) return;
+	w->stats[w->id] = *stats;
+}
+
+/* Wait for all the workers, and add up what they sent. Returns the
+ * number of workers that failed.
+ */
+int workers_wait(workers *w, xmit_stats *total, bool verbose) {
+	int k, status, failed=0;
+
+	for(k=0; k<w->n; k++) {
+		while(waitpid(w->pids[k], &status, 0) < 0) {
+			if(errno != EINTR) {
+				perror("waitpid");
+				status = -1;
+				break;
+			}
+		}
+		if(status != 0) failed++;
+		if(verbose)
+			fprintf(stderr, "Worker %d: %llu packets (%llu bytes) in %llu calls, %llu errors%s\n",
+			        k, w->stats[k].packets, w->stats[k].bytes,
+			        w->stats[k].calls, w->stats[k].errors,
+			        status ? " (failed)" : "");
+		total->packets += w->stats[k].packets;
+		total->bytes += w->stats[k].bytes;
+		total->calls += w->stats[k].calls;
+		total->errors += w->stats[k].errors;
+	}
+	munmap(w->stats, w->stats_len);
+	free(w->pids);
+	w->stats = NULL;
+	w->pids = NULL;
+	return failed;
+}
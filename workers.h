@@ -0,0 +1,23 @@
+/* workers.h - parallel packet generation for sendip (--threads)
+ */
+#ifndef _SENDIP_WORKERS_H
+#define _SENDIP_WORKERS_H
+
+/* Modules keep their state in statics, and are only loaded once, so
+ * the workers are processes rather than threads: each gets its own
+ * copy of every module, buffer and socket for free.
+ */
+typedef struct {
+	int n;			/* number of workers, 0 if not running any */
+	int id;			/* which worker we are, -1 in the parent */
+	pid_t *pids;
+	xmit_stats *stats;	/* one per worker, shared with the parent */
+	size_t stats_len;
+} workers;
+
+int workers_start(workers *w, int n, bool pin);
+int workers_share(workers *w, int total);
+void workers_done(workers *w, xmit_stats *stats);
+int workers_wait(workers *w, xmit_stats *total, bool verbose);
+
+#endif  /* _SENDIP_WORKERS_H */
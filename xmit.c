@@ -0,0 +1,448 @@
+/* xmit.c - packet transmission for sendip
+ * This used to live in sendip.c as sendpacket(), which looked up the
+ * destination and opened (and closed) a raw socket for every packet
+ * sent. Now the destination lookups and the sockets are kept in an
+ * xmit_ctx for the whole run, so all that's left per packet is the
+ * send itself.
+ */
+
+#define _GNU_SOURCE	/* for sendmmsg */
+
+/* socket stuff */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+/* everything else */
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <ctype.h> /* isprint */
+#include "sendip_module.h"
+#include "xmit.h"
+
+#ifdef __sun__  /* for EVILNESS workaround */
+#include "ipv4.h"
+#endif /* __sun__ */
+
+#ifdef __linux__
+#define HAVE_SENDMMSG
+#include <sys/ioctl.h>
+#include <net/if.h>
+#endif
+
+static void dump_packet(sendip_data *data) {
+	int i, j;
+	fprintf(stderr, "Final packet data:\n");
+	for(i=0; i<data->alloc_len; ) {
+		for(j=0; j<4 && i+j<data->alloc_len; j++)
+			fprintf(stderr, "%02X ", ((unsigned char *)(data->data))[i+j]);
+		fprintf(stderr, "  ");
+		for(j=0; j<4 && i+j<data->alloc_len; j++) {
+			int c=(int) ((unsigned char *)(data->data))[i+j];
+			fprintf(stderr, "%c", isprint(c)?((char *)(data->data))[i+j]:'.');
+		}
+		fprintf(stderr, "\n");
+		i+=j;
+	}
+}
+
+void xmit_init(xmit_ctx *ctx, bool verbose) {
+	memset(ctx, 0, sizeof(xmit_ctx));
+	ctx->sock4 = ctx->sock6 = -1;
+	ctx->ring_fd = -1;
+	ctx->verbose = verbose;
+	/* Link level destination defaults to broadcast */
+	memset(ctx->ether, 0xFF, 6);
+}
+
+/* Select the transmit backend by name */
+int xmit_backend(xmit_ctx *ctx, const char *name) {
+	if(!strcmp(name, "raw")) {
+		ctx->backend = XMIT_RAW;
+	} else if(!strcmp(name, "packet")) {
+		ctx->backend = XMIT_PACKET;
+	} else if(!strcmp(name, "xdp")) {
+		ctx->backend = XMIT_XDP;
+	} else if(!strcmp(name, "uring")) {
+		ctx->backend = XMIT_URING;
+	} else {
+		fprintf(stderr,"Unknown transmit method %s\n",name);
+		return -1;
+	}
+	return 0;
+}
+
+/* Parse an Ethernet header description: dst[,src], with each address
+ * as six colon separated hex bytes.
+ */
+int xmit_ether(xmit_ctx *ctx, const char *arg) {
+	unsigned int m[12];
+	int i, n;
+
+	n = sscanf(arg, "%x:%x:%x:%x:%x:%x,%x:%x:%x:%x:%x:%x",
+	           &m[0], &m[1], &m[2], &m[3], &m[4], &m[5],
+	           &m[6], &m[7], &m[8], &m[9], &m[10], &m[11]);
+	if(n != 6 && n != 12) {
+		fprintf(stderr,"Ethernet header should be dst[,src], e.g. 02:00:00:00:00:01\n");
+		return -1;
+	}
+	for(i=0; i<n; i++)
+		ctx->ether[i] = (u_int8_t)m[i];
+	ctx->ether_src = (n == 12);
+	return 0;
+}
+
+/* Default the Ethernet source address to that of the interface,
+ * using s (any socket) for the ioctl
+ */
+void xmit_ether_src(xmit_ctx *ctx, int s) {
+#ifdef SIOCGIFHWADDR
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ctx->ifname, IFNAMSIZ-1);
+	if(ioctl(s, SIOCGIFHWADDR, &ifr) == 0)
+		memcpy(ctx->ether+6, ifr.ifr_hwaddr.sa_data, 6);
+#endif
+}
+
+/* Fill in the Ethernet type for packets of af_type */
+void xmit_ethertype(xmit_ctx *ctx, int af_type) {
+	u_int16_t type = (af_type == AF_INET6) ? 0x86DD : 0x0800;
+
+	ctx->ether[12] = type>>8;
+	ctx->ether[13] = type&0xFF;
+}
+
+/* Find (or resolve and remember) the destination for hostname */
+xmit_dest *xmit_lookup(xmit_ctx *ctx, const char *hostname, int af_type) {
+	xmit_dest *dest;
+
+	/* hostname stuff */
+	struct hostent *host = NULL;      /* result of gethostbyname2 */
+
+	/* casts for specific protocols */
+	struct sockaddr_in *to4;          /* IPv4 */
+	struct sockaddr_in6 *to6;         /* IPv6 */
+
+	for(dest=ctx->dests; dest!=NULL; dest=dest->next) {
+		if(dest->af_type == af_type && !strcmp(dest->hostname, hostname))
+			return dest;
+	}
+
+	if ((host = gethostbyname2(hostname, af_type)) == NULL) {
+		fprintf(stderr,"Couldn't get destination host %s (af %d): ",
+		        hostname, af_type);
+		perror("gethostbyname2");
+		return NULL;
+	}
+
+	dest = malloc(sizeof(xmit_dest));
+	if(dest==NULL) {
+		perror("OUT OF MEMORY!\n");
+		return NULL;
+	}
+	memset(dest, 0, sizeof(xmit_dest));
+	to4 = (struct sockaddr_in *)&dest->to;
+	to6 = (struct sockaddr_in6 *)&dest->to;
+
+	switch (af_type) {
+	case AF_INET:
+		to4->sin_family = host->h_addrtype;
+		memcpy(&to4->sin_addr, host->h_addr, host->h_length);
+		dest->tolen = sizeof(struct sockaddr_in);
+		break;
+	case AF_INET6:
+		to6->sin6_family = host->h_addrtype;
+		memcpy(&to6->sin6_addr, host->h_addr, host->h_length);
+		dest->tolen = sizeof(struct sockaddr_in6);
+		break;
+	default:
+		free(dest);
+		return NULL;
+	}
+	dest->hostname = strdup(hostname);
+	dest->af_type = af_type;
+	dest->next = ctx->dests;
+	ctx->dests = dest;
+	return dest;
+}
+
+/* Get the raw socket for af_type, opening it if need be */
+int xmit_socket(xmit_ctx *ctx, int af_type) {
+	int *sp = (af_type == AF_INET6) ? &ctx->sock6 : &ctx->sock4;
+	int s;
+
+	if(*sp >= 0) return *sp;
+
+	if ((s = socket(af_type, SOCK_RAW, IPPROTO_RAW)) < 0) {
+		perror("Couldn't open RAW socket");
+		return -1;
+	}
+	/* Need this for OpenBSD, shouldn't cause problems elsewhere */
+	/* TODO: should make it a command line option */
+	if(af_type == AF_INET) {
+		const int on=1;
+		if (setsockopt(s, IPPROTO_IP,IP_HDRINCL,(const void *)&on,sizeof(on)) <0) {
+			perror ("Couldn't setsockopt IP_HDRINCL");
+			close(s);
+			return -2;
+		}
+	}
+	*sp = s;
+	return s;
+}
+
+int xmit_send(xmit_ctx *ctx, sendip_data *data, const char *hostname,
+              int af_type) {
+	xmit_dest *dest;
+	int s;                            /* socket for sending       */
+	int sent;                         /* number of bytes sent */
+
+	if(ctx->backend == XMIT_PACKET) {
+		if(ctx->verbose) dump_packet(data);
+		if((sent = txring_queue(ctx, data, af_type)) != TXRING_TOO_BIG)
+			return sent;
+		/* Too big for the ring; send it through a raw socket instead */
+	}
+	if(ctx->backend == XMIT_XDP) {
+		if(ctx->verbose) dump_packet(data);
+		return xsk_queue(ctx, data, af_type);
+	}
+	if(ctx->backend == XMIT_URING) {
+		if(ctx->verbose) dump_packet(data);
+		return uring_queue(ctx, data, hostname, af_type);
+	}
+
+	if((dest = xmit_lookup(ctx, hostname, af_type)) == NULL) {
+		ctx->stats.errors++;
+		return -1;
+	}
+
+	if(ctx->verbose && ctx->backend != XMIT_PACKET) dump_packet(data);
+
+	if ((s = xmit_socket(ctx, af_type)) < 0) {
+		ctx->stats.errors++;
+		return s;
+	}
+
+	/* On Solaris, it seems that the only way to send IP options or packets
+		with a faked IP header length is to:
+		setsockopt(IP_OPTIONS) with the IP option data and size
+		decrease the total length of the packet accordingly
+		I'm sure this *shouldn't* work.  But it does.
+	*/
+#ifdef __sun__
+	if((*((char *)(data->data))&0x0F) != 5) {
+		ip_header *iphdr = (ip_header *)data->data;
+
+		int optlen = iphdr->header_len*4-20;
+
+		if(ctx->verbose)
+			fprintf(stderr, "Solaris workaround enabled for %d IP option bytes\n", optlen);
+
+		iphdr->tot_len = htons(ntohs(iphdr->tot_len)-optlen);
+
+		if(setsockopt(s,IPPROTO_IP,IP_OPTIONS,
+		              (void *)(((char *)(data->data))+20),optlen)) {
+			perror("Couldn't setsockopt IP_OPTIONS");
+			return -2;
+		}
+	}
+#endif /* __sun__ */
+
+	/* Send the packet */
+	sent = sendto(s, (char *)data->data, data->alloc_len, 0,
+	              (void *)&dest->to, dest->tolen);
+	ctx->stats.calls++;
+	if (sent == data->alloc_len) {
+		ctx->stats.packets++;
+		ctx->stats.bytes += sent;
+		if(ctx->verbose) fprintf(stderr, "Sent %d bytes to %s\n",sent,hostname);
+	} else {
+		ctx->stats.errors++;
+		if (sent < 0)
+			perror("sendto");
+		else {
+			if(ctx->verbose) fprintf(stderr, "Only sent %d of %d bytes to %s\n",
+				                         sent, data->alloc_len, hostname);
+		}
+	}
+	return sent;
+}
+
+/* Turn on batching, batch packets at a time */
+int xmit_batch(xmit_ctx *ctx, int batch) {
+	struct mmsghdr *msgs;
+	struct iovec *iovs;
+	int i;
+
+	/* The other backends only need to know how often to kick */
+	if(ctx->backend != XMIT_RAW) {
+		ctx->batch = batch;
+		return 0;
+	}
+
+	ctx->arena = malloc((size_t)batch*XMIT_SLOT);
+	msgs = calloc(batch, sizeof(struct mmsghdr));
+	iovs = calloc(batch, sizeof(struct iovec));
+	if(!ctx->arena || !msgs || !iovs) {
+		perror("OUT OF MEMORY!\n");
+		free(ctx->arena);
+		free(msgs);
+		free(iovs);
+		ctx->arena = NULL;
+		return -1;
+	}
+	for(i=0; i<batch; i++) {
+		iovs[i].iov_base = ctx->arena+(size_t)i*XMIT_SLOT;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	ctx->msgs = msgs;
+	ctx->iovs = iovs;
+	ctx->batch = batch;
+	ctx->queued = 0;
+	return 0;
+}
+
+/* Copy the packet into the next free slot, sending the batch if that
+ * fills it. Note the Solaris IP_OPTIONS workaround in xmit_send() is
+ * not applied to batched packets.
+ */
+int xmit_queue(xmit_ctx *ctx, sendip_data *data, const char *hostname,
+               int af_type) {
+	struct mmsghdr *msgs = (struct mmsghdr *)ctx->msgs;
+	struct iovec *iovs = (struct iovec *)ctx->iovs;
+	xmit_dest *dest;
+
+	/* The other backends do their own batching */
+	if(ctx->backend != XMIT_RAW)
+		return xmit_send(ctx, data, hostname, af_type);
+
+	if((dest = xmit_lookup(ctx, hostname, af_type)) == NULL) {
+		ctx->stats.errors++;
+		return -1;
+	}
+	if(data->alloc_len > XMIT_SLOT) {
+		fprintf(stderr,"Packet of %d bytes too big to batch\n",data->alloc_len);
+		ctx->stats.errors++;
+		return -1;
+	}
+	if(ctx->queued && ctx->batch_af != af_type)
+		xmit_flush(ctx);
+
+	if(ctx->verbose) dump_packet(data);
+
+	memcpy(iovs[ctx->queued].iov_base, data->data, data->alloc_len);
+	iovs[ctx->queued].iov_len = data->alloc_len;
+	msgs[ctx->queued].msg_hdr.msg_name = (void *)&dest->to;
+	msgs[ctx->queued].msg_hdr.msg_namelen = dest->tolen;
+	ctx->batch_af = af_type;
+	if(++ctx->queued == ctx->batch)
+		xmit_flush(ctx);
+	return data->alloc_len;
+}
+
+/* Send everything queued. A packet the kernel refuses is counted as an
+ * error and skipped, and the rest of the batch is still sent. Returns
+ * the number of packets that went out.
+ */
+int xmit_flush(xmit_ctx *ctx) {
+	struct mmsghdr *msgs = (struct mmsghdr *)ctx->msgs;
+	struct iovec *iovs = (struct iovec *)ctx->iovs;
+	int s, i, n;
+	int done=0, good=0;
+
+	if(ctx->backend == XMIT_PACKET)
+		return txring_flush(ctx, FALSE);
+	if(ctx->backend == XMIT_XDP)
+		return xsk_flush(ctx);
+	if(ctx->backend == XMIT_URING)
+		return uring_flush(ctx);
+	if(!ctx->queued) return 0;
+	if((s = xmit_socket(ctx, ctx->batch_af)) < 0) {
+		ctx->stats.errors += ctx->queued;
+		ctx->queued = 0;
+		return 0;
+	}
+
+	while(done < ctx->queued) {
+#ifdef HAVE_SENDMMSG
+		n = sendmmsg(s, msgs+done, ctx->queued-done, 0);
+		ctx->stats.calls++;
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			perror("sendmmsg");
+			ctx->stats.errors++;
+			done++;
+			continue;
+		}
+#else
+		n = sendto(s, iovs[done].iov_base, iovs[done].iov_len, 0,
+		           msgs[done].msg_hdr.msg_name,
+		           msgs[done].msg_hdr.msg_namelen);
+		ctx->stats.calls++;
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			perror("sendto");
+			ctx->stats.errors++;
+			done++;
+			continue;
+		}
+		msgs[done].msg_len = n;
+		n = 1;
+#endif
+		for(i=done; i<done+n; i++) {
+			if(msgs[i].msg_len == iovs[i].iov_len) {
+				ctx->stats.packets++;
+				ctx->stats.bytes += msgs[i].msg_len;
+				good++;
+			} else {
+				if(ctx->verbose)
+					fprintf(stderr, "Only sent %u of %d bytes\n",
+					        msgs[i].msg_len, (int)iovs[i].iov_len);
+				ctx->stats.errors++;
+			}
+		}
+		done += n;
+	}
+	if(ctx->verbose)
+		fprintf(stderr, "Sent batch of %d packets\n", good);
+	ctx->queued = 0;
+	return good;
+}
+
+void xmit_report(xmit_ctx *ctx) {
+	if(!ctx->verbose) return;
+	fprintf(stderr, "Sent %llu packets (%llu bytes) in %llu calls, %llu errors\n",
+	        ctx->stats.packets, ctx->stats.bytes, ctx->stats.calls,
+	        ctx->stats.errors);
+}
+
+void xmit_close(xmit_ctx *ctx) {
+	xmit_dest *dest, *next;
+
+	txring_close(ctx);
+	xsk_close(ctx);
+	uring_close(ctx);
+	if(ctx->sock4 >= 0) close(ctx->sock4);
+	if(ctx->sock6 >= 0) close(ctx->sock6);
+	for(dest=ctx->dests; dest!=NULL; dest=next) {
+		next = dest->next;
+		free(dest->hostname);
+		free(dest);
+	}
+	free(ctx->arena);
+	free(ctx->msgs);
+	free(ctx->iovs);
+	ctx->sock4 = ctx->sock6 = -1;
+	ctx->dests = NULL;
+	ctx->arena = NULL;
+	ctx->msgs = ctx->iovs = NULL;
+	ctx->batch = ctx->queued = 0;
+}
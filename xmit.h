@@ -0,0 +1,121 @@
+/* xmit.h - packet transmission for sendip
+ */
+#ifndef _SENDIP_XMIT_H
+#define _SENDIP_XMIT_H
+
+/* sockaddr_storage struct is not defined everywhere, so here is our own
+	nasty version
+*/
+typedef struct {
+	u_int16_t ss_family;
+	u_int32_t ss_align;
+	char ss_padding[122];
+} _sockaddr_storage;
+
+/* A resolved destination. These are looked up once per hostname and
+ * address family and then kept for the rest of the run.
+ */
+typedef struct _xmit_dest {
+	struct _xmit_dest *next;
+	char *hostname;
+	int af_type;
+	_sockaddr_storage to;
+	int tolen;
+} xmit_dest;
+
+/* Run statistics */
+typedef struct {
+	unsigned long long packets;	/* packets handed to the kernel */
+	unsigned long long bytes;
+	unsigned long long errors;	/* packets that failed or were cut short */
+	unsigned long long calls;	/* send system calls made */
+} xmit_stats;
+
+/* Transmit backends */
+#define XMIT_RAW	0	/* SOCK_RAW sockets, one per address family */
+#define XMIT_PACKET	1	/* PF_PACKET TX_RING on a single interface */
+#define XMIT_XDP	2	/* AF_XDP socket on a single interface */
+#define XMIT_URING	3	/* SOCK_RAW sockets driven through io_uring */
+
+/* Largest packet a batch slot has to hold */
+#define XMIT_SLOT	65536
+
+/* Sender context: one raw socket per address family, opened on first
+ * use and reused for every packet after that.
+ *
+ * With batching turned on, packets are copied into a ring of slots and
+ * go out batch at a time with sendmmsg() (or a sendto() loop where
+ * that doesn't exist). All the packets in a batch share a socket, so
+ * the batch is flushed early if the address family changes.
+ */
+typedef struct {
+	int backend;		/* XMIT_RAW, XMIT_PACKET, ... */
+	int sock4;
+	int sock6;
+	xmit_dest *dests;
+	bool verbose;
+	xmit_stats stats;
+
+	/* link level backends */
+	char *ifname;
+	u_int8_t ether[14];	/* Ethernet header put in front of each packet */
+	bool ether_src;		/* source address given with --ether */
+
+	/* PACKET_TX_RING (txring.c) */
+	int ring_fd;
+	char *ring;		/* the mmapped ring */
+	size_t ring_len;
+	int ring_frames;	/* number of frames in the ring */
+	int frame_size;
+	int ring_next;		/* next frame to fill */
+	int ring_pending;	/* frames filled since the last kick */
+
+	/* AF_XDP (xsk.c) */
+	void *xsk;		/* socket, UMEM and rings, set up on first use */
+
+	/* io_uring (uring.c) */
+	void *uring;		/* ring and packet slots, set up on first use */
+
+	/* batching */
+	int batch;		/* slots in the batch; 0 means no batching */
+	int queued;		/* slots currently in use */
+	int batch_af;		/* address family of the queued packets */
+	char *arena;		/* batch*XMIT_SLOT bytes of packet data */
+	void *msgs;		/* struct mmsghdr[batch] */
+	void *iovs;		/* struct iovec[batch] */
+} xmit_ctx;
+
+void xmit_init(xmit_ctx *ctx, bool verbose);
+xmit_dest *xmit_lookup(xmit_ctx *ctx, const char *hostname, int af_type);
+int xmit_socket(xmit_ctx *ctx, int af_type);
+int xmit_send(xmit_ctx *ctx, sendip_data *data, const char *hostname,
+              int af_type);
+int xmit_backend(xmit_ctx *ctx, const char *name);
+int xmit_ether(xmit_ctx *ctx, const char *arg);
+void xmit_ether_src(xmit_ctx *ctx, int s);
+void xmit_ethertype(xmit_ctx *ctx, int af_type);
+int xmit_batch(xmit_ctx *ctx, int batch);
+int xmit_queue(xmit_ctx *ctx, sendip_data *data, const char *hostname,
+               int af_type);
+int xmit_flush(xmit_ctx *ctx);
+void xmit_report(xmit_ctx *ctx);
+void xmit_close(xmit_ctx *ctx);
+
+/* txring.c */
+#define TXRING_TOO_BIG	(-3)	/* txring_queue(): packet won't fit a frame */
+int txring_queue(xmit_ctx *ctx, sendip_data *data, int af_type);
+int txring_flush(xmit_ctx *ctx, bool wait);
+void txring_close(xmit_ctx *ctx);
+
+/* xsk.c */
+int xsk_queue(xmit_ctx *ctx, sendip_data *data, int af_type);
+int xsk_flush(xmit_ctx *ctx);
+void xsk_close(xmit_ctx *ctx);
+
+/* uring.c */
+int uring_queue(xmit_ctx *ctx, sendip_data *data, const char *hostname,
+                int af_type);
+int uring_flush(xmit_ctx *ctx);
+void uring_close(xmit_ctx *ctx);
+
+#endif  /* _SENDIP_XMIT_H */
@@ -0,0 +1,332 @@
+/* xsk.c - AF_XDP transmit backend for sendip
+ * Finished packets are copied, behind an Ethernet header, into chunks
+ * of a UMEM area registered with an AF_XDP socket, and their
+ * descriptors put on the socket's TX ring. The ring is published and
+ * the kernel kicked once every batch of packets (--batch, default
+ * XSK_KICK), and chunks come back through the completion ring.
+ *
+ * The socket is bound in copy (generic XDP) mode, so it works on any
+ * interface, veth pairs included, without driver support. Only queue 0
+ * is used. No XDP program is needed since nothing is received.
+ *
+ * Linux only, and needs a kernel with AF_XDP (4.18 or later).
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "sendip_module.h"
+#include "xmit.h"
+
+#if defined(__linux__) && defined(AF_XDP)
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <linux/if_xdp.h>
+#include <linux/if_ether.h>
+
+#ifndef SOL_XDP
+#define SOL_XDP	283
+#endif
+
+#define XSK_FRAMES	4096	/* UMEM chunks, and entries in each ring */
+#define XSK_KICK	64	/* packets between kicks without --batch */
+#define XSK_RETRIES	1000	/* 1ms waits before giving up on the rings */
+#define XSK_SPINS	1000	/* kicks before waiting 1ms between them */
+
+/* One of the rings shared with the kernel */
+typedef struct {
+	u_int32_t *producer;
+	u_int32_t *consumer;
+	void *desc;
+	void *map;
+	size_t map_len;
+} xsk_ring;
+
+typedef struct {
+	int fd;
+	char *umem;
+	size_t umem_len;
+	u_int32_t frame_size;
+	xsk_ring tx;
+	xsk_ring cq;
+	u_int32_t tx_prod;	/* our copy of the TX producer index */
+	u_int64_t *free;	/* addresses of the chunks not in use */
+	int nfree;
+	int pending;		/* packets queued since the last kick */
+} xsk_state;
+
+static int xsk_map(int s, xsk_ring *ring, struct xdp_ring_offset *off,
+                   size_t entry, off_t pgoff) {
+	ring->map_len = off->desc + XSK_FRAMES*entry;
+	ring->map = mmap(NULL, ring->map_len, PROT_READ|PROT_WRITE,
+	                 MAP_SHARED|MAP_POPULATE, s, pgoff);
+	if(ring->map == MAP_FAILED) {
+		ring->map = NULL;
+		return -1;
+	}
+	ring->producer = (u_int32_t *)((char *)ring->map + off->producer);
+	ring->consumer = (u_int32_t *)((char *)ring->map + off->consumer);
+	ring->desc = (char *)ring->map + off->desc;
+	return 0;
+}
+
+static void xsk_free(xsk_state *x) {
+	if(x->tx.map) munmap(x->tx.map, x->tx.map_len);
+	if(x->cq.map) munmap(x->cq.map, x->cq.map_len);
+	if(x->fd >= 0) close(x->fd);
+	if(x->umem) munmap(x->umem, x->umem_len);
+	free(x->free);
+	free(x);
+}
+
+static xsk_state *xsk_open(xmit_ctx *ctx, int pktlen) {
+	xsk_state *x;
+	struct xdp_umem_reg reg;
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp;
+	socklen_t optlen;
+	unsigned int ifindex;
+	int entries = XSK_FRAMES;
+	int i;
+
+	if(!ctx->ifname || !(ifindex = if_nametoindex(ctx->ifname))) {
+		fprintf(stderr,"XDP transmit needs a valid interface (--iface)\n");
+		return NULL;
+	}
+	/* Aligned chunks have to be a power of 2, at most a page */
+	if(ETH_HLEN+pktlen > 4096) {
+		fprintf(stderr,"Packet of %d bytes too big for XDP transmit\n",pktlen);
+		return NULL;
+	}
+
+	if((x = malloc(sizeof(xsk_state))) == NULL) {
+		perror("OUT OF MEMORY!\n");
+		return NULL;
+	}
+	memset(x, 0, sizeof(xsk_state));
+	x->frame_size = (ETH_HLEN+pktlen > 2048) ? 4096 : 2048;
+	x->umem_len = (size_t)XSK_FRAMES*x->frame_size;
+	x->free = malloc(XSK_FRAMES*sizeof(u_int64_t));
+	x->umem = mmap(NULL, x->umem_len, PROT_READ|PROT_WRITE,
+	               MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(x->umem == MAP_FAILED) x->umem = NULL;
+	if((x->fd = socket(AF_XDP, SOCK_RAW, 0)) < 0) {
+		perror("Couldn't open AF_XDP socket");
+		xsk_free(x);
+		return NULL;
+	}
+	if(!x->free || !x->umem) {
+		perror("OUT OF MEMORY!\n");
+		xsk_free(x);
+		return NULL;
+	}
+	for(i=0; i<XSK_FRAMES; i++)
+		x->free[i] = (u_int64_t)i*x->frame_size;
+	x->nfree = XSK_FRAMES;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (u_int64_t)(unsigned long)x->umem;
+	reg.len = x->umem_len;
+	reg.chunk_size = x->frame_size;
+	reg.headroom = 0;
+	if(setsockopt(x->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+		perror("Couldn't register UMEM");
+		xsk_free(x);
+		return NULL;
+	}
+	/* The kernel insists on a fill ring even though we never receive */
+	if(setsockopt(x->fd, SOL_XDP, XDP_UMEM_FILL_RING, &entries, sizeof(entries)) < 0 ||
+	   setsockopt(x->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &entries, sizeof(entries)) < 0 ||
+	   setsockopt(x->fd, SOL_XDP, XDP_TX_RING, &entries, sizeof(entries)) < 0) {
+		perror("Couldn't set up XDP rings");
+		xsk_free(x);
+		return NULL;
+	}
+	optlen = sizeof(off);
+	if(getsockopt(x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+		perror("Couldn't get XDP ring offsets");
+		xsk_free(x);
+		return NULL;
+	}
+	if(xsk_map(x->fd, &x->tx, &off.tx, sizeof(struct xdp_desc),
+	           XDP_PGOFF_TX_RING) < 0 ||
+	   xsk_map(x->fd, &x->cq, &off.cr, sizeof(u_int64_t),
+	           XDP_UMEM_PGOFF_COMPLETION_RING) < 0) {
+		perror("Couldn't mmap XDP rings");
+		xsk_free(x);
+		return NULL;
+	}
+
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = ifindex;
+	sxdp.sxdp_queue_id = 0;
+	sxdp.sxdp_flags = XDP_COPY;
+	if(bind(x->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+		perror("Couldn't bind AF_XDP socket");
+		xsk_free(x);
+		return NULL;
+	}
+	if(!ctx->ether_src)
+		xmit_ether_src(ctx, x->fd);
+	x->tx_prod = *x->tx.producer;
+
+	if(ctx->verbose)
+		fprintf(stderr, "XDP transmit on %s: %d chunks of %u bytes\n",
+		        ctx->ifname, XSK_FRAMES, x->frame_size);
+	return x;
+}
+
+/* Take back the chunks the kernel has finished with */
+static void xsk_reap(xsk_state *x) {
+	u_int64_t *addrs = (u_int64_t *)x->cq.desc;
+	u_int32_t cons = *x->cq.consumer;
+	u_int32_t prod = __atomic_load_n(x->cq.producer, __ATOMIC_ACQUIRE);
+
+	if(cons == prod) return;
+	while(cons != prod)
+		x->free[x->nfree++] = addrs[cons++ & (XSK_FRAMES-1)];
+	__atomic_store_n(x->cq.consumer, cons, __ATOMIC_RELEASE);
+}
+
+/* Publish the queued descriptors and kick the kernel until it has
+ * taken them all off the TX ring. In copy mode each kick only sends a
+ * few dozen packets.
+ */
+/* Publish the TX ring and kick the kernel until it has taken the lot.
+ * Once it stops taking them, kick only every millisecond, and give up
+ * if the ring hasn't moved for XSK_RETRIES of those (the interface is
+ * down, or the driver has stalled) rather than spin for ever.
+ */
+static int xsk_kick(xmit_ctx *ctx, xsk_state *x) {
+	u_int32_t cons, last;
+	int spins = 0, waits = 0;
+
+	__atomic_store_n(x->tx.producer, x->tx_prod, __ATOMIC_RELEASE);
+	last = __atomic_load_n(x->tx.consumer, __ATOMIC_ACQUIRE);
+	while(last != x->tx_prod) {
+		ctx->stats.calls++;
+		if(sendto(x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+		   errno != EAGAIN && errno != EBUSY && errno != ENOBUFS &&
+		   errno != EINTR) {
+			perror("Couldn't kick XDP socket");
+			return -1;
+		}
+		cons = __atomic_load_n(x->tx.consumer, __ATOMIC_ACQUIRE);
+		if(cons != last) {
+			last = cons;
+			spins = waits = 0;
+		} else if(++spins >= XSK_SPINS) {
+			if(++waits > XSK_RETRIES) {
+				fprintf(stderr,"XDP transmit ring isn't draining; is the interface up?\n");
+				return -1;
+			}
+			poll(NULL, 0, 1);
+		}
+	}
+	x->pending = 0;
+	xsk_reap(x);
+	return 0;
+}
+
+int xsk_flush(xmit_ctx *ctx) {
+	xsk_state *x = (xsk_state *)ctx->xsk;
+
+	if(!x || !x->pending) return 0;
+	return xsk_kick(ctx, x);
+}
+
+int xsk_queue(xmit_ctx *ctx, sendip_data *data, int af_type) {
+	xsk_state *x = (xsk_state *)ctx->xsk;
+	struct xdp_desc *desc;
+	u_int8_t *frame;
+	u_int64_t addr;
+	int tries;
+
+	if(!x && (ctx->xsk = x = xsk_open(ctx, data->alloc_len)) == NULL) {
+		ctx->stats.errors++;
+		return -1;
+	}
+	if(ETH_HLEN+data->alloc_len > x->frame_size) {
+		fprintf(stderr,"Packet of %d bytes too big for XDP transmit\n",
+		        data->alloc_len);
+		ctx->stats.errors++;
+		return -1;
+	}
+
+	/* Wait for the kernel to give a chunk back */
+	if(!x->nfree) xsk_reap(x);
+	for(tries=0; !x->nfree; tries++) {
+		if(tries >= XSK_SPINS+XSK_RETRIES) {
+			fprintf(stderr,"XDP completions aren't coming back\n");
+			ctx->stats.errors++;
+			return -1;
+		}
+		if(xsk_kick(ctx, x) < 0) {
+			ctx->stats.errors++;
+			return -1;
+		}
+		if(!x->nfree && tries >= XSK_SPINS)
+			poll(NULL, 0, 1);
+	}
+
+	addr = x->free[--x->nfree];
+	frame = (u_int8_t *)x->umem + addr;
+	xmit_ethertype(ctx, af_type);
+	memcpy(frame, ctx->ether, ETH_HLEN);
+	memcpy(frame+ETH_HLEN, data->data, data->alloc_len);
+
+	desc = (struct xdp_desc *)x->tx.desc + (x->tx_prod & (XSK_FRAMES-1));
+	desc->addr = addr;
+	desc->len = ETH_HLEN+data->alloc_len;
+	desc->options = 0;
+	x->tx_prod++;
+
+	ctx->stats.packets++;
+	ctx->stats.bytes += data->alloc_len;
+	if(++x->pending >= (ctx->batch ? ctx->batch : XSK_KICK))
+		xsk_kick(ctx, x);
+	return data->alloc_len;
+}
+
+void xsk_close(xmit_ctx *ctx) {
+	xsk_state *x = (xsk_state *)ctx->xsk;
+	struct xdp_statistics st;
+	socklen_t optlen = sizeof(st);
+	int tries;
+
+	if(!x) return;
+	xsk_kick(ctx, x);
+	/* Don't tear down the UMEM under packets still being sent */
+	for(tries=0; x->nfree < XSK_FRAMES && tries < XSK_RETRIES; tries++) {
+		poll(NULL, 0, 1);
+		xsk_reap(x);
+	}
+	if(getsockopt(x->fd, SOL_XDP, XDP_STATISTICS, &st, &optlen) == 0)
+		ctx->stats.errors += st.tx_invalid_descs;
+	xsk_free(x);
+	ctx->xsk = NULL;
+}
+
+#else /* !__linux__ */
+
+int xsk_queue(xmit_ctx *ctx, sendip_data *data, int af_type) {
+	fprintf(stderr,"XDP transmit is only available on Linux\n");
+	ctx->stats.errors++;
+	return -1;
+}
+
+int xsk_flush(xmit_ctx *ctx) {
+	return 0;
+}
+
+void xsk_close(xmit_ctx *ctx) {
+}
+
+#endif /* __linux__ */